@@ -0,0 +1,200 @@
+//==============================================================================
+// INCLUDES
+//==============================================================================
+
+#include <pw/hsm.hpp>
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+/*
+* Benchmark of StateMachine::dispatch_batch against calling 
+* StateMachine::dispatch once per event for batches of 1000 events.
+*
+* The machine is four states deep and the benchmarked events are handled by
+* the root state, so every event has to be offered to each state of the 
+* active configuration. Each batch ends with an event which causes a 
+* transition, so the batch dispatcher has to re-resolve its chain once per
+* batch.
+*/
+
+namespace batch_dispatch
+{
+
+//==============================================================================
+// EVENTS
+//==============================================================================
+
+class ESample;
+class EToggle;
+
+using Handler = pw::hsm::EventHandler<ESample, EToggle>;
+
+class ESample : public pw::hsm::Event<ESample, Handler>
+{
+public:
+	ESample(int value = 0) : _value(value) {}
+	
+	auto value() const { return _value; }
+	
+private:
+	int _value;
+};
+
+class EToggle : public pw::hsm::Event<EToggle, Handler>
+{
+	
+};
+
+using AbstractEvent = pw::hsm::AbstractEvent<Handler>;
+
+//==============================================================================
+// STATES
+//==============================================================================
+
+class Machine;
+class SRoot;
+class SA;
+class SA1;
+class SA11;
+class SB;
+
+/*
+* Machine
+* |_ SRoot
+*    |_ SA
+*       |_ SA1
+*          |_ SA11
+*    |_ SB
+*/
+
+class SA11 : public pw::hsm::State<SA11, Handler, SA1>
+{
+public:
+	SA11(Parent& parent) : State(parent) {}
+	
+	//Keeps the other handlers visible, so that batches of ESample skip this state
+	using State::handle;
+	
+	HandleResult handle(const EToggle& e) override
+	{
+		return transition<SB>();
+	}
+};
+
+class SA1 : public pw::hsm::State<SA1, Handler, SA, SA11>
+{
+public:
+	SA1(Parent& parent) : State(parent) {}
+};
+
+class SA : public pw::hsm::State<SA, Handler, SRoot, SA1>
+{
+public:
+	SA(Parent& parent) : State(parent) {}
+};
+
+class SB : public pw::hsm::State<SB, Handler, SRoot>
+{
+public:
+	SB(Parent& parent) : State(parent) {}
+	
+	//Keeps the other handlers visible, so that batches of ESample skip this state
+	using State::handle;
+	
+	HandleResult handle(const EToggle& e) override
+	{
+		return transition<SA>();
+	}
+};
+
+class SRoot : public pw::hsm::State<SRoot, Handler, Machine, SA, SB>
+{
+public:
+	SRoot(Parent& parent) : State(parent) {}
+	
+	HandleResult handle(const ESample& e) override
+	{
+		sum += e.value();
+		return kHandled;
+	}
+	
+public:
+	long sum = 0;
+};
+
+class Machine : public pw::hsm::StateMachine<Machine, SRoot>
+{
+	
+};
+
+} //namespace batch_dispatch
+
+//==============================================================================
+// MAIN
+//==============================================================================
+
+using namespace batch_dispatch;
+
+constexpr std::size_t kBatchSize = 1000;
+constexpr int kRounds = 10000;
+
+template <typename F>
+static void measure(const char* name, F&& f)
+{
+	const auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < kRounds; ++i)
+	{
+		f();
+	}
+	const auto elapsed = std::chrono::steady_clock::now() - start;
+	
+	const double ns = std::chrono::duration<double, std::nano>(elapsed).count();
+	std::cout << name << ": " << ns / (kRounds * kBatchSize) << " ns/event" << std::endl;
+}
+
+int main()
+{
+	Machine sm;
+	
+	//Typed batch: 999 samples followed by one transition
+	std::vector<ESample> samples;
+	for (std::size_t i = 0; i < kBatchSize - 1; ++i)
+	{
+		samples.emplace_back(int(i));
+	}
+	
+	//Type-erased batch with the same content
+	EToggle toggle;
+	std::vector<const AbstractEvent*> erased;
+	for (auto& s : samples)
+	{
+		erased.push_back(&s);
+	}
+	erased.push_back(&toggle);
+	
+	measure("dispatch (loop)      ", [&]{
+		for (auto* e : erased)
+		{
+			sm.dispatch(*e);
+		}
+	});
+	
+	measure("dispatch_batch(typed)", [&]{
+		sm.dispatch_batch(samples);
+		sm.dispatch(toggle);
+	});
+	
+	measure("dispatch_batch(erased)", [&]{
+		sm.dispatch_batch(erased);
+	});
+	
+	const auto summary = sm.dispatch_batch(erased);
+	std::cout << "last batch: handled=" << summary.handled 
+		<< " passed=" << summary.passed 
+		<< " transitions=" << summary.transitions << std::endl;
+	
+	std::cout << "checksum: " << sm.root().sum << std::endl;
+	
+	return 0;
+}
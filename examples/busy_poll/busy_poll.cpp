@@ -0,0 +1,192 @@
+//==============================================================================
+// INCLUDES
+//==============================================================================
+
+#include <pw/hsm.hpp>
+#include <pw/hsm/busy_poll.hpp>
+#include <pw/hsm/locking_queue.hpp>
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <iostream>
+#include <thread>
+
+using namespace std::chrono_literals;
+
+/*
+* Wakeup latency of pw::hsm::BusyPollRunner in each PollMode, compared with
+* a thread blocked in LockingEventQueue::wait_and_pop().
+*
+* A producer posts kSamples events, sleeping kGap between them so that the
+* runner is waiting for each one. For each mode, the program prints the
+* latency percentiles from the runner's statistics and the CPU time the
+* process used per second of the run, which shows what the latency costs.
+*/
+
+namespace busy_poll
+{
+
+//==============================================================================
+// EVENTS
+//==============================================================================
+
+class EPing;
+
+using Handler = pw::hsm::EventHandler<EPing>;
+
+class EPing : public pw::hsm::Event<EPing, Handler>
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	EPing(Clock::time_point sent = {}) : _sent(sent) {}
+
+	auto sent() const { return _sent; }
+
+private:
+	Clock::time_point _sent;
+};
+
+constexpr std::size_t kSamples = 5000;
+constexpr auto kGap = 100us;
+
+//==============================================================================
+// STATE MACHINE
+//==============================================================================
+
+class Echo;
+
+class SListening : public pw::hsm::State<SListening, Handler, Echo>
+{
+public:
+	SListening(Parent& parent) : State(parent) {}
+
+	HandleResult handle(const EPing& e) override;
+};
+
+class Echo : public pw::hsm::StateMachine<Echo, SListening>
+{
+public:
+	/**
+	* @brief Latencies measured by the handler itself (for the locking
+	*        queue baseline, which has no statistics of its own)
+	*/
+	pw::hsm::LatencyHistogram latency{};
+};
+
+SListening::HandleResult SListening::handle(const EPing& e)
+{
+	sm().latency.record(EPing::Clock::now() - e.sent());
+	return kHandled;
+}
+
+//==============================================================================
+// CONFIGURATIONS
+//==============================================================================
+
+struct SpinConfig : pw::hsm::PollConfig
+{
+	static constexpr pw::hsm::PollMode kMode = pw::hsm::PollMode::kSpin;
+};
+
+struct SpinYieldConfig : pw::hsm::PollConfig
+{
+	static constexpr pw::hsm::PollMode kMode = pw::hsm::PollMode::kSpinYield;
+};
+
+struct SpinParkConfig : pw::hsm::PollConfig
+{
+	static constexpr pw::hsm::PollMode kMode = pw::hsm::PollMode::kSpinPark;
+};
+
+} //namespace busy_poll
+
+//==============================================================================
+// MAIN
+//==============================================================================
+
+using namespace busy_poll;
+
+static void report(const char* name, const pw::hsm::LatencyHistogram& latency, double cpu)
+{
+	auto us = [](std::chrono::nanoseconds d) { return std::chrono::duration<double, std::micro>(d).count(); };
+
+	std::cout << name << ": " << latency.count() << " wakeups, p50 <= " << us(latency.percentile(0.5))
+		<< " us, p99 <= " << us(latency.percentile(0.99))
+		<< " us, p99.9 <= " << us(latency.percentile(0.999))
+		<< " us, cpu " << cpu << " s/s" << std::endl;
+}
+
+/**
+* @brief Post kSamples events to post, kGap apart
+*
+* @return CPU seconds used by the process per second of the run
+*/
+template <typename POST>
+static double produce(POST&& post)
+{
+	const std::clock_t cpu = std::clock();
+	const auto start = std::chrono::steady_clock::now();
+
+	for (std::size_t i = 0; i < kSamples; ++i)
+	{
+		std::this_thread::sleep_for(kGap);
+		post(EPing(EPing::Clock::now()));
+	}
+
+	const std::chrono::duration<double> wall = std::chrono::steady_clock::now() - start;
+	return double(std::clock() - cpu) / CLOCKS_PER_SEC / wall.count();
+}
+
+template <typename CONFIG>
+static void measure(const char* name)
+{
+	pw::hsm::BusyPollRunner<Echo, CONFIG> runner;
+	const double cpu = produce([&runner](const EPing& e) { runner.post(e); });
+
+	//Let the last event through before reading the statistics
+	std::this_thread::sleep_for(10ms);
+	const auto stats = runner.stats();
+
+	report(name, stats.wakeup, cpu);
+	std::cout << "  " << stats.events << " events, " << stats.yields << " yields, " << stats.parks << " parks" << std::endl;
+}
+
+static void measure_locking_queue()
+{
+	pw::hsm::LockingEventQueue<Handler> queue;
+	Echo echo;
+	std::atomic<bool> stop{false};
+
+	std::thread consumer([&]() {
+		pw::hsm::LockingEventQueue<Handler>::Envelope e;
+		while (!stop.load(std::memory_order_relaxed))
+		{
+			if (queue.wait_and_pop(e))
+			{
+				echo.dispatch(*e);
+			}
+		}
+	});
+
+	const double cpu = produce([&queue](const EPing& e) { queue.push(e); });
+
+	stop = true;
+	queue.wake();
+	consumer.join();
+
+	report("locking queue", echo.latency, cpu);
+}
+
+int main()
+{
+	std::cout << kSamples << " events, " << std::chrono::microseconds(kGap).count() << " us apart, "
+		<< std::thread::hardware_concurrency() << " CPUs" << std::endl;
+
+	measure_locking_queue();
+	measure<SpinParkConfig>("spin-then-park");
+	measure<SpinYieldConfig>("spin-then-yield");
+	measure<SpinConfig>("spin");
+
+	return 0;
+}
@@ -0,0 +1,284 @@
+//==============================================================================
+// INCLUDES
+//==============================================================================
+
+#include <pw/hsm.hpp>
+#include <pw/hsm/coroutine.hpp>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+
+/*
+* A three-step handshake written once as a pw::hsm::CoroutineState and once
+* as one substate per step.
+*
+* After EConnect, the link waits for EHelloAck, then for EAuth (and gives up
+* if the token is wrong), then for EReady, and is connected. Both machines
+* run the handshake kRounds times; the program prints the time per handshake
+* and how much of the coroutine machine's arena the handshake's frame used.
+*/
+
+namespace coroutine_states
+{
+
+//==============================================================================
+// EVENTS
+//==============================================================================
+
+class EConnect;
+class EHelloAck;
+class EAuth;
+class EReady;
+class EDisconnect;
+
+using Handler = pw::hsm::EventHandler<EConnect, EHelloAck, EAuth, EReady, EDisconnect>;
+
+class EConnect : public pw::hsm::Event<EConnect, Handler> {};
+class EHelloAck : public pw::hsm::Event<EHelloAck, Handler> {};
+
+class EAuth : public pw::hsm::Event<EAuth, Handler>
+{
+public:
+	EAuth(std::uint32_t token) : _token(token) {}
+
+	auto token() const { return _token; }
+
+private:
+	std::uint32_t _token;
+};
+
+class EReady : public pw::hsm::Event<EReady, Handler> {};
+class EDisconnect : public pw::hsm::Event<EDisconnect, Handler> {};
+
+constexpr std::uint32_t kToken = 0x5eed;
+constexpr std::size_t kRounds = 1000000;
+
+//==============================================================================
+// COROUTINE LINK
+//==============================================================================
+
+class CoroutineLink;
+class SCoRoot;
+class SCoIdle;
+class SCoHandshake;
+class SCoConnected;
+
+class SCoIdle : public pw::hsm::State<SCoIdle, Handler, SCoRoot>
+{
+public:
+	SCoIdle(Parent& parent) : State(parent) {}
+
+	HandleResult handle(const EConnect& e) override { return transition<SCoHandshake>(); }
+};
+
+/**
+* @brief The whole handshake in one state
+*/
+class SCoHandshake : public pw::hsm::CoroutineState<SCoHandshake, Handler, SCoRoot, EHelloAck, EAuth, EReady>
+{
+public:
+	SCoHandshake(Parent& parent) : CoroutineState(parent)
+	{
+		start(run());
+	}
+
+private:
+	Body run();
+};
+
+class SCoConnected : public pw::hsm::State<SCoConnected, Handler, SCoRoot>
+{
+public:
+	SCoConnected(Parent& parent);
+
+	HandleResult handle(const EDisconnect& e) override { return transition<SCoIdle>(); }
+};
+
+class SCoRoot : public pw::hsm::State<SCoRoot, Handler, CoroutineLink, SCoIdle, SCoHandshake, SCoConnected>
+{
+public:
+	SCoRoot(Parent& parent) : State(parent) {}
+};
+
+/**
+* @brief Holds the arena in a base class which precedes StateMachine, so that
+*        it outlives the states
+*/
+class CoroutineLinkServices
+{
+public:
+	auto& coroutine_arena() { return _arena; }
+
+protected:
+	pw::hsm::CoroutineArena<512> _arena;
+};
+
+class CoroutineLink :
+	public CoroutineLinkServices,
+	public pw::hsm::StateMachine<CoroutineLink, SCoRoot>
+{
+public:
+	std::size_t connected = 0;
+};
+
+SCoHandshake::Body SCoHandshake::run()
+{
+	//Entry: the hello would be sent here
+	co_await next<EHelloAck>();
+
+	const EAuth& auth = co_await next<EAuth>();
+	if (auth.token() != kToken)
+	{
+		co_return transition_to<SCoIdle>();
+	}
+
+	co_await next<EReady>();
+	co_return transition_to<SCoConnected>();
+}
+
+SCoConnected::SCoConnected(Parent& parent) : State(parent)
+{
+	++sm().connected;
+}
+
+//==============================================================================
+// SUBSTATE LINK
+//==============================================================================
+
+class SubstateLink;
+class SSubRoot;
+class SSubIdle;
+class SSubHandshake;
+class SAwaitHelloAck;
+class SAwaitAuth;
+class SAwaitReady;
+class SSubConnected;
+
+class SSubIdle : public pw::hsm::State<SSubIdle, Handler, SSubRoot>
+{
+public:
+	SSubIdle(Parent& parent) : State(parent) {}
+
+	HandleResult handle(const EConnect& e) override { return transition<SSubHandshake>(); }
+};
+
+class SAwaitHelloAck : public pw::hsm::State<SAwaitHelloAck, Handler, SSubHandshake>
+{
+public:
+	SAwaitHelloAck(Parent& parent) : State(parent) {}
+
+	HandleResult handle(const EHelloAck& e) override { return transition<SAwaitAuth>(); }
+};
+
+class SAwaitAuth : public pw::hsm::State<SAwaitAuth, Handler, SSubHandshake>
+{
+public:
+	SAwaitAuth(Parent& parent) : State(parent) {}
+
+	HandleResult handle(const EAuth& e) override;
+};
+
+class SAwaitReady : public pw::hsm::State<SAwaitReady, Handler, SSubHandshake>
+{
+public:
+	SAwaitReady(Parent& parent) : State(parent) {}
+
+	HandleResult handle(const EReady& e) override { return transition<SSubConnected>(); }
+};
+
+/**
+* @brief The handshake as one substate per step
+*/
+class SSubHandshake : public pw::hsm::State<SSubHandshake, Handler, SSubRoot, SAwaitHelloAck, SAwaitAuth, SAwaitReady>
+{
+public:
+	SSubHandshake(Parent& parent) : State(parent) {}
+};
+
+class SSubConnected : public pw::hsm::State<SSubConnected, Handler, SSubRoot>
+{
+public:
+	SSubConnected(Parent& parent);
+
+	HandleResult handle(const EDisconnect& e) override { return transition<SSubIdle>(); }
+};
+
+class SSubRoot : public pw::hsm::State<SSubRoot, Handler, SubstateLink, SSubIdle, SSubHandshake, SSubConnected>
+{
+public:
+	SSubRoot(Parent& parent) : State(parent) {}
+};
+
+class SubstateLink : public pw::hsm::StateMachine<SubstateLink, SSubRoot>
+{
+public:
+	std::size_t connected = 0;
+};
+
+SAwaitAuth::HandleResult SAwaitAuth::handle(const EAuth& e)
+{
+	if (e.token() != kToken)
+	{
+		return transition<SSubIdle>();
+	}
+
+	return transition<SAwaitReady>();
+}
+
+SSubConnected::SSubConnected(Parent& parent) : State(parent)
+{
+	++sm().connected;
+}
+
+} //namespace coroutine_states
+
+//==============================================================================
+// MAIN
+//==============================================================================
+
+using namespace coroutine_states;
+
+/**
+* @brief Run kRounds handshakes (every tenth with a wrong token)
+*
+* @return Nanoseconds per handshake
+*/
+template <typename LINK>
+static double handshakes(LINK& link)
+{
+	const auto start = std::chrono::steady_clock::now();
+
+	for (std::size_t i = 0; i < kRounds; ++i)
+	{
+		const bool wrong = i % 10 == 0;
+
+		link.dispatch(EConnect{});
+		link.dispatch(EHelloAck{});
+		link.dispatch(EAuth{wrong ? kToken + 1 : kToken});
+
+		if (!wrong)
+		{
+			link.dispatch(EReady{});
+			link.dispatch(EDisconnect{});
+		}
+	}
+
+	const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / kRounds;
+}
+
+int main()
+{
+	CoroutineLink coroutine;
+	SubstateLink substates;
+
+	const double co = handshakes(coroutine);
+	const double sub = handshakes(substates);
+
+	std::cout << "coroutine state: " << co << " ns per handshake, " << coroutine.connected << " connected, "
+		<< coroutine.coroutine_arena().high_water_mark() << " arena bytes, "
+		<< coroutine.coroutine_arena().failures() << " failed frames" << std::endl;
+	std::cout << "substates:       " << sub << " ns per handshake, " << substates.connected << " connected" << std::endl;
+
+	return 0;
+}
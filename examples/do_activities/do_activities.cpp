@@ -0,0 +1,265 @@
+//==============================================================================
+// INCLUDES
+//==============================================================================
+
+#include <pw/hsm.hpp>
+#include <pw/hsm/activity.hpp>
+#include <pw/hsm/locking_queue.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <thread>
+
+using namespace std::chrono_literals;
+
+/*
+* A state which fetches kChunks chunks of data (1 ms of blocking work each),
+* once as a do-activity on a pw::hsm::ActivityPool and once synchronously in
+* its entry action.
+*
+* The first fetch runs to completion and its result arrives as EFetched. The
+* second is interrupted by ECancel after kCancelAfter; exiting the state
+* cancels the activity, which stops after the chunk it is working on. The
+* program prints the longest run-to-completion step in both variants.
+*/
+
+namespace do_activities
+{
+
+//==============================================================================
+// EVENTS
+//==============================================================================
+
+class EFetch;
+class EFetched;
+class ECancel;
+
+using Handler = pw::hsm::EventHandler<EFetch, EFetched, ECancel>;
+
+class EFetch : public pw::hsm::Event<EFetch, Handler> {};
+
+class EFetched : public pw::hsm::Event<EFetched, Handler>
+{
+public:
+	EFetched(std::size_t chunks = 0, std::uint32_t checksum = 0) : _chunks(chunks), _checksum(checksum) {}
+
+	auto chunks() const { return _chunks; }
+	auto checksum() const { return _checksum; }
+
+private:
+	std::size_t _chunks;
+	std::uint32_t _checksum;
+};
+
+class ECancel : public pw::hsm::Event<ECancel, Handler> {};
+
+constexpr std::size_t kChunks = 100;
+constexpr auto kCancelAfter = 20ms;
+
+using Q = pw::hsm::LockingEventQueue<Handler>;
+using Pool = pw::hsm::ActivityPool<>;
+using Fetch = pw::hsm::Activity<EFetched, Q, Pool>;
+
+/*
+* Chunks fetched so far by any fetch (to show where a cancelled one stopped)
+*/
+std::atomic<std::size_t> gChunksFetched{0};
+
+/**
+* @brief The blocking work: fetch chunks until done or cancelled
+*/
+static EFetched fetch(const pw::hsm::CancelToken* token)
+{
+	std::uint32_t checksum = 0;
+	std::size_t i = 0;
+
+	for (; i < kChunks && !(token && token->cancelled()); ++i)
+	{
+		std::this_thread::sleep_for(1ms);
+		checksum = checksum * 31 + std::uint32_t(i);
+		gChunksFetched.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	return EFetched(i, checksum);
+}
+
+//==============================================================================
+// STATE MACHINE
+//==============================================================================
+
+class Downloader;
+class SRoot;
+class SIdle;
+class SFetching;
+
+class SIdle : public pw::hsm::State<SIdle, Handler, SRoot>
+{
+public:
+	SIdle(Parent& parent) : State(parent) {}
+
+	HandleResult handle(const EFetch& e) override { return transition<SFetching>(); }
+	HandleResult handle(const EFetched& e) override;
+};
+
+/**
+* @brief State while a fetch is running
+*/
+class SFetching : public pw::hsm::State<SFetching, Handler, SRoot>
+{
+public:
+	SFetching(Parent& parent);
+
+	HandleResult handle(const EFetched& e) override;
+	HandleResult handle(const ECancel& e) override { return transition<SIdle>(); }
+
+private:
+	Fetch _fetch;
+};
+
+class SRoot : public pw::hsm::State<SRoot, Handler, Downloader, SIdle, SFetching>
+{
+public:
+	SRoot(Parent& parent) : State(parent) {}
+};
+
+/**
+* @brief Objects used by the states, held in a base class which precedes
+*        pw::hsm::StateMachine so that they outlive the states
+*/
+class DownloaderServices
+{
+protected:
+	DownloaderServices(Pool& pool) : _pool(pool) {}
+
+	Pool& _pool;
+	Q _q;
+};
+
+class Downloader :
+	private DownloaderServices,
+	public pw::hsm::StateMachine<Downloader, SRoot>
+{
+public:
+	/**
+	* @param async Whether to fetch on pool rather than in the entry action
+	*/
+	Downloader(Pool& pool, bool async) : DownloaderServices(pool), async(async) {}
+
+	Pool& pool() { return _pool; }
+	Q& queue() { return _q; }
+
+	/**
+	* @brief Dispatch e, then the events queued meanwhile
+	*/
+	template <typename E>
+	void step(const E& e)
+	{
+		_timed(e);
+		poll();
+	}
+
+	/**
+	* @brief Dispatch the queued events, timing each RTC step
+	*/
+	void poll()
+	{
+		Q::Envelope queued;
+		while (_q.try_pop(queued))
+		{
+			_timed(*queued);
+		}
+	}
+
+public:
+	const bool async;
+	std::chrono::nanoseconds longestStep{0};
+	std::size_t fetched = 0;
+
+private:
+	void _timed(const pw::hsm::AbstractEvent<Handler>& e)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		dispatch(e);
+		longestStep = std::max<std::chrono::nanoseconds>(longestStep, std::chrono::steady_clock::now() - start);
+	}
+};
+
+SIdle::HandleResult SIdle::handle(const EFetched& e)
+{
+	//A result pushed just before its fetch was cancelled
+	return kHandled;
+}
+
+SFetching::SFetching(Parent& parent) :
+	State(parent),
+	_fetch(sm().pool(), sm().queue())
+{
+	if (sm().async)
+	{
+		_fetch.start([](const pw::hsm::CancelToken& token) { return fetch(&token); });
+	}
+	else
+	{
+		sm().queue().push(fetch(nullptr));
+	}
+}
+
+SFetching::HandleResult SFetching::handle(const EFetched& e)
+{
+	std::cout << "  fetched " << e.chunks() << " chunks, checksum " << std::hex << e.checksum() << std::dec << std::endl;
+	++sm().fetched;
+	return transition<SIdle>();
+}
+
+} //namespace do_activities
+
+//==============================================================================
+// MAIN
+//==============================================================================
+
+using namespace do_activities;
+
+static void run(const char* name, Pool& pool, bool async)
+{
+	std::cout << name << ":" << std::endl;
+
+	Downloader downloader(pool, async);
+
+	//A fetch which completes
+	downloader.step(EFetch{});
+	while (downloader.fetched == 0)
+	{
+		std::this_thread::sleep_for(1ms);
+		downloader.poll();
+	}
+
+	//A fetch which is cancelled
+	const std::size_t before = gChunksFetched.load();
+	downloader.step(EFetch{});
+	std::this_thread::sleep_for(kCancelAfter);
+	downloader.step(ECancel{});
+
+	//Let the cancelled activity notice
+	std::this_thread::sleep_for(10ms);
+	downloader.poll();
+
+	std::cout << "  cancelled fetch stopped after " << gChunksFetched.load() - before << " chunks" << std::endl;
+	std::cout << "  longest RTC step " << std::chrono::duration<double, std::milli>(downloader.longestStep).count()
+		<< " ms" << std::endl;
+}
+
+int main()
+{
+	Pool pool(2);
+
+	run("do-activity", pool, true);
+	run("entry action", pool, false);
+
+	const auto stats = pool.stats();
+	std::cout << stats.started << " activities started, " << stats.completed << " completed, "
+		<< stats.dropped << " dropped, " << stats.cancelled << " cancelled, " << stats.rejected << " rejected" << std::endl;
+
+	return 0;
+}
@@ -0,0 +1,240 @@
+//==============================================================================
+// INCLUDES
+//==============================================================================
+
+#include <pw/hsm.hpp>
+#include <pw/hsm/epoll.hpp>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <thread>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+
+using namespace std::chrono_literals;
+
+/*
+* A machine fed by all four kinds of pw::hsm::EpollLoop sources, with every
+* event dispatched on the main thread straight from epoll_wait().
+*
+* 1. A periodic timerfd ticks every 10 ms; on the third tick the machine
+*    writes a message into a pipe.
+* 2. The pipe's read end becomes readable; the machine reads the message and
+*    asks a worker thread to do something.
+* 3. The worker notifies an eventfd when it is done.
+* 4. The machine raises SIGUSR1, which arrives through a signalfd and stops
+*    the loop.
+*/
+
+namespace epoll_sources
+{
+
+//==============================================================================
+// EVENTS
+//==============================================================================
+
+class ETick;
+class EReadable;
+class EDone;
+class ESignal;
+
+using Handler = pw::hsm::EventHandler<ETick, EReadable, EDone, ESignal>;
+
+class ETick : public pw::hsm::Event<ETick, Handler>
+{
+public:
+	ETick(std::uint64_t expirations) : _expirations(expirations) {}
+
+	auto expirations() const { return _expirations; }
+
+private:
+	std::uint64_t _expirations;
+};
+
+class EReadable : public pw::hsm::Event<EReadable, Handler>
+{
+public:
+	EReadable(int fd, std::uint32_t events) : _fd(fd), _events(events) {}
+
+	auto fd() const { return _fd; }
+	auto events() const { return _events; }
+
+private:
+	int _fd;
+	std::uint32_t _events;
+};
+
+class EDone : public pw::hsm::Event<EDone, Handler> {};
+
+class ESignal : public pw::hsm::Event<ESignal, Handler>
+{
+public:
+	ESignal(int signo) : _signo(signo) {}
+
+	auto signo() const { return _signo; }
+
+private:
+	int _signo;
+};
+
+//==============================================================================
+// STATE MACHINE
+//==============================================================================
+
+class Device;
+
+class SRoot;
+class SWaitingForTicks;
+class SReading;
+class SWaitingForWorker;
+class SStopping;
+
+class SWaitingForTicks : public pw::hsm::State<SWaitingForTicks, Handler, SRoot>
+{
+public:
+	SWaitingForTicks(Parent& parent) : State(parent) {}
+
+	HandleResult handle(const ETick& e) override;
+
+private:
+	std::uint64_t _ticks = 0;
+};
+
+class SReading : public pw::hsm::State<SReading, Handler, SRoot>
+{
+public:
+	SReading(Parent& parent) : State(parent) {}
+
+	HandleResult handle(const EReadable& e) override;
+};
+
+class SWaitingForWorker : public pw::hsm::State<SWaitingForWorker, Handler, SRoot>
+{
+public:
+	SWaitingForWorker(Parent& parent) : State(parent) {}
+
+	HandleResult handle(const EDone& e) override;
+};
+
+class SStopping : public pw::hsm::State<SStopping, Handler, SRoot>
+{
+public:
+	SStopping(Parent& parent) : State(parent) {}
+
+	HandleResult handle(const ESignal& e) override;
+};
+
+class SRoot : public pw::hsm::State<SRoot, Handler, Device, SWaitingForTicks, SReading, SWaitingForWorker, SStopping>
+{
+public:
+	SRoot(Parent& parent) : State(parent) {}
+};
+
+class Device : public pw::hsm::StateMachine<Device, SRoot>
+{
+public:
+	Device(pw::hsm::EpollLoop& loop, int pipeWrite) : loop(loop), pipeWrite(pipeWrite) {}
+
+	pw::hsm::EpollLoop& loop;
+	int pipeWrite;
+
+	/**
+	* @brief Set by main so that handlers can start the worker
+	*/
+	pw::hsm::EventSource<Device, EDone>* done = nullptr;
+	std::thread worker;
+};
+
+SWaitingForTicks::HandleResult SWaitingForTicks::handle(const ETick& e)
+{
+	_ticks += e.expirations();
+	std::cout << "tick " << _ticks << std::endl;
+
+	if (_ticks < 3)
+	{
+		return kHandled;
+	}
+
+	const char message[] = "hello";
+	[[maybe_unused]] const auto written = ::write(sm().pipeWrite, message, sizeof(message));
+	return transition<SReading>();
+}
+
+SReading::HandleResult SReading::handle(const EReadable& e)
+{
+	char message[16] = {};
+	if (::read(e.fd(), message, sizeof(message) - 1) > 0)
+	{
+		std::cout << "read \"" << message << "\"" << std::endl;
+	}
+
+	auto* done = sm().done;
+	sm().worker = std::thread([done]() {
+		std::this_thread::sleep_for(5ms);
+		done->notify();
+	});
+
+	return transition<SWaitingForWorker>();
+}
+
+SWaitingForWorker::HandleResult SWaitingForWorker::handle(const EDone& e)
+{
+	std::cout << "worker done" << std::endl;
+	sm().worker.join();
+	::kill(::getpid(), SIGUSR1);
+	return transition<SStopping>();
+}
+
+SStopping::HandleResult SStopping::handle(const ESignal& e)
+{
+	std::cout << "signal " << e.signo() << std::endl;
+	sm().loop.stop();
+	return kHandled;
+}
+
+} //namespace epoll_sources
+
+//==============================================================================
+// MAIN
+//==============================================================================
+
+using namespace epoll_sources;
+
+int main()
+{
+	pw::hsm::EpollLoop loop;
+
+	int fds[2];
+	if (!loop.valid() || ::pipe2(fds, O_CLOEXEC | O_NONBLOCK) != 0)
+	{
+		std::cout << "cannot create descriptors" << std::endl;
+		return 1;
+	}
+
+	Device device(loop, fds[1]);
+
+	//Before the worker thread starts, so that it inherits the blocked signal
+	pw::hsm::SignalSource<Device, ESignal> signals(loop, device, {SIGUSR1});
+	pw::hsm::TimerSource<Device, ETick> ticks(loop, device);
+	pw::hsm::FdSource<Device, EReadable> readable(loop, device, fds[0]);
+	pw::hsm::EventSource<Device, EDone> done(loop, device);
+	device.done = &done;
+
+	if (!signals.valid() || !ticks.valid() || !readable.valid() || !done.valid())
+	{
+		std::cout << "cannot watch descriptors" << std::endl;
+		return 1;
+	}
+
+	ticks.start(10ms, 10ms);
+	loop.run();
+	ticks.cancel();
+
+	std::cout << loop.wakeups() << " wakeups" << std::endl;
+
+	::close(fds[0]);
+	::close(fds[1]);
+	return 0;
+}
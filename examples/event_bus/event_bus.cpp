@@ -0,0 +1,417 @@
+//==============================================================================
+// INCLUDES
+//==============================================================================
+
+#include <pw/hsm.hpp>
+#include <pw/hsm/bus.hpp>
+#include <pw/hsm/locking_queue.hpp>
+#include <pw/hsm/queue.hpp>
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+#include <thread>
+
+/*
+* kDevices machines notify each other of temperature readings, door changes
+* and alarms, but each kind of event only matters to a few of them: the
+* thermostats, the door sensors and the sirens respectively.
+*
+* The program publishes kEvents events once by dispatching each of them into
+* every machine, and once through a pw::hsm::EventBus to which every machine
+* subscribed for the events it cares about. The devices run on the main
+* thread, so the bus dispatches into them directly. A logger, which only
+* cares about alarms, runs on a thread of its own: every event is pushed into
+* its mailbox in the first variant, only alarms in the second. The program
+* prints the time per event for both variants.
+*
+* Finally, two relays republish each event they handle as the next one of a
+* chain: the first relay turns ETemperature into EDoor, the second EDoor into
+* EAlarm, which the first relay subscribes to as well. The bus must queue
+* that alarm rather than dispatch it into the first relay, which is still
+* handling ETemperature.
+*/
+
+namespace event_bus
+{
+
+//==============================================================================
+// EVENTS
+//==============================================================================
+
+class ETemperature;
+class EDoor;
+class EAlarm;
+class EStop;
+
+using Handler = pw::hsm::EventHandler<ETemperature, EDoor, EAlarm, EStop>;
+
+class ETemperature : public pw::hsm::Event<ETemperature, Handler>
+{
+public:
+	ETemperature(int celsius = 0) : _celsius(celsius) {}
+
+	auto celsius() const { return _celsius; }
+
+private:
+	int _celsius;
+};
+
+class EDoor : public pw::hsm::Event<EDoor, Handler>
+{
+public:
+	EDoor(bool open = false) : _open(open) {}
+
+	auto open() const { return _open; }
+
+private:
+	bool _open;
+};
+
+class EAlarm : public pw::hsm::Event<EAlarm, Handler> {};
+
+/**
+* @brief Stops the logger's thread
+*/
+class EStop : public pw::hsm::Event<EStop, Handler> {};
+
+constexpr std::size_t kThermostats = 4;
+constexpr std::size_t kDoors = 4;
+constexpr std::size_t kSirens = 2;
+constexpr std::size_t kDevices = 32;
+constexpr std::size_t kEvents = 1000000;
+
+enum class Role
+{
+	kThermostat,
+	kDoor,
+	kSiren,
+	kOther
+};
+
+using Mailbox = pw::hsm::EventQueue<Handler>;
+
+/**
+* @brief Configuration of the logger's mailbox, which makes the bus wait
+*        rather than drop alarms when the logger falls behind
+*/
+struct LoggerQConfig : pw::hsm::QueueConfig
+{
+	static constexpr std::size_t kCapacity = 256;
+	static constexpr auto kOverflow = pw::hsm::Overflow::kBlock;
+};
+
+/**
+* @brief Configuration of the bus, which counts deliveries
+*/
+struct BusConfig : pw::hsm::BusConfig
+{
+	static constexpr bool kStats = true;
+};
+
+using Bus = pw::hsm::EventBus<Handler, BusConfig>;
+
+//==============================================================================
+// DEVICE
+//==============================================================================
+
+class Device;
+
+/**
+* @brief The only state of a device, which counts the events meant for its
+*        role and passes the others
+*/
+class SDevice : public pw::hsm::State<SDevice, Handler, Device>
+{
+public:
+	SDevice(Parent& parent) : State(parent) {}
+
+	HandleResult handle(const ETemperature& e) override;
+	HandleResult handle(const EDoor& e) override;
+	HandleResult handle(const EAlarm& e) override;
+
+public:
+	std::size_t count = 0;
+	int celsius = 0;
+	bool open = false;
+};
+
+class Device : public pw::hsm::StateMachine<Device, SDevice>
+{
+public:
+	Device(Role role = Role::kOther) : role(role) {}
+
+	/**
+	* @brief Subscribe the device to the events of its role
+	*/
+	void subscribe(Bus& bus)
+	{
+		switch (role)
+		{
+		case Role::kThermostat: bus.subscribe<ETemperature>(*this, mailbox); break;
+		case Role::kDoor: bus.subscribe<EDoor>(*this, mailbox); break;
+		case Role::kSiren: bus.subscribe<EAlarm>(*this, mailbox); break;
+		case Role::kOther: break;
+		}
+	}
+
+public:
+	Role role;
+	Mailbox mailbox;
+};
+
+SDevice::HandleResult SDevice::handle(const ETemperature& e)
+{
+	if (sm().role != Role::kThermostat)
+	{
+		return kPass;
+	}
+
+	celsius = e.celsius();
+	++count;
+	return kHandled;
+}
+
+SDevice::HandleResult SDevice::handle(const EDoor& e)
+{
+	if (sm().role != Role::kDoor)
+	{
+		return kPass;
+	}
+
+	open = e.open();
+	++count;
+	return kHandled;
+}
+
+SDevice::HandleResult SDevice::handle(const EAlarm& e)
+{
+	if (sm().role != Role::kSiren)
+	{
+		return kPass;
+	}
+
+	++count;
+	return kHandled;
+}
+
+//==============================================================================
+// LOGGER
+//==============================================================================
+
+class Logger;
+
+class SLogger : public pw::hsm::State<SLogger, Handler, Logger>
+{
+public:
+	SLogger(Parent& parent) : State(parent) {}
+
+	HandleResult handle(const EAlarm& e) override { ++alarms; return kHandled; }
+	HandleResult handle(const EStop& e) override { stopped = true; return kHandled; }
+
+public:
+	std::size_t alarms = 0;
+	bool stopped = false;
+};
+
+class Logger : public pw::hsm::StateMachine<Logger, SLogger>
+{
+public:
+	/**
+	* @brief Dispatch the events of the mailbox until EStop
+	*/
+	void run()
+	{
+		Q::Envelope e;
+		while (!root().stopped && mailbox.wait_and_pop(e))
+		{
+			dispatch(*e);
+		}
+	}
+
+public:
+	using Q = pw::hsm::LockingEventQueue<Handler, LoggerQConfig>;
+
+	Q mailbox;
+};
+
+//==============================================================================
+// RELAYS
+//==============================================================================
+
+class Relay;
+
+/**
+* @brief The only state of a relay, which publishes the next event of the
+*        chain from its handlers and records how deeply they are nested
+*/
+class SRelay : public pw::hsm::State<SRelay, Handler, Relay>
+{
+public:
+	SRelay(Parent& parent) : State(parent) {}
+
+	HandleResult handle(const ETemperature& e) override { return _relay(EDoor(true)); }
+	HandleResult handle(const EDoor& e) override { return _relay(EAlarm{}); }
+	HandleResult handle(const EAlarm& e) override { ++alarms; return _relay(EStop{}); }
+
+public:
+	std::size_t alarms = 0;
+	std::size_t depth = 0;
+	std::size_t deepest = 0;
+
+private:
+	template <typename E>
+	HandleResult _relay(const E& next);
+};
+
+class Relay : public pw::hsm::StateMachine<Relay, SRelay>
+{
+public:
+	Relay(Bus& bus) : bus(bus) {}
+
+public:
+	Bus& bus;
+	Mailbox mailbox;
+};
+
+template <typename E>
+SRelay::HandleResult SRelay::_relay(const E& next)
+{
+	deepest = std::max(deepest, ++depth);
+	sm().bus.publish(next);
+	--depth;
+	return kHandled;
+}
+
+} //namespace event_bus
+
+//==============================================================================
+// MAIN
+//==============================================================================
+
+using namespace event_bus;
+
+/**
+* @brief Call f with the i-th event of the benchmark
+*/
+template <typename F>
+static void generate(std::size_t i, F&& f)
+{
+	if (i % 64 == 0)
+	{
+		f(EAlarm{});
+	}
+	else if (i % 2 == 0)
+	{
+		f(ETemperature(int(i % 40)));
+	}
+	else
+	{
+		f(EDoor(i % 4 == 1));
+	}
+}
+
+template <typename F>
+static double measure(F&& f)
+{
+	const auto start = std::chrono::steady_clock::now();
+
+	for (std::size_t i = 0; i < kEvents; ++i)
+	{
+		generate(i, f);
+	}
+
+	const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / kEvents;
+}
+
+static void makeDevices(Device (&devices)[kDevices])
+{
+	for (std::size_t i = 0; i < kDevices; ++i)
+	{
+		devices[i].role =
+			i < kThermostats ? Role::kThermostat :
+			i < kThermostats + kDoors ? Role::kDoor :
+			i < kThermostats + kDoors + kSirens ? Role::kSiren :
+			Role::kOther;
+	}
+}
+
+static std::size_t handled(const Device (&devices)[kDevices])
+{
+	std::size_t n = 0;
+	for (const Device& device : devices)
+	{
+		n += device.root().count;
+	}
+	return n;
+}
+
+int main()
+{
+	std::cout << kEvents << " events, " << kDevices << " devices and a logger on another thread:" << std::endl;
+
+	Device broadcast[kDevices];
+	makeDevices(broadcast);
+
+	Logger broadcastLogger;
+	std::thread broadcastThread([&broadcastLogger]() { broadcastLogger.run(); });
+
+	const double all = measure([&](const auto& e) {
+		for (Device& device : broadcast)
+		{
+			device.dispatch(e);
+		}
+		broadcastLogger.mailbox.push(e);
+	});
+
+	broadcastLogger.mailbox.push(EStop{});
+	broadcastThread.join();
+
+	std::cout << "  dispatch into every machine: " << all << " ns per event, "
+		<< handled(broadcast) << " handled, " << broadcastLogger.root().alarms << " alarms logged" << std::endl;
+
+	Device subscribed[kDevices];
+	makeDevices(subscribed);
+
+	Bus bus;
+	for (Device& device : subscribed)
+	{
+		device.subscribe(bus);
+	}
+
+	//Runs on another thread, so alarms are pushed into its mailbox
+	Logger logger;
+	bus.subscribe<EAlarm>(logger, logger.mailbox, std::thread::id());
+	std::thread loggerThread([&logger]() { logger.run(); });
+
+	const double published = measure([&](const auto& e) { bus.publish(e); });
+
+	logger.mailbox.push(EStop{});
+	loggerThread.join();
+
+	const auto stats = bus.stats();
+	std::cout << "  publish on the bus:          " << published << " ns per event, "
+		<< handled(subscribed) << " handled, " << logger.root().alarms << " alarms logged" << std::endl;
+	std::cout << "  " << stats.direct << " direct calls, " << stats.queued << " queued, "
+		<< stats.dropped << " dropped" << std::endl;
+
+	Bus chain;
+	Relay first(chain);
+	Relay second(chain);
+	chain.subscribe<ETemperature>(first, first.mailbox);
+	chain.subscribe<EAlarm>(first, first.mailbox);
+	chain.subscribe<EDoor>(second, second.mailbox);
+
+	chain.publish(ETemperature{});
+	const std::size_t waiting = first.mailbox.size();
+	while (first.mailbox.dispatch_next(first))
+	{
+
+	}
+
+	std::cout << "chain of relays: " << waiting << " alarm queued for the first relay, nested "
+		<< first.root().deepest << " deep, " << first.root().alarms << " handled" << std::endl;
+
+	return first.root().deepest == 1 && first.root().alarms == 1 ? 0 : 1;
+}
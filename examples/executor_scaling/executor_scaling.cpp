@@ -0,0 +1,338 @@
+//==============================================================================
+// INCLUDES
+//==============================================================================
+
+#include <pw/hsm.hpp>
+#include <pw/hsm/executor.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+
+/*
+* Scaling benchmark of pw::hsm::Executor with 100k active objects.
+*
+* Every tenth machine starts with a token. Handling a token costs a little 
+* work and forwards it to a pseudo-randomly chosen machine until it has made
+* kHops hops, so each run dispatches kTokens * kHops token events spread 
+* evenly over all machines. The run is repeated for 1, 2, 4, ... workers up to
+* the number of cores (or the number given on the command line).
+*
+* Before the tokens, a sequence of ESeq events is posted to every machine from
+* the main thread; the machines count any that arrive out of order, and any
+* dispatch which overlaps another dispatch into the same machine, to check
+* that the executor preserves run-to-completion ordering. A token which does
+* not fit into a mailbox is lost and makes the benchmark fail, since the rate
+* would no longer be comparable across runs.
+*/
+
+namespace executor_scaling
+{
+
+//==============================================================================
+// EVENTS
+//==============================================================================
+
+class EToken;
+class ESeq;
+
+using Handler = pw::hsm::EventHandler<EToken, ESeq>;
+
+class EToken : public pw::hsm::Event<EToken, Handler>
+{
+public:
+	EToken(std::uint32_t hops = 0) : _hops(hops) {}
+	
+	auto hops() const { return _hops; }
+	
+private:
+	std::uint32_t _hops;
+};
+
+class ESeq : public pw::hsm::Event<ESeq, Handler>
+{
+public:
+	ESeq(std::uint32_t seq = 0) : _seq(seq) {}
+	
+	auto seq() const { return _seq; }
+	
+private:
+	std::uint32_t _seq;
+};
+
+//==============================================================================
+// STATES
+//==============================================================================
+
+class Node;
+class SRoot;
+class SEven;
+class SOdd;
+class Network;
+
+/*
+* Node
+* |_ SRoot
+*    |_ SEven
+*    |_ SOdd
+*/
+
+class SEven : public pw::hsm::State<SEven, Handler, SRoot>
+{
+public:
+	SEven(Parent& parent) : State(parent) {}
+	
+	HandleResult handle(const EToken& e) override;
+};
+
+class SOdd : public pw::hsm::State<SOdd, Handler, SRoot>
+{
+public:
+	SOdd(Parent& parent) : State(parent) {}
+	
+	HandleResult handle(const EToken& e) override;
+};
+
+class SRoot : public pw::hsm::State<SRoot, Handler, Node, SEven, SOdd>
+{
+public:
+	SRoot(Parent& parent) : State(parent) {}
+	
+	HandleResult handle(const ESeq& e) override;
+	
+	/**
+	* @brief Do some work for token e and pass it on
+	*/
+	void forward(const EToken& e);
+};
+
+class Node : public pw::hsm::StateMachine<Node, SRoot>
+{
+public:
+	Node(Network& network, std::uint32_t index) : 
+		network(network),
+		random(index)
+	{
+		
+	}
+	
+	/**
+	* @brief Dispatch e while checking that no other dispatch is in progress
+	*/
+	template <typename E>
+	void dispatch(const E& e)
+	{
+		if (busy.exchange(true, std::memory_order_acquire))
+		{
+			++overlaps;
+		}
+		StateMachine::dispatch(e);
+		busy.store(false, std::memory_order_release);
+	}
+	
+	std::uint64_t next()
+	{
+		//splitmix64
+		std::uint64_t z = (random += 0x9e3779b97f4a7c15ull);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+		return z ^ (z >> 31);
+	}
+	
+public:
+	Network& network;
+	std::uint64_t random;
+	std::uint32_t lastSeq = 0;
+	std::uint32_t disorders = 0;
+	std::uint32_t overlaps = 0;
+	std::uint64_t work = 0;
+	std::atomic<bool> busy{false};
+};
+
+/**
+* @brief Mailbox of a Node
+*
+* Tokens pile up in the mailbox of a machine which waits long for a worker
+* (about 30 of 2M tokens overflow 8 slots with 1 worker), so leave ample room.
+*/
+struct MailboxConfig : pw::hsm::QueueConfig
+{
+	static constexpr std::size_t kCapacity = 32;
+};
+
+using Executor = pw::hsm::Executor<>;
+using ActiveNode = pw::hsm::ActiveObject<Node, MailboxConfig, Executor>;
+
+/**
+* @brief All active nodes of one run
+*/
+class Network
+{
+public:
+	Network(Executor& executor, std::size_t size)
+	{
+		nodes.reserve(size);
+		for (std::size_t i = 0; i < size; ++i)
+		{
+			nodes.emplace_back(std::make_unique<ActiveNode>(executor, *this, std::uint32_t(i)));
+		}
+	}
+	
+	template <typename E>
+	void post(std::size_t index, const E& e)
+	{
+		if (!nodes[index]->post(e))
+		{
+			dropped.fetch_add(1, std::memory_order_relaxed);
+		}
+	}
+	
+public:
+	std::vector<std::unique_ptr<ActiveNode>> nodes;
+	std::atomic<std::size_t> dropped{0};
+};
+
+//==============================================================================
+
+SEven::HandleResult SEven::handle(const EToken& e)
+{
+	root().forward(e);
+	return transition<SOdd>();
+}
+
+SOdd::HandleResult SOdd::handle(const EToken& e)
+{
+	root().forward(e);
+	return transition<SEven>();
+}
+
+SRoot::HandleResult SRoot::handle(const ESeq& e)
+{
+	Node& node = sm();
+	if (e.seq() != node.lastSeq + 1)
+	{
+		++node.disorders;
+	}
+	node.lastSeq = e.seq();
+	return kHandled;
+}
+
+void SRoot::forward(const EToken& e)
+{
+	Node& node = sm();
+	
+	//Stand-in for the work a real handler does
+	std::uint64_t x = node.work + e.hops();
+	for (int i = 0; i < 64; ++i)
+	{
+		x = x * 6364136223846793005ull + 1442695040888963407ull;
+	}
+	node.work = x;
+	
+	if (e.hops() > 0)
+	{
+		node.network.post(node.next() % node.network.nodes.size(), EToken{e.hops() - 1});
+	}
+}
+
+} //namespace executor_scaling
+
+//==============================================================================
+// MAIN
+//==============================================================================
+
+using namespace executor_scaling;
+
+constexpr std::size_t kMachines = 100000;
+constexpr std::size_t kTokens = kMachines / 10;
+constexpr std::uint32_t kHops = 200;
+constexpr std::uint32_t kSeqs = 4;
+
+static std::size_t lost = 0;
+
+/**
+* @return Token events dispatched per second with the given number of workers
+*/
+static double run(std::size_t workers)
+{
+	Executor executor(workers);
+	Network network(executor, kMachines);
+	
+	for (std::uint32_t s = 1; s <= kSeqs; ++s)
+	{
+		for (std::size_t i = 0; i < kMachines; ++i)
+		{
+			network.post(i, ESeq{s});
+		}
+	}
+	executor.wait_idle();
+	
+	const auto start = std::chrono::steady_clock::now();
+	for (std::size_t i = 0; i < kTokens; ++i)
+	{
+		network.post(i * (kMachines / kTokens), EToken{kHops - 1});
+	}
+	executor.wait_idle();
+	const auto elapsed = std::chrono::steady_clock::now() - start;
+	
+	std::size_t disorders = 0;
+	std::size_t overlaps = 0;
+	for (auto& n : network.nodes)
+	{
+		disorders += n->machine().disorders + (n->machine().lastSeq != kSeqs);
+		overlaps += n->machine().overlaps;
+	}
+	
+	const auto stats = executor.stats();
+	const double seconds = std::chrono::duration<double>(elapsed).count();
+	const double rate = (kTokens * kHops - network.dropped) / seconds;
+	lost += network.dropped + disorders + overlaps;
+	
+	std::cout << workers << " worker(s): " 
+		<< rate / 1e6 << " M events/s, "
+		<< seconds * 1e3 << " ms, "
+		<< "steals=" << stats.steals << " parks=" << stats.parks << " "
+		<< "dropped=" << network.dropped << " "
+		<< "out-of-order=" << disorders << " overlapping=" << overlaps;
+	
+	return rate;
+}
+
+int main(int argc, char* argv[])
+{
+	std::size_t cores = std::thread::hardware_concurrency();
+	if (argc > 1)
+	{
+		cores = std::size_t(std::atoi(argv[1]));
+	}
+	cores = cores > 0 ? cores : 1;
+	
+	std::cout << kMachines << " machines, " << kTokens << " tokens, " 
+		<< kHops << " hops per token" << std::endl;
+	
+	const double base = run(1);
+	std::cout << std::endl;
+	
+	for (std::size_t workers = 2; workers <= cores; workers *= 2)
+	{
+		const double rate = run(workers);
+		std::cout << ", speedup " << rate / base << std::endl;
+		
+		if (workers < cores && workers * 2 > cores)
+		{
+			workers = cores / 2;
+		}
+	}
+	
+	if (lost > 0)
+	{
+		std::cout << "FAILED: events were dropped, reordered or overlapped" << std::endl;
+		return 1;
+	}
+	
+	return 0;
+}
@@ -0,0 +1,194 @@
+//==============================================================================
+// INCLUDES
+//==============================================================================
+
+#include <pw/hsm.hpp>
+#include <pw/hsm/queue.hpp>
+#include <iostream>
+#include <vector>
+
+/*
+* States whose handlers are not declared by the state class itself: SIdle
+* and SBusy share the EPing handler of the Responder base class template,
+* and SBusy overrides the EStop handler privately. StateMachine::would_handle
+* and EventQueue::push_if_handled must report these events as handled, since
+* dispatching them reaches the handlers all the same, and
+* StateMachine::dispatch_batch must have the same effect as dispatching the
+* events one by one.
+*
+* Responder and SRoot declare "using State::handle;" so that the handlers
+* they do not override stay visible, which lets would_handle tell that
+* EStop is passed while SIdle is active.
+*/
+
+namespace inherited_handlers
+{
+
+//==============================================================================
+// EVENTS
+//==============================================================================
+
+class EPing;
+class EStart;
+class EStop;
+
+using Handler = pw::hsm::EventHandler<EPing, EStart, EStop>;
+
+class EPing : public pw::hsm::Event<EPing, Handler> {};
+class EStart : public pw::hsm::Event<EStart, Handler> {};
+class EStop : public pw::hsm::Event<EStop, Handler> {};
+
+//==============================================================================
+// STATES
+//==============================================================================
+
+class Machine;
+class SRoot;
+class SIdle;
+class SBusy;
+
+/*
+* Machine
+* |_ SRoot
+*    |_ SIdle
+*    |_ SBusy
+*/
+
+/**
+* @brief Base class of the states which answer pings
+*/
+template <typename T, typename PARENT>
+class Responder : public pw::hsm::State<T, Handler, PARENT>
+{
+	using Base = pw::hsm::State<T, Handler, PARENT>;
+
+public:
+	Responder(PARENT& parent) : Base(parent) {}
+
+	using Base::handle;
+
+	pw::hsm::HandleResult handle(const EPing& e) override
+	{
+		++this->root().pings;
+		return pw::hsm::kHandled;
+	}
+};
+
+class SIdle : public Responder<SIdle, SRoot>
+{
+public:
+	SIdle(Parent& parent) : Responder(parent) {}
+};
+
+class SBusy : public Responder<SBusy, SRoot>
+{
+public:
+	SBusy(Parent& parent) : Responder(parent) {}
+
+private:
+	HandleResult handle(const EStop& e) override
+	{
+		return transition<SIdle>();
+	}
+};
+
+class SRoot : public pw::hsm::State<SRoot, Handler, Machine, SIdle, SBusy>
+{
+public:
+	SRoot(Parent& parent) : State(parent) {}
+
+	using State::handle;
+
+	HandleResult handle(const EStart& e) override
+	{
+		return transition<SBusy>();
+	}
+
+public:
+	int pings = 0;
+};
+
+class Machine : public pw::hsm::StateMachine<Machine, SRoot>
+{
+
+};
+
+} //namespace inherited_handlers
+
+//==============================================================================
+// MAIN
+//==============================================================================
+
+using namespace inherited_handlers;
+
+static int failures = 0;
+
+static void expect(const char* what, bool ok)
+{
+	std::cout << (ok ? "  ok:     " : "  FAILED: ") << what << std::endl;
+	failures += ok ? 0 : 1;
+}
+
+int main()
+{
+	Machine sm;
+	pw::hsm::EventQueue<Handler> queue;
+
+	std::cout << "SIdle:" << std::endl;
+	expect("would_handle<EPing>() (inherited handler)", sm.would_handle<EPing>());
+	expect("!would_handle<EStop>()", !sm.would_handle<EStop>());
+	expect("push_if_handled(EPing) queues it", queue.push_if_handled(sm, EPing{}));
+	expect("push_if_handled(EStop) filters it", !queue.push_if_handled(sm, EStop{}));
+
+	while (queue.dispatch_next(sm))
+	{
+
+	}
+
+	expect("the queued EPing was handled", sm.root().pings == 1);
+
+	sm.dispatch(EStart{});
+
+	std::cout << "SBusy:" << std::endl;
+	expect("would_handle<EPing>() (inherited handler)", sm.would_handle<EPing>());
+	expect("would_handle<EStop>() (private override)", sm.would_handle<EStop>());
+	expect("push_if_handled(EStop) queues it", queue.push_if_handled(sm, EStop{}));
+
+	while (queue.dispatch_next(sm))
+	{
+
+	}
+
+	expect("the queued EStop was handled", !sm.would_handle<EStop>());
+
+	std::cout << "dispatch_batch:" << std::endl;
+
+	Machine looped;
+	Machine batched;
+
+	const std::vector<EPing> pings(3);
+	for (const EPing& e : pings)
+	{
+		looped.dispatch(e);
+	}
+
+	auto summary = batched.dispatch_batch(pings);
+	expect("typed batch handles every EPing", summary.handled == pings.size() && summary.passed == 0);
+	expect("typed batch pings as many times as dispatch", batched.root().pings == looped.root().pings);
+
+	const EPing ping;
+	const EStart start;
+	const EStop stop;
+	const std::vector<const pw::hsm::AbstractEvent<Handler>*> mixed = {&ping, &start, &ping, &stop, &ping, &stop};
+	for (const auto* e : mixed)
+	{
+		looped.dispatch(*e);
+	}
+
+	summary = batched.dispatch_batch(mixed);
+	expect("mixed batch handles all but the last EStop", summary.handled == mixed.size() - 1 && summary.passed == 1);
+	expect("mixed batch pings as many times as dispatch", batched.root().pings == looped.root().pings);
+	expect("mixed batch ends in the same state as dispatch", batched.would_handle<EStop>() == looped.would_handle<EStop>());
+
+	return failures == 0 ? 0 : 1;
+}
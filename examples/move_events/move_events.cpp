@@ -0,0 +1,214 @@
+//==============================================================================
+// INCLUDES
+//==============================================================================
+
+#include <pw/hsm.hpp>
+#include <pw/hsm/queue.hpp>
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+#include <memory>
+#include <utility>
+#include <vector>
+
+/*
+* A recorder keeps the last frame it received. Its SRecording state handles
+* EFrame both as const EFrame& (copying the frame's kFrameSize bytes into the
+* recorder) and as EFrame&& (taking the frame's buffer over, which the
+* handler allows by listing it as Movable), so the same machine measures both
+* ways of getting a payload to a state:
+*     - dispatched directly, as an lvalue or with std::move
+*     - through an EventQueue, pushed as an lvalue and popped as a const event,
+*       or pushed with std::move and dispatched with dispatch_next (one hop
+*       more to copy)
+*
+* It then hands kUploads buffers to the recorder with EUpload, an event which
+* can only be moved, while it is still idle: they are queued, deferred by
+* SIdle and replayed into SRecording, which takes them over, without ever
+* being copied.
+*/
+
+namespace move_events
+{
+
+//==============================================================================
+// EVENTS
+//==============================================================================
+
+class EFrame;
+class EUpload;
+class EStart;
+
+using Handler = pw::hsm::EventHandler<pw::hsm::Movable<EFrame>, pw::hsm::Movable<EUpload>, EStart>;
+
+using Buffer = std::vector<unsigned char>;
+
+class EFrame : public pw::hsm::Event<EFrame, Handler>
+{
+public:
+	EFrame(Buffer data = {}) : data(std::move(data)) {}
+
+	Buffer data;
+};
+
+/**
+* @brief Hands a buffer over to the recorder (move-only)
+*/
+class EUpload : public pw::hsm::Event<EUpload, Handler>
+{
+public:
+	EUpload(std::unique_ptr<Buffer> buffer = {}) : buffer(std::move(buffer)) {}
+
+	std::unique_ptr<Buffer> buffer;
+};
+
+class EStart : public pw::hsm::Event<EStart, Handler> {};
+
+constexpr std::size_t kFrameSize = 64 * 1024;
+constexpr std::size_t kFrames = 20000;
+constexpr std::size_t kUploads = 4;
+
+//==============================================================================
+// STATE MACHINE
+//==============================================================================
+
+class Recorder;
+class SRoot;
+class SRecording;
+
+class SIdle : public pw::hsm::State<SIdle, Handler, SRoot>
+{
+public:
+	using Deferred = pw::hsm::Defer<EUpload>;
+
+	SIdle(Parent& parent) : State(parent) {}
+
+	HandleResult handle(const EStart& e) override { return transition<SRecording>(); }
+};
+
+class SRecording : public pw::hsm::State<SRecording, Handler, SRoot>
+{
+public:
+	SRecording(Parent& parent) : State(parent) {}
+
+	HandleResult handle(const EFrame& e) override;
+	HandleResult handle(EFrame&& e) override;
+	HandleResult handle(EUpload&& e) override;
+};
+
+class SRoot : public pw::hsm::State<SRoot, Handler, Recorder, SIdle, SRecording>
+{
+public:
+	SRoot(Parent& parent) : State(parent) {}
+
+public:
+	Buffer last;
+	std::size_t bytes = 0;
+	std::vector<std::unique_ptr<Buffer>> uploads;
+};
+
+class Recorder : public pw::hsm::StateMachine<Recorder, SRoot>
+{
+
+};
+
+SRecording::HandleResult SRecording::handle(const EFrame& e)
+{
+	root().last = e.data;
+	root().bytes += root().last.size();
+	return kHandled;
+}
+
+SRecording::HandleResult SRecording::handle(EFrame&& e)
+{
+	root().last = std::move(e.data);
+	root().bytes += root().last.size();
+	return kHandled;
+}
+
+SRecording::HandleResult SRecording::handle(EUpload&& e)
+{
+	root().uploads.push_back(std::move(e.buffer));
+	return kHandled;
+}
+
+} //namespace move_events
+
+//==============================================================================
+// MAIN
+//==============================================================================
+
+using namespace move_events;
+
+/**
+* @return A new frame, as a producer would fill it
+*/
+static Buffer frame(std::size_t i)
+{
+	return Buffer(kFrameSize, static_cast<unsigned char>(i));
+}
+
+template <typename F>
+static double measure(F&& f)
+{
+	const auto start = std::chrono::steady_clock::now();
+
+	for (std::size_t i = 0; i < kFrames; ++i)
+	{
+		f(i);
+	}
+
+	const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / kFrames;
+}
+
+int main()
+{
+	Recorder recorder;
+	recorder.dispatch(EStart{});
+
+	pw::hsm::EventQueue<Handler> queue;
+
+	const double copied = measure([&](std::size_t i) {
+		const EFrame e(frame(i));
+		recorder.dispatch(e);
+	});
+
+	const double moved = measure([&](std::size_t i) {
+		EFrame e(frame(i));
+		recorder.dispatch(std::move(e));
+	});
+
+	const double queuedCopied = measure([&](std::size_t i) {
+		const EFrame e(frame(i));
+		queue.push(e);
+		queue.pop([&recorder](const pw::hsm::AbstractEvent<Handler>& e) { recorder.dispatch(e); });
+	});
+
+	const double queuedMoved = measure([&](std::size_t i) {
+		EFrame e(frame(i));
+		queue.push(std::move(e));
+		queue.dispatch_next(recorder);
+	});
+
+	std::cout << kFrames << " frames of " << kFrameSize / 1024 << " KiB (" << recorder.root().bytes / (1024 * 1024) << " MiB recorded):" << std::endl;
+	std::cout << "  dispatched, copied: " << copied / 1000 << " us per frame" << std::endl;
+	std::cout << "  dispatched, moved:  " << moved / 1000 << " us per frame" << std::endl;
+	std::cout << "  queued, copied:     " << queuedCopied / 1000 << " us per frame" << std::endl;
+	std::cout << "  queued, moved:      " << queuedMoved / 1000 << " us per frame" << std::endl;
+
+	Recorder uploader;
+	for (std::size_t i = 0; i < kUploads; ++i)
+	{
+		queue.push(EUpload(std::make_unique<Buffer>(frame(i))));
+		queue.dispatch_next(uploader);
+	}
+
+	const std::size_t deferred = uploader.deferred_stats().size;
+	uploader.dispatch(EStart{});
+
+	std::cout << kUploads << " move-only uploads: " << deferred << " deferred while idle, "
+		<< uploader.root().uploads.size() << " taken over once recording" << std::endl;
+
+	return uploader.root().uploads.size() == kUploads ? 0 : 1;
+}
@@ -0,0 +1,282 @@
+//==============================================================================
+// INCLUDES
+//==============================================================================
+
+#include <pw/hsm.hpp>
+#include <pw/hsm/queue.hpp>
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+#include <tuple>
+
+/*
+* A panel of kLamps lamps which are switched on and off independently,
+* modelled once as one machine whose root state has a region per lamp
+* (pw::hsm::Orthogonal) and once as a separate machine per lamp.
+*
+* Every event is relevant to every lamp, so with separate machines it has to
+* be pushed into each machine's queue and dispatched to each machine. With
+* regions, it is pushed and dispatched once. The program prints the time per
+* event for both.
+*/
+
+namespace orthogonal_regions
+{
+
+//==============================================================================
+// EVENTS
+//==============================================================================
+
+class EToggle;
+class ETick;
+class EReset;
+
+using Handler = pw::hsm::EventHandler<EToggle, ETick, EReset>;
+
+/**
+* @brief Switches one lamp on or off
+*/
+class EToggle : public pw::hsm::Event<EToggle, Handler>
+{
+public:
+	EToggle(std::size_t lamp = 0) : _lamp(lamp) {}
+
+	auto lamp() const { return _lamp; }
+
+private:
+	std::size_t _lamp;
+};
+
+/**
+* @brief Counted by every lamp which is on
+*/
+class ETick : public pw::hsm::Event<ETick, Handler> {};
+
+/**
+* @brief Switches all lamps off
+*/
+class EReset : public pw::hsm::Event<EReset, Handler> {};
+
+constexpr std::size_t kLamps = 4;
+constexpr std::size_t kEvents = 1000000;
+
+using Queue = pw::hsm::EventQueue<Handler>;
+
+//==============================================================================
+// LAMP STATES
+//==============================================================================
+
+/*
+* The states of lamp I, whose root (SLamp) is a child of OWNER: either a
+* region of the panel's root state or the root of a machine of its own.
+*
+* SLamp<I>
+* |_ SOff<I>
+* |_ SOn<I>
+*/
+
+template <std::size_t I, typename OWNER>
+class SLamp;
+
+template <std::size_t I, typename OWNER>
+class SOn;
+
+template <std::size_t I, typename OWNER>
+class SOff : public pw::hsm::State<SOff<I, OWNER>, Handler, SLamp<I, OWNER>>
+{
+	using Base = pw::hsm::State<SOff<I, OWNER>, Handler, SLamp<I, OWNER>>;
+
+public:
+	SOff(typename Base::Parent& parent) : Base(parent) {}
+
+	pw::hsm::HandleResult handle(const EToggle& e) override
+	{
+		if (e.lamp() != I)
+		{
+			return Base::kPass;
+		}
+
+		return this->template transition<SOn<I, OWNER>>();
+	}
+};
+
+template <std::size_t I, typename OWNER>
+class SOn : public pw::hsm::State<SOn<I, OWNER>, Handler, SLamp<I, OWNER>>
+{
+	using Base = pw::hsm::State<SOn<I, OWNER>, Handler, SLamp<I, OWNER>>;
+
+public:
+	SOn(typename Base::Parent& parent) : Base(parent) {}
+
+	pw::hsm::HandleResult handle(const EToggle& e) override
+	{
+		if (e.lamp() != I)
+		{
+			return Base::kPass;
+		}
+
+		return this->template transition<SOff<I, OWNER>>();
+	}
+
+	pw::hsm::HandleResult handle(const ETick& e) override
+	{
+		++this->parent().ticks;
+		return Base::kHandled;
+	}
+};
+
+template <std::size_t I, typename OWNER>
+class SLamp : public pw::hsm::State<SLamp<I, OWNER>, Handler, OWNER, SOff<I, OWNER>, SOn<I, OWNER>>
+{
+	using Base = pw::hsm::State<SLamp<I, OWNER>, Handler, OWNER, SOff<I, OWNER>, SOn<I, OWNER>>;
+
+public:
+	SLamp(typename Base::Parent& parent) : Base(parent) {}
+
+	bool on() const { return std::holds_alternative<SOn<I, OWNER>>(this->_children); }
+
+public:
+	std::size_t ticks = 0;
+};
+
+//==============================================================================
+// PANEL WITH REGIONS
+//==============================================================================
+
+class Panel;
+class SPanel;
+
+template <std::size_t I>
+using SPanelLamp = SLamp<I, SPanel>;
+
+/**
+* @brief Root state of the panel, with a region per lamp
+*/
+class SPanel : public pw::hsm::State<SPanel, Handler, Panel,
+	pw::hsm::Orthogonal<SPanelLamp<0>, SPanelLamp<1>, SPanelLamp<2>, SPanelLamp<3>>>
+{
+public:
+	SPanel(Parent& parent) : State(parent) {}
+
+	/*
+	* Re-enter the panel, which puts every region back in its initial state
+	*/
+	HandleResult handle(const EReset& e) override { return transition<SPanelLamp<0>>(); }
+};
+
+class Panel : public pw::hsm::StateMachine<Panel, SPanel>
+{
+public:
+	std::size_t ticks() const
+	{
+		const auto& panel = root();
+		return panel.region<SPanelLamp<0>>().ticks + panel.region<SPanelLamp<1>>().ticks +
+			panel.region<SPanelLamp<2>>().ticks + panel.region<SPanelLamp<3>>().ticks;
+	}
+};
+
+//==============================================================================
+// A MACHINE PER LAMP
+//==============================================================================
+
+template <std::size_t I>
+class Lamp : public pw::hsm::StateMachine<Lamp<I>, SLamp<I, Lamp<I>>>
+{
+
+};
+
+} //namespace orthogonal_regions
+
+//==============================================================================
+// MAIN
+//==============================================================================
+
+using namespace orthogonal_regions;
+
+static void show(const Panel& panel)
+{
+	const auto& p = panel.root();
+	std::cout << "  lamps " << p.region<SPanelLamp<0>>().on() << p.region<SPanelLamp<1>>().on()
+		<< p.region<SPanelLamp<2>>().on() << p.region<SPanelLamp<3>>().on()
+		<< ", " << panel.ticks() << " ticks" << std::endl;
+}
+
+/**
+* @brief Call f with the i-th event of the benchmark
+*/
+template <typename F>
+static void generate(std::size_t i, F&& f)
+{
+	if (i % 16 == 0)
+	{
+		f(EToggle((i / 16) % kLamps));
+	}
+	else
+	{
+		f(ETick{});
+	}
+}
+
+template <typename F>
+static double measure(F&& f)
+{
+	const auto start = std::chrono::steady_clock::now();
+
+	for (std::size_t i = 0; i < kEvents; ++i)
+	{
+		generate(i, f);
+	}
+
+	const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / kEvents;
+}
+
+int main()
+{
+	std::cout << "regions:" << std::endl;
+	{
+		Panel panel;
+		panel.dispatch(EToggle(1));
+		panel.dispatch(EToggle(3));
+		panel.dispatch(ETick{});
+		show(panel);
+
+		panel.dispatch(EReset{});
+		panel.dispatch(ETick{});
+		show(panel);
+	}
+
+	std::cout << kEvents << " events, " << kLamps << " lamps:" << std::endl;
+
+	Panel panel;
+	Queue q;
+
+	const double regions = measure([&](const auto& e) {
+		q.push(e);
+		q.dispatch_next(panel);
+	});
+
+	std::tuple<Lamp<0>, Lamp<1>, Lamp<2>, Lamp<3>> lamps;
+	Queue qs[kLamps];
+
+	const double machines = measure([&](const auto& e) {
+		for (auto& q : qs)
+		{
+			q.push(e);
+		}
+
+		std::apply([&qs](auto& ... lamp) {
+			std::size_t i = 0;
+			(qs[i++].dispatch_next(lamp), ...);
+		}, lamps);
+	});
+
+	const std::size_t lampTicks = std::apply([](const auto& ... lamp) {
+		return (lamp.root().ticks + ...);
+	}, lamps);
+
+	std::cout << "  one machine with regions: " << regions << " ns per event, " << panel.ticks() << " ticks" << std::endl;
+	std::cout << "  a machine per lamp:       " << machines << " ns per event, " << lampTicks << " ticks" << std::endl;
+
+	return 0;
+}
@@ -0,0 +1,193 @@
+//==============================================================================
+// INCLUDES
+//==============================================================================
+
+#include <pw/hsm.hpp>
+#include <pw/hsm/parallel.hpp>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <thread>
+#include <utility>
+
+/*
+* Benchmark of an orthogonal state with kRegions CPU-heavy regions, whose
+* regions are dispatched one after the other in one machine and in parallel
+* on a pw::hsm::RegionPool (see pw::hsm::Independent) in the other.
+*
+* Every EWork event makes each region hash kRounds rounds. The program
+* prints the time per event for both machines and checks that their regions
+* computed the same digests.
+*/
+
+namespace parallel_regions
+{
+
+//==============================================================================
+// EVENTS
+//==============================================================================
+
+class EWork;
+
+using Handler = pw::hsm::EventHandler<EWork>;
+
+class EWork : public pw::hsm::Event<EWork, Handler>
+{
+public:
+	EWork(std::uint64_t seed = 0) : _seed(seed) {}
+
+	auto seed() const { return _seed; }
+
+private:
+	std::uint64_t _seed;
+};
+
+constexpr std::size_t kRegions = 8;
+constexpr std::size_t kEvents = 2000;
+constexpr std::size_t kRounds = 5000;
+
+//==============================================================================
+// STATES
+//==============================================================================
+
+/**
+* @brief Region I of OWNER, which hashes the seed of every EWork into its
+*        digest
+*/
+template <std::size_t I, typename OWNER>
+class SCruncher : public pw::hsm::State<SCruncher<I, OWNER>, Handler, OWNER>
+{
+	using Base = pw::hsm::State<SCruncher<I, OWNER>, Handler, OWNER>;
+
+public:
+	SCruncher(typename Base::Parent& parent) : Base(parent) {}
+
+	pw::hsm::HandleResult handle(const EWork& e) override
+	{
+		std::uint64_t x = _digest ^ (e.seed() + I);
+		for (std::size_t i = 0; i < kRounds; ++i)
+		{
+			//splitmix64
+			x += 0x9e3779b97f4a7c15ull;
+			x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+			x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+			x ^= x >> 31;
+		}
+		_digest = x;
+
+		return Base::kHandled;
+	}
+
+	std::uint64_t digest() const { return _digest; }
+
+private:
+	std::uint64_t _digest = 0;
+};
+
+template <typename OWNER>
+using Crunchers = pw::hsm::Orthogonal<
+	SCruncher<0, OWNER>, SCruncher<1, OWNER>, SCruncher<2, OWNER>, SCruncher<3, OWNER>,
+	SCruncher<4, OWNER>, SCruncher<5, OWNER>, SCruncher<6, OWNER>, SCruncher<7, OWNER>>;
+
+class SerialBank;
+class ParallelBank;
+
+/**
+* @brief Root whose regions are dispatched one after the other
+*/
+class SSerialRoot : public pw::hsm::State<SSerialRoot, Handler, SerialBank, Crunchers<SSerialRoot>>
+{
+public:
+	SSerialRoot(Parent& parent) : State(parent) {}
+};
+
+/**
+* @brief Root whose regions are all independent
+*/
+class SParallelRoot : public pw::hsm::State<SParallelRoot, Handler, ParallelBank, Crunchers<SParallelRoot>>
+{
+public:
+	using IndependentRegions = pw::hsm::Independent<
+		SCruncher<0, SParallelRoot>, SCruncher<1, SParallelRoot>, SCruncher<2, SParallelRoot>, SCruncher<3, SParallelRoot>,
+		SCruncher<4, SParallelRoot>, SCruncher<5, SParallelRoot>, SCruncher<6, SParallelRoot>, SCruncher<7, SParallelRoot>>;
+
+public:
+	SParallelRoot(Parent& parent) : State(parent) {}
+};
+
+class SerialBank : public pw::hsm::StateMachine<SerialBank, SSerialRoot>
+{
+
+};
+
+using Pool = pw::hsm::RegionPool<>;
+
+class ParallelBank : public pw::hsm::StateMachine<ParallelBank, SParallelRoot>
+{
+public:
+	ParallelBank(Pool& pool) : _pool(pool) {}
+
+	Pool& region_pool() { return _pool; }
+
+private:
+	Pool& _pool;
+};
+
+/**
+* @return A digest of the digests of all regions of root
+*/
+template <typename ROOT, std::size_t ... Is>
+std::uint64_t digest(const ROOT& root, std::index_sequence<Is...>)
+{
+	std::uint64_t d = 0;
+	((d = d * 31 + root.template region<SCruncher<Is, ROOT>>().digest()), ...);
+	return d;
+}
+
+} //namespace parallel_regions
+
+//==============================================================================
+// MAIN
+//==============================================================================
+
+using namespace parallel_regions;
+
+template <typename SM>
+static double measure(SM& sm)
+{
+	const auto start = std::chrono::steady_clock::now();
+
+	for (std::size_t i = 0; i < kEvents; ++i)
+	{
+		sm.dispatch(EWork(i));
+	}
+
+	const std::chrono::duration<double, std::micro> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / kEvents;
+}
+
+int main()
+{
+	Pool pool;
+
+	std::cout << kEvents << " events, " << kRegions << " regions, " << std::thread::hardware_concurrency()
+		<< " CPUs, " << pool.size() << " pool workers" << std::endl;
+
+	SerialBank serial;
+	const double s = measure(serial);
+
+	ParallelBank parallel(pool);
+	const double p = measure(parallel);
+
+	const auto stats = pool.stats();
+	const bool same = digest(serial.root(), std::make_index_sequence<kRegions>{}) ==
+		digest(parallel.root(), std::make_index_sequence<kRegions>{});
+
+	std::cout << "serial regions:   " << s << " us per event" << std::endl;
+	std::cout << "parallel regions: " << p << " us per event (" << s / p << "x), "
+		<< stats.stolen << " of " << stats.forks * kRegions << " regions run by workers, "
+		<< stats.parks << " parks" << std::endl;
+	std::cout << "digests " << (same ? "match" : "differ") << std::endl;
+
+	return same ? 0 : 1;
+}
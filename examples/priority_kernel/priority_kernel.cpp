@@ -0,0 +1,245 @@
+//==============================================================================
+// INCLUDES
+//==============================================================================
+
+#include <pw/hsm.hpp>
+#include <pw/hsm/kernel.hpp>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <thread>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace std::chrono_literals;
+
+/*
+* Worst-case response times of pw::hsm::Kernel with a safety interlock and a
+* bulk machine.
+*
+* The bulk machine (priority 1) is kept busy with EWork events whose RTC
+* steps each take kBulkStep. Every tenth step it posts an ECheck to the
+* interlock from within its handler. A separate thread, standing in for an
+* interrupt, posts an EAlarm to the interlock (priority 3) every kAlarmPeriod.
+* The interlock's steps are short.
+*
+* Both kernel modes run for kDuration each:
+* - cooperative: alarms from the other thread wait for the bulk machine's
+*   current RTC step to finish, while checks posted from the bulk handler 
+*   preempt it immediately
+* - threaded: the operating system preempts the bulk machine's thread as soon
+*   as an alarm arrives (if real-time priorities are permitted)
+*/
+
+namespace priority_kernel
+{
+
+//==============================================================================
+// EVENTS
+//==============================================================================
+
+class EWork;
+class ECheck;
+class EAlarm;
+
+using Handler = pw::hsm::EventHandler<EWork, ECheck, EAlarm>;
+
+class EWork : public pw::hsm::Event<EWork, Handler> {};
+class ECheck : public pw::hsm::Event<ECheck, Handler> {};
+class EAlarm : public pw::hsm::Event<EAlarm, Handler> {};
+
+using Kernel = pw::hsm::Kernel<>;
+
+constexpr auto kBulkStep = 200us;
+constexpr auto kAlarmPeriod = 500us;
+constexpr auto kDuration = 1s;
+
+/**
+* @brief Busy-wait for d, standing in for the work of an RTC step
+*/
+static void busy(std::chrono::nanoseconds d)
+{
+	const auto until = std::chrono::steady_clock::now() + d;
+	while (std::chrono::steady_clock::now() < until)
+	{
+		
+	}
+}
+
+//==============================================================================
+// INTERLOCK
+//==============================================================================
+
+class Interlock;
+
+class SArmed : public pw::hsm::State<SArmed, Handler, Interlock>
+{
+public:
+	SArmed(Parent& parent) : State(parent) {}
+	
+	HandleResult handle(const ECheck& e) override
+	{
+		busy(1us);
+		return kHandled;
+	}
+	
+	HandleResult handle(const EAlarm& e) override
+	{
+		busy(1us);
+		return kHandled;
+	}
+};
+
+class Interlock : public pw::hsm::StateMachine<Interlock, SArmed>
+{
+	
+};
+
+using InterlockObject = pw::hsm::PriorityObject<Interlock, 64, Kernel>;
+
+//==============================================================================
+// BULK
+//==============================================================================
+
+class Bulk;
+
+class SBusy : public pw::hsm::State<SBusy, Handler, Bulk>
+{
+public:
+	SBusy(Parent& parent) : State(parent) {}
+	
+	HandleResult handle(const EWork& e) override;
+	
+private:
+	unsigned _steps = 0;
+};
+
+class Bulk : public pw::hsm::StateMachine<Bulk, SBusy>
+{
+public:
+	Bulk(InterlockObject& interlock) : interlock(interlock) {}
+	
+	/**
+	* @brief Object running this machine (to post more work to itself)
+	*/
+	pw::hsm::PriorityObject<Bulk, 64, Kernel>* self = nullptr;
+	
+	InterlockObject& interlock;
+};
+
+using BulkObject = pw::hsm::PriorityObject<Bulk, 64, Kernel>;
+
+SBusy::HandleResult SBusy::handle(const EWork& e)
+{
+	busy(kBulkStep / 2);
+	
+	if (++_steps % 10 == 0)
+	{
+		sm().interlock.post(ECheck{});
+	}
+	
+	busy(kBulkStep / 2);
+	
+	//Keep the bulk machine busy
+	sm().self->post(EWork{});
+	return kHandled;
+}
+
+} //namespace priority_kernel
+
+//==============================================================================
+// MAIN
+//==============================================================================
+
+using namespace priority_kernel;
+
+static void report(const Kernel& kernel, unsigned priority, const char* name)
+{
+	const auto stats = kernel.response(priority);
+	const auto mean = stats.count ? stats.total / std::int64_t(stats.count) : 0ns;
+	
+	std::cout << "  priority " << priority << " (" << name << "): "
+		<< stats.count << " events, mean " 
+		<< std::chrono::duration<double, std::micro>(mean).count() << " us, worst "
+		<< std::chrono::duration<double, std::micro>(stats.worst).count() << " us" << std::endl;
+}
+
+/**
+* @brief Give the calling thread the highest real-time priority, like an
+*        interrupt (otherwise a busy real-time machine thread would starve it)
+*/
+static void raise_to_interrupt_priority()
+{
+#if defined(__linux__)
+	sched_param param{};
+	param.sched_priority = sched_get_priority_max(SCHED_FIFO);
+	pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+#endif
+}
+
+/**
+* @brief Post alarms until stop is set
+*/
+static void alarms(InterlockObject& interlock, const std::atomic<bool>& stop)
+{
+	raise_to_interrupt_priority();
+	
+	auto next = std::chrono::steady_clock::now();
+	while (!stop.load(std::memory_order_relaxed))
+	{
+		next += kAlarmPeriod;
+		std::this_thread::sleep_until(next);
+		interlock.post(EAlarm{});
+	}
+}
+
+static void run(bool threaded)
+{
+	Kernel kernel;
+	InterlockObject interlock(kernel, 3);
+	BulkObject bulk(kernel, 1, interlock);
+	bulk.machine().self = &bulk;
+	
+	std::atomic<bool> stop{false};
+	std::thread isr(alarms, std::ref(interlock), std::cref(stop));
+	
+	bulk.post(EWork{});
+	
+	if (threaded)
+	{
+		const bool realtime = kernel.start_threads();
+		std::cout << "threaded (" << (realtime ? "SCHED_FIFO" : "default policy, no privileges") << "):" << std::endl;
+		std::this_thread::sleep_for(kDuration);
+	}
+	else
+	{
+		std::cout << "cooperative:" << std::endl;
+		std::thread timer([&kernel]() {
+			std::this_thread::sleep_for(kDuration);
+			kernel.stop();
+		});
+		kernel.run();
+		timer.join();
+	}
+	
+	stop = true;
+	isr.join();
+	kernel.stop();
+	
+	report(kernel, 3, "interlock");
+	report(kernel, 1, "bulk");
+}
+
+int main()
+{
+	std::cout << "bulk RTC step " << std::chrono::microseconds(kBulkStep).count() 
+		<< " us, alarm every " << std::chrono::microseconds(kAlarmPeriod).count() << " us" << std::endl;
+	
+	run(false);
+	run(true);
+	
+	return 0;
+}
@@ -0,0 +1,244 @@
+//==============================================================================
+// INCLUDES
+//==============================================================================
+
+#include <pw/hsm.hpp>
+#include <pw/hsm/locking_queue.hpp>
+#include <pw/hsm/reply.hpp>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <iostream>
+#include <thread>
+
+using namespace std::chrono_literals;
+
+/*
+* A configuration service answers EGetConfig requests (pw::hsm::Request),
+* whose reply is constructed in a pw::hsm::Reply slot owned by the caller.
+*
+* The program makes kRequests requests on the service's thread, reading the
+* slot right after dispatch, and compares them with the ad hoc way of getting
+* an answer: a std::function callback carried by the event, which copies the
+* answer to the caller. It then makes kRemoteRequests requests from
+* another thread through the service's mailbox, waiting on the slot, and
+* shows that a request the active state does not handle leaves the slot
+* empty.
+*/
+
+namespace request_reply
+{
+
+//==============================================================================
+// EVENTS
+//==============================================================================
+
+/**
+* @brief The answer
+*/
+struct Config
+{
+	char name[16];
+	unsigned rate;
+	unsigned version;
+};
+
+class EGetConfig;
+class EGetConfigCallback;
+class ESetRate;
+class EStop;
+
+using Handler = pw::hsm::EventHandler<EGetConfig, EGetConfigCallback, ESetRate, EStop>;
+
+class EGetConfig : public pw::hsm::Request<EGetConfig, Handler, Config>
+{
+public:
+	using Request::Request;
+};
+
+/**
+* @brief The same request, answered through a callback
+*/
+class EGetConfigCallback : public pw::hsm::Event<EGetConfigCallback, Handler>
+{
+public:
+	EGetConfigCallback(std::function<void(const Config&)> callback = {}) : callback(std::move(callback)) {}
+
+	std::function<void(const Config&)> callback;
+};
+
+class ESetRate : public pw::hsm::Event<ESetRate, Handler>
+{
+public:
+	ESetRate(unsigned rate = 0) : _rate(rate) {}
+
+	auto rate() const { return _rate; }
+
+private:
+	unsigned _rate;
+};
+
+/**
+* @brief Stops the service, which then no longer answers requests
+*/
+class EStop : public pw::hsm::Event<EStop, Handler> {};
+
+constexpr std::size_t kRequests = 1000000;
+constexpr std::size_t kRemoteRequests = 10000;
+
+//==============================================================================
+// STATE MACHINE
+//==============================================================================
+
+class Service;
+class SRoot;
+class SStopped;
+
+class SRunning : public pw::hsm::State<SRunning, Handler, SRoot>
+{
+public:
+	SRunning(Parent& parent) : State(parent) {}
+
+	HandleResult handle(const EGetConfig& e) override;
+	HandleResult handle(const EGetConfigCallback& e) override;
+	HandleResult handle(const ESetRate& e) override;
+	HandleResult handle(const EStop& e) override { return transition<SStopped>(); }
+};
+
+class SStopped : public pw::hsm::State<SStopped, Handler, SRoot>
+{
+public:
+	SStopped(Parent& parent) : State(parent) {}
+};
+
+class SRoot : public pw::hsm::State<SRoot, Handler, Service, SRunning, SStopped>
+{
+public:
+	SRoot(Parent& parent) : State(parent) {}
+
+public:
+	Config config{"sensor-7", 10, 1};
+};
+
+class Service : public pw::hsm::StateMachine<Service, SRoot>
+{
+public:
+	using Mailbox = pw::hsm::LockingEventQueue<Handler>;
+
+	/**
+	* @brief Dispatch the events of the mailbox until it is woken up
+	*/
+	void run()
+	{
+		Mailbox::Envelope e;
+		while (mailbox.wait_and_pop(e))
+		{
+			dispatch(*e);
+		}
+	}
+
+public:
+	Mailbox mailbox;
+};
+
+SRunning::HandleResult SRunning::handle(const EGetConfig& e)
+{
+	e.reply(root().config);
+	return kHandled;
+}
+
+SRunning::HandleResult SRunning::handle(const EGetConfigCallback& e)
+{
+	e.callback(root().config);
+	return kHandled;
+}
+
+SRunning::HandleResult SRunning::handle(const ESetRate& e)
+{
+	root().config.rate = e.rate();
+	++root().config.version;
+	return kHandled;
+}
+
+} //namespace request_reply
+
+//==============================================================================
+// MAIN
+//==============================================================================
+
+using namespace request_reply;
+
+template <typename F>
+static double measure(std::size_t n, F&& f)
+{
+	const auto start = std::chrono::steady_clock::now();
+
+	for (std::size_t i = 0; i < n; ++i)
+	{
+		f(i);
+	}
+
+	const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / n;
+}
+
+int main()
+{
+	std::cout << kRequests << " requests on the service's thread:" << std::endl;
+	{
+		Service service;
+		pw::hsm::Reply<Config> slot;
+		unsigned sum = 0;
+
+		const double replied = measure(kRequests, [&](std::size_t i) {
+			service.dispatch(EGetConfig(slot));
+			sum += slot.get()->rate;
+		});
+
+		Config received{};
+
+		const double callback = measure(kRequests, [&](std::size_t i) {
+			service.dispatch(EGetConfigCallback([&received](const Config& c) { received = c; }));
+			sum += received.rate;
+		});
+
+		std::cout << "  reply slot: " << replied << " ns per request" << std::endl;
+		std::cout << "  callback:   " << callback << " ns per request (checksum " << sum << ")" << std::endl;
+	}
+
+	std::cout << kRemoteRequests << " requests from another thread:" << std::endl;
+	{
+		Service service;
+		std::thread thread([&service]() { service.run(); });
+
+		pw::hsm::Reply<Config> slot;
+		std::size_t answered = 0;
+
+		const double remote = measure(kRemoteRequests, [&](std::size_t i) {
+			if (i % 100 == 0)
+			{
+				service.mailbox.push(ESetRate(unsigned(i)));
+			}
+
+			service.mailbox.push(EGetConfig(slot));
+			if (slot.wait_for(1s))
+			{
+				++answered;
+			}
+		});
+
+		const Config* last = slot.get();
+		std::cout << "  " << remote << " ns per round trip, " << answered << " answered, last: "
+			<< last->name << " rate " << last->rate << " version " << last->version << std::endl;
+
+		//Once stopped, requests are passed and nobody replies
+		service.mailbox.push(EStop{});
+		service.mailbox.push(EGetConfig(slot));
+		std::cout << "  after EStop: " << (slot.wait_for(100ms) ? "answered" : "no answer") << std::endl;
+
+		service.mailbox.wake();
+		thread.join();
+	}
+
+	return 0;
+}
@@ -0,0 +1,272 @@
+//==============================================================================
+// INCLUDES
+//==============================================================================
+
+#include <pw/hsm.hpp>
+#include <pw/hsm/sharded.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+
+/*
+* Scaling benchmark of pw::hsm::ShardedRuntime with 100k session machines.
+*
+* kTokensPerShard tokens per shard are posted to evenly spaced sessions.
+* Handling a token costs a little work and forwards it to a pseudo-randomly
+* chosen session, which usually lives on another shard. The tokens make
+* kEvents hops in total, so every run does the same amount of work while
+* the number of tokens in flight stays within the capacity of the queues
+* between shards. The run is repeated
+* for 1, 2, 4, ... shards up to the number of cores (or the number given on
+* the command line). On a multi-socket machine, the shards on each socket
+* allocate their sessions from that socket's memory.
+*
+* Every session records the thread it was created on and counts dispatches
+* from any other thread, which must never happen.
+*/
+
+namespace sharded_scaling
+{
+
+//==============================================================================
+// EVENTS
+//==============================================================================
+
+class EToken;
+
+using Handler = pw::hsm::EventHandler<EToken>;
+
+class EToken : public pw::hsm::Event<EToken, Handler>
+{
+public:
+	EToken(std::uint32_t hops = 0) : _hops(hops) {}
+	
+	auto hops() const { return _hops; }
+	
+private:
+	std::uint32_t _hops;
+};
+
+//==============================================================================
+// STATES
+//==============================================================================
+
+class Session;
+class SRoot;
+class SEven;
+class SOdd;
+
+using Runtime = pw::hsm::ShardedRuntime<Session, std::uint64_t>;
+
+/*
+* Session
+* |_ SRoot
+*    |_ SEven
+*    |_ SOdd
+*/
+
+class SEven : public pw::hsm::State<SEven, Handler, SRoot>
+{
+public:
+	SEven(Parent& parent) : State(parent) {}
+	
+	HandleResult handle(const EToken& e) override;
+};
+
+class SOdd : public pw::hsm::State<SOdd, Handler, SRoot>
+{
+public:
+	SOdd(Parent& parent) : State(parent) {}
+	
+	HandleResult handle(const EToken& e) override;
+};
+
+class SRoot : public pw::hsm::State<SRoot, Handler, Session, SEven, SOdd>
+{
+public:
+	SRoot(Parent& parent) : State(parent) {}
+	
+	/**
+	* @brief Do some work for token e and pass it on
+	*/
+	void forward(const EToken& e);
+};
+
+class Session : public pw::hsm::StateMachine<Session, SRoot>
+{
+public:
+	Session(Runtime& runtime, std::uint64_t key) : 
+		runtime(runtime),
+		random(key),
+		owner(std::this_thread::get_id())
+	{
+		
+	}
+	
+	~Session()
+	{
+		foreignTotal.fetch_add(foreign, std::memory_order_relaxed);
+	}
+	
+	template <typename E>
+	void dispatch(const E& e)
+	{
+		if (std::this_thread::get_id() != owner)
+		{
+			++foreign;
+		}
+		StateMachine::dispatch(e);
+	}
+	
+	std::uint64_t next()
+	{
+		//splitmix64
+		std::uint64_t z = (random += 0x9e3779b97f4a7c15ull);
+		z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+		z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+		return z ^ (z >> 31);
+	}
+	
+public:
+	Runtime& runtime;
+	std::uint64_t random;
+	std::thread::id owner;
+	std::uint64_t work = 0;
+	std::uint32_t foreign = 0;
+	
+	/*
+	* Sum of foreign over all destroyed sessions
+	*/
+	static inline std::atomic<std::size_t> foreignTotal{0};
+};
+
+} //namespace sharded_scaling
+
+//==============================================================================
+// GLOBAL VARIABLES
+//==============================================================================
+
+constexpr std::size_t kSessions = 100000;
+constexpr std::size_t kTokensPerShard = 100;
+constexpr std::size_t kEvents = 2000000;
+
+//==============================================================================
+
+namespace sharded_scaling
+{
+
+SEven::HandleResult SEven::handle(const EToken& e)
+{
+	root().forward(e);
+	return transition<SOdd>();
+}
+
+SOdd::HandleResult SOdd::handle(const EToken& e)
+{
+	root().forward(e);
+	return transition<SEven>();
+}
+
+void SRoot::forward(const EToken& e)
+{
+	Session& session = sm();
+	
+	//Stand-in for the work a real handler does
+	std::uint64_t x = session.work + e.hops();
+	for (int i = 0; i < 64; ++i)
+	{
+		x = x * 6364136223846793005ull + 1442695040888963407ull;
+	}
+	session.work = x;
+	
+	if (e.hops() > 0)
+	{
+		session.runtime.post(session.next() % kSessions, EToken{e.hops() - 1});
+	}
+}
+
+} //namespace sharded_scaling
+
+//==============================================================================
+// MAIN
+//==============================================================================
+
+using namespace sharded_scaling;
+
+/**
+* @return Token events dispatched per second with the given number of shards
+*/
+static double run(std::size_t shards)
+{
+	double seconds;
+	std::size_t dispatched = 0;
+	std::size_t dropped = 0;
+	
+	Session::foreignTotal = 0;
+	
+	{
+		//Room for all sessions even if the keys do not hash evenly
+		Runtime runtime(shards, kSessions / shards + kSessions / 10 + 16);
+		
+		const std::size_t tokens = kTokensPerShard * shards;
+		const auto hops = std::uint32_t(kEvents / tokens);
+		
+		const auto start = std::chrono::steady_clock::now();
+		for (std::size_t i = 0; i < tokens; ++i)
+		{
+			runtime.post(i * (kSessions / tokens), EToken{hops - 1});
+		}
+		runtime.wait_idle();
+		seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		
+		std::cout << shards << " shard(s) on CPUs";
+		for (std::size_t i = 0; i < shards; ++i)
+		{
+			const auto stats = runtime.stats(i);
+			dispatched += stats.dispatched;
+			dropped += stats.dropped + stats.rejected;
+			std::cout << " " << stats.cpu;
+		}
+	}
+	
+	const double rate = dispatched / seconds;
+	
+	std::cout << ": " << rate / 1e6 << " M events/s, "
+		<< seconds * 1e3 << " ms, "
+		<< "dropped=" << dropped << " "
+		<< "foreign=" << Session::foreignTotal;
+	
+	return rate;
+}
+
+int main(int argc, char* argv[])
+{
+	std::size_t cores = std::thread::hardware_concurrency();
+	if (argc > 1)
+	{
+		cores = std::size_t(std::atoi(argv[1]));
+	}
+	cores = cores > 0 ? cores : 1;
+	
+	std::cout << kSessions << " sessions, " << kTokensPerShard << " tokens per shard, " 
+		<< kEvents << " events per run" << std::endl;
+	
+	const double base = run(1);
+	std::cout << std::endl;
+	
+	for (std::size_t shards = 2; shards <= cores; shards *= 2)
+	{
+		const double rate = run(shards);
+		std::cout << ", speedup " << rate / base << std::endl;
+		
+		if (shards < cores && shards * 2 > cores)
+		{
+			shards = cores / 2;
+		}
+	}
+	
+	return 0;
+}
@@ -0,0 +1,232 @@
+//==============================================================================
+// INCLUDES
+//==============================================================================
+
+#include <pw/hsm.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <thread>
+
+/*
+* A light which cycles through red, green and yellow on every ENext event,
+* dispatched kEvents times on the main thread while kMonitors threads read
+* its active state (pw::hsm::DefaultConfig::kPublishActiveState) as fast as
+* they can.
+*
+* After n transitions the light must be in the n-th state of the cycle, so
+* every snapshot the monitors read is checked against its own transition
+* counter: a torn snapshot would pair a state with the wrong count. The
+* program also prints the time per event without publication, with it and
+* with it while the monitors read (which, on fewer CPUs than threads, also
+* measures the time the monitors take away from the dispatching thread).
+*/
+
+namespace state_monitor
+{
+
+//==============================================================================
+// EVENTS
+//==============================================================================
+
+class ENext;
+
+using Handler = pw::hsm::EventHandler<ENext>;
+
+class ENext : public pw::hsm::Event<ENext, Handler> {};
+
+constexpr std::size_t kEvents = 2000000;
+constexpr std::size_t kMonitors = 2;
+
+//==============================================================================
+// STATES
+//==============================================================================
+
+/*
+* SRoot<SM>
+* |_ SStop<SM>
+* |  |_ SRed<SM>
+* |_ SGo<SM>
+*    |_ SGreen<SM>
+*    |_ SYellow<SM>
+*/
+
+template <typename SM> class SRoot;
+template <typename SM> class SStop;
+template <typename SM> class SGo;
+template <typename SM> class SRed;
+template <typename SM> class SGreen;
+template <typename SM> class SYellow;
+
+template <typename SM>
+class SRed : public pw::hsm::State<SRed<SM>, Handler, SStop<SM>>
+{
+	using Base = pw::hsm::State<SRed<SM>, Handler, SStop<SM>>;
+
+public:
+	SRed(typename Base::Parent& parent) : Base(parent) {}
+
+	pw::hsm::HandleResult handle(const ENext& e) override { return this->template transition<SGreen<SM>>(); }
+};
+
+template <typename SM>
+class SGreen : public pw::hsm::State<SGreen<SM>, Handler, SGo<SM>>
+{
+	using Base = pw::hsm::State<SGreen<SM>, Handler, SGo<SM>>;
+
+public:
+	SGreen(typename Base::Parent& parent) : Base(parent) {}
+
+	pw::hsm::HandleResult handle(const ENext& e) override { return this->template transition<SYellow<SM>>(); }
+};
+
+template <typename SM>
+class SYellow : public pw::hsm::State<SYellow<SM>, Handler, SGo<SM>>
+{
+	using Base = pw::hsm::State<SYellow<SM>, Handler, SGo<SM>>;
+
+public:
+	SYellow(typename Base::Parent& parent) : Base(parent) {}
+
+	pw::hsm::HandleResult handle(const ENext& e) override { return this->template transition<SRed<SM>>(); }
+};
+
+template <typename SM>
+class SStop : public pw::hsm::State<SStop<SM>, Handler, SRoot<SM>, SRed<SM>>
+{
+	using Base = pw::hsm::State<SStop<SM>, Handler, SRoot<SM>, SRed<SM>>;
+
+public:
+	SStop(typename Base::Parent& parent) : Base(parent) {}
+};
+
+template <typename SM>
+class SGo : public pw::hsm::State<SGo<SM>, Handler, SRoot<SM>, SGreen<SM>, SYellow<SM>>
+{
+	using Base = pw::hsm::State<SGo<SM>, Handler, SRoot<SM>, SGreen<SM>, SYellow<SM>>;
+
+public:
+	SGo(typename Base::Parent& parent) : Base(parent) {}
+};
+
+template <typename SM>
+class SRoot : public pw::hsm::State<SRoot<SM>, Handler, SM, SStop<SM>, SGo<SM>>
+{
+	using Base = pw::hsm::State<SRoot<SM>, Handler, SM, SStop<SM>, SGo<SM>>;
+
+public:
+	SRoot(typename Base::Parent& parent) : Base(parent) {}
+};
+
+//==============================================================================
+// MACHINES
+//==============================================================================
+
+struct PublishingConfig : pw::hsm::DefaultConfig
+{
+	static constexpr bool kPublishActiveState = true;
+};
+
+class Light : public pw::hsm::StateMachine<Light, SRoot<Light>>
+{
+
+};
+
+class MonitoredLight : public pw::hsm::StateMachine<MonitoredLight, SRoot<MonitoredLight>, PublishingConfig>
+{
+public:
+	/**
+	* @return ID of the state the light is in after n transitions
+	*/
+	static std::size_t expected(std::uint64_t n)
+	{
+		switch (n % 3)
+		{
+		case 0: return state_id<SRed<MonitoredLight>>();
+		case 1: return state_id<SGreen<MonitoredLight>>();
+		default: return state_id<SYellow<MonitoredLight>>();
+		}
+	}
+};
+
+} //namespace state_monitor
+
+//==============================================================================
+// MAIN
+//==============================================================================
+
+using namespace state_monitor;
+
+template <typename SM>
+static double measure(SM& sm)
+{
+	const auto start = std::chrono::steady_clock::now();
+
+	for (std::size_t i = 0; i < kEvents; ++i)
+	{
+		sm.dispatch(ENext{});
+	}
+
+	const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+	return elapsed.count() / kEvents;
+}
+
+int main()
+{
+	Light light;
+	const double plain = measure(light);
+
+	MonitoredLight unwatched;
+	const double alone = measure(unwatched);
+
+	MonitoredLight monitored;
+	std::atomic<bool> done{false};
+	std::atomic<std::size_t> reads{0};
+	std::atomic<std::size_t> stopped{0};
+	std::atomic<std::size_t> torn{0};
+
+	std::thread monitors[kMonitors];
+	for (auto& monitor : monitors)
+	{
+		monitor = std::thread([&]() {
+			std::size_t n = 0;
+			while (!done.load(std::memory_order_relaxed))
+			{
+				const auto state = monitored.active_state();
+				if (state.leaf != MonitoredLight::expected(state.transitions))
+				{
+					torn.fetch_add(1, std::memory_order_relaxed);
+				}
+				if (MonitoredLight::is_within<SStop<MonitoredLight>>(state.leaf))
+				{
+					stopped.fetch_add(1, std::memory_order_relaxed);
+				}
+				++n;
+			}
+			reads.fetch_add(n, std::memory_order_relaxed);
+		});
+	}
+
+	const double published = measure(monitored);
+
+	done.store(true);
+	for (auto& monitor : monitors)
+	{
+		monitor.join();
+	}
+
+	const auto last = monitored.active_state();
+	const std::chrono::duration<double, std::milli> age = std::chrono::steady_clock::now() - last.since;
+
+	std::cout << kEvents << " events, " << kMonitors << " monitors, " << std::thread::hardware_concurrency() << " CPUs:" << std::endl;
+	std::cout << "  without publication: " << plain << " ns per event" << std::endl;
+	std::cout << "  with publication:    " << alone << " ns per event, " << published << " with the monitors reading" << std::endl;
+	std::cout << "  " << reads.load() << " snapshots read, " << stopped.load() << " while stopped, "
+		<< torn.load() << " inconsistent" << std::endl;
+	std::cout << "  last: state " << last.leaf << " after " << last.transitions << " transitions, "
+		<< age.count() << " ms ago" << std::endl;
+
+	return torn.load() == 0 ? 0 : 1;
+}
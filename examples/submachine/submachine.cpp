@@ -0,0 +1,401 @@
+//==============================================================================
+// INCLUDES
+//==============================================================================
+
+#include <pw/hsm.hpp>
+#include <pw/hsm/clock.hpp>
+#include <pw/hsm/locking_queue.hpp>
+#include <pw/hsm/run_loop.hpp>
+#include <pw/hsm/timer.hpp>
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+
+using namespace std::chrono_literals;
+
+/*
+* A retry protocol with exponential backoff, written once as a reusable
+* machine (root state template SRetry) and run twice on a virtual clock:
+* on its own, as a RetryMachine, and mounted by the SConnecting state of a
+* Client (pw::hsm::Submachine).
+*
+* Either way, the protocol's states arm their timeouts on and push their
+* events into the services of the machine which runs them, so the Client has
+* a single queue and a single timer service for both its own states and the
+* nested protocol. Every line of the trace shows the machine it came from.
+*/
+
+namespace submachine
+{
+
+//==============================================================================
+// EVENTS
+//==============================================================================
+
+class EConnect;
+class ETimeout;
+class EReply;
+class ERetryDone;
+
+using Handler = pw::hsm::EventHandler<EConnect, ETimeout, EReply, ERetryDone>;
+
+class EConnect : public pw::hsm::Event<EConnect, Handler> {};
+class ETimeout : public pw::hsm::Event<ETimeout, Handler> {};
+
+/**
+* @brief Reply of the (simulated) peer to an attempt
+*/
+class EReply : public pw::hsm::Event<EReply, Handler>
+{
+public:
+	EReply(unsigned attempt = 0) : _attempt(attempt) {}
+
+	auto attempt() const { return _attempt; }
+
+private:
+	unsigned _attempt;
+};
+
+/**
+* @brief Outcome of the retry protocol, queued for whoever runs it
+*/
+class ERetryDone : public pw::hsm::Event<ERetryDone, Handler>
+{
+public:
+	ERetryDone(unsigned attempts = 0, bool ok = false) : _attempts(attempts), _ok(ok) {}
+
+	auto attempts() const { return _attempts; }
+	auto ok() const { return _ok; }
+
+private:
+	unsigned _attempts;
+	bool _ok;
+};
+
+constexpr unsigned kMaxAttempts = 5;
+constexpr auto kReplyTimeout = 1s;
+constexpr auto kBackoff = 250ms;
+
+using Clock = pw::hsm::VirtualClock<>;
+
+struct QConfig : pw::hsm::QueueConfig
+{
+	using Clock = submachine::Clock;
+};
+
+struct TConfig : pw::hsm::TimerConfig
+{
+	using Clock = submachine::Clock;
+};
+
+using Q = pw::hsm::LockingEventQueue<Handler, QConfig>;
+using Timers = pw::hsm::TimerService<TConfig>;
+using Timeout = pw::hsm::Timer<ETimeout, Q, TConfig>;
+using Loop = pw::hsm::RunLoop<Q, Timers>;
+
+//==============================================================================
+// SERVICES
+//==============================================================================
+
+/**
+* @brief Objects used by the states of both machines, held in a base class
+*        which precedes pw::hsm::StateMachine so that they outlive the states
+*/
+class LinkServices
+{
+public:
+	Timers& timers() { return _timers; }
+	Q& queue() { return _q; }
+
+	/**
+	* @brief Print what happened, stamped with the clock and the machine's name
+	*/
+	void trace(const char* what, unsigned n)
+	{
+		const std::chrono::duration<double> t = Clock::now().time_since_epoch();
+		std::cout << "  " << t.count() << " s  " << _name << ": " << what << " " << n << std::endl;
+	}
+
+	/**
+	* @brief Send attempt to the peer, which only answers from attempt
+	*        answerFrom on
+	*/
+	void send(unsigned attempt)
+	{
+		trace("send attempt", attempt);
+		if (attempt >= _answerFrom)
+		{
+			_q.push(EReply(attempt));
+		}
+	}
+
+	const pw::hsm::RunLoopStats& loopStats() const { return _loop.stats(); }
+
+protected:
+	LinkServices(const char* name, unsigned answerFrom) : _name(name), _answerFrom(answerFrom) {}
+
+	const char* const _name;
+	const unsigned _answerFrom;
+
+	Q _q;
+	Timers _timers;
+	Loop _loop{_q, _timers};
+};
+
+//==============================================================================
+// RETRY PROTOCOL
+//==============================================================================
+
+/*
+* The states of the protocol, whose root (SRetry) is a child of OWNER: either
+* the Submachine state which mounts it or the root of a machine of its own.
+*
+* SRetry<OWNER>
+* |_ SAttempting<OWNER>
+* |_ SWaiting<OWNER>
+* |_ SDone<OWNER>
+*/
+
+template <typename OWNER>
+class SRetry;
+
+template <typename OWNER>
+class SWaiting;
+
+template <typename OWNER>
+class SDone;
+
+/**
+* @brief Waiting for the reply to an attempt
+*/
+template <typename OWNER>
+class SAttempting : public pw::hsm::State<SAttempting<OWNER>, Handler, SRetry<OWNER>>
+{
+	using Base = pw::hsm::State<SAttempting<OWNER>, Handler, SRetry<OWNER>>;
+
+public:
+	SAttempting(typename Base::Parent& parent) :
+		Base(parent),
+		_timeout(this->sm().timers(), this->sm().queue())
+	{
+		_timeout.start(kReplyTimeout);
+		this->sm().send(++this->root().attempts);
+	}
+
+	pw::hsm::HandleResult handle(const ETimeout& e) override
+	{
+		const unsigned attempts = this->root().attempts;
+		if (attempts < kMaxAttempts)
+		{
+			return this->template transition<SWaiting<OWNER>>();
+		}
+
+		this->sm().trace("give up after attempt", attempts);
+		this->sm().queue().push(ERetryDone(attempts, false));
+		return this->template transition<SDone<OWNER>>();
+	}
+
+private:
+	Timeout _timeout;
+};
+
+/**
+* @brief Backing off before the next attempt, twice as long as before the
+*        previous one
+*/
+template <typename OWNER>
+class SWaiting : public pw::hsm::State<SWaiting<OWNER>, Handler, SRetry<OWNER>>
+{
+	using Base = pw::hsm::State<SWaiting<OWNER>, Handler, SRetry<OWNER>>;
+
+public:
+	SWaiting(typename Base::Parent& parent) :
+		Base(parent),
+		_timeout(this->sm().timers(), this->sm().queue())
+	{
+		_timeout.start(kBackoff * (1u << (this->root().attempts - 1)));
+	}
+
+	pw::hsm::HandleResult handle(const ETimeout& e) override
+	{
+		return this->template transition<SAttempting<OWNER>>();
+	}
+
+private:
+	Timeout _timeout;
+};
+
+/**
+* @brief Outcome reported, waiting for the owner to leave the protocol
+*/
+template <typename OWNER>
+class SDone : public pw::hsm::State<SDone<OWNER>, Handler, SRetry<OWNER>>
+{
+	using Base = pw::hsm::State<SDone<OWNER>, Handler, SRetry<OWNER>>;
+
+public:
+	SDone(typename Base::Parent& parent) : Base(parent) {}
+
+	pw::hsm::HandleResult handle(const EReply& e) override { return Base::kHandled; }
+};
+
+template <typename OWNER>
+class SRetry : public pw::hsm::State<SRetry<OWNER>, Handler, OWNER, SAttempting<OWNER>, SWaiting<OWNER>, SDone<OWNER>>
+{
+	using Base = pw::hsm::State<SRetry<OWNER>, Handler, OWNER, SAttempting<OWNER>, SWaiting<OWNER>, SDone<OWNER>>;
+
+public:
+	SRetry(typename Base::Parent& parent) : Base(parent) {}
+
+	/*
+	* A reply arriving while backing off still counts
+	*/
+	pw::hsm::HandleResult handle(const EReply& e) override
+	{
+		this->sm().trace("reply to attempt", e.attempt());
+		this->sm().queue().push(ERetryDone(attempts, true));
+		return this->template transition<SDone<OWNER>>();
+	}
+
+public:
+	unsigned attempts = 0;
+};
+
+/**
+* @brief The retry protocol on its own
+*/
+class RetryMachine :
+	public LinkServices,
+	public pw::hsm::StateMachine<RetryMachine, SRetry<RetryMachine>>
+{
+public:
+	RetryMachine(unsigned answerFrom) : LinkServices("retry ", answerFrom) {}
+
+	template <typename REP, typename PERIOD>
+	void execFor(std::chrono::duration<REP, PERIOD> d) { _loop.run_for(*this, d); }
+};
+
+//==============================================================================
+// CLIENT
+//==============================================================================
+
+/*
+* SRoot
+* |_ SOffline
+* |_ SConnecting (mounts SRetry<SConnecting>)
+* |_ SOnline
+*/
+
+class Client;
+class SRoot;
+class SOnline;
+
+class SOffline : public pw::hsm::State<SOffline, Handler, SRoot>
+{
+public:
+	SOffline(Parent& parent);
+
+	HandleResult handle(const EConnect& e) override;
+};
+
+class SConnecting : public pw::hsm::Submachine<SConnecting, Handler, SRoot, SRetry>
+{
+public:
+	SConnecting(Parent& parent) : Submachine(parent) {}
+
+	HandleResult handle(const ERetryDone& e) override;
+};
+
+class SOnline : public pw::hsm::State<SOnline, Handler, SRoot>
+{
+public:
+	SOnline(Parent& parent);
+};
+
+class SRoot : public pw::hsm::State<SRoot, Handler, Client, SOffline, SConnecting, SOnline>
+{
+public:
+	SRoot(Parent& parent) : State(parent) {}
+
+public:
+	unsigned connects = 0;
+};
+
+class Client :
+	public LinkServices,
+	public pw::hsm::StateMachine<Client, SRoot>
+{
+public:
+	Client(unsigned answerFrom) : LinkServices("client", answerFrom) {}
+
+	template <typename REP, typename PERIOD>
+	void execFor(std::chrono::duration<REP, PERIOD> d) { _loop.run_for(*this, d); }
+};
+
+SOffline::SOffline(Parent& parent) : State(parent)
+{
+	sm().trace("offline, connects", root().connects);
+}
+
+SOffline::HandleResult SOffline::handle(const EConnect& e)
+{
+	++root().connects;
+	return transition<SConnecting>();
+}
+
+SConnecting::HandleResult SConnecting::handle(const ERetryDone& e)
+{
+	//root() is the submachine's, outer_root() the client's
+	sm().trace(e.ok() ? "connected after attempts" : "failed after attempts", root().attempts);
+
+	if (e.ok())
+	{
+		return transition<SOnline>();
+	}
+
+	return transition<SOffline>();
+}
+
+SOnline::SOnline(Parent& parent) : State(parent)
+{
+	sm().trace("online, connects", root().connects);
+}
+
+} //namespace submachine
+
+//==============================================================================
+// MAIN
+//==============================================================================
+
+using namespace submachine;
+
+int main()
+{
+	std::cout << "standalone, peer answers from attempt 3:" << std::endl;
+	{
+		Clock::reset();
+		RetryMachine retry(3);
+		retry.execFor(1min);
+		std::cout << "  " << retry.loopStats().events << " events dispatched" << std::endl;
+	}
+
+	std::cout << "mounted in a client, peer answers from attempt 4:" << std::endl;
+	{
+		Clock::reset();
+		Client client(4);
+		client.queue().push(EConnect{});
+		client.execFor(1min);
+		std::cout << "  " << client.loopStats().events << " events dispatched" << std::endl;
+	}
+
+	std::cout << "mounted in a client, peer never answers:" << std::endl;
+	{
+		Clock::reset();
+		Client client(kMaxAttempts + 1);
+		client.queue().push(EConnect{});
+		client.execFor(1min);
+		std::cout << "  " << client.loopStats().events << " events dispatched" << std::endl;
+	}
+
+	return 0;
+}
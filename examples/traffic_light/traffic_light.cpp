@@ -3,63 +3,18 @@
 //==============================================================================
 
 #include <pw/hsm.hpp>
-#include <queue>
-#include <memory>
-#include <mutex>
-#include <condition_variable>
+#include <pw/hsm/locking_queue.hpp>
+#include <pw/hsm/timer.hpp>
+#include <pw/hsm/run_loop.hpp>
+#include <pw/hsm/signal_queue.hpp>
+#include <pw/hsm/clock.hpp>
+#include <atomic>
 #include <chrono>
 #include <iostream>
 #include <csignal>
 
 using namespace std::chrono_literals;
 	
-//==============================================================================
-// HELPER CLASSES
-//==============================================================================
-
-/**
-* @brief Implementation of a thread-safe, blocking queue with timeout
-*/
-template<typename T>
-class LockingQueue
-{
-public:
-	template <typename U>
-    void push(U&& data)
-    {
-        {
-            std::lock_guard<std::mutex> lock(guard);
-            queue.push(std::forward<U>(data));
-        }
-        signal.notify_one();
-    }
-
-    bool empty() const
-    {
-        std::lock_guard<std::mutex> lock(guard);
-        return queue.empty();
-    }
-
-    bool tryWaitAndPop(T& value, std::chrono::milliseconds milli)
-    {
-        std::unique_lock<std::mutex> lock(guard);
-        while (queue.empty())
-        {
-            signal.wait_for(lock, milli);
-            return false;
-        }
-
-        value = std::move(queue.front());
-        queue.pop();
-        return true;
-    }
-
-private:
-    std::queue<T> queue;
-    mutable std::mutex guard;
-    std::condition_variable signal;
-};
-
 //==============================================================================
 // EVENTS
 //==============================================================================
@@ -68,11 +23,10 @@ namespace traffic_light
 {
 
 class EPedestrianButton;
-class ETick;
 class ETimeout;
 class ESigint;
 
-using Handler = pw::hsm::EventHandler<EPedestrianButton, ETick, ETimeout, ESigint>;
+using Handler = pw::hsm::EventHandler<EPedestrianButton, ETimeout, ESigint>;
 	
 class ECarDetected : public pw::hsm::Event<ECarDetected, Handler>
 {
@@ -81,21 +35,24 @@ class ECarDetected : public pw::hsm::Event<ECarDetected, Handler>
 
 class EPedestrianButton : public pw::hsm::Event<EPedestrianButton, Handler>
 {
-	
-};
-
-class ETick : public pw::hsm::Event<ETick, Handler>
-{
-	
+public:
+	/*
+	* Repeated presses while one is still queued carry no new information
+	*/
+	static constexpr auto kCoalesce = pw::hsm::Coalesce::kReplace;
 };
 
 class ETimeout : public pw::hsm::Event<ETimeout, Handler>
 {
-	
+public:
+	static constexpr std::size_t kPriority = 1;
 };
 
 class ESigint : public pw::hsm::Event<ESigint, Handler>
 {
+public:
+	static constexpr std::size_t kPriority = 1;
+	
 public:
 	ESigint(int signum) : _signum(signum) {}
 		
@@ -105,8 +62,61 @@ private:
 	int _signum;
 };
 
+/*
+* When built with TRAFFIC_LIGHT_SIMULATION defined, all timeouts are measured
+* with a virtual clock and the light runs through a week of operation as fast
+* as it can.
+*/
+#ifdef TRAFFIC_LIGHT_SIMULATION
+using TrafficClock = pw::hsm::VirtualClock<>;
+#else
+using TrafficClock = std::chrono::steady_clock;
+#endif
+
+/**
+* @brief Configuration of the dispatch queue
+*
+* Control events (ETimeout, ESigint) use the higher priority lane. When the
+* queue is full, the oldest event of the lowest lane (i.e., a pedestrian
+* button press) is dropped so that timeouts are never lost.
+*/
+struct QConfig : pw::hsm::QueueConfig
+{
+	static constexpr std::size_t kCapacity = 16;
+	static constexpr std::size_t kLanes = 2;
+	static constexpr auto kOverflow = pw::hsm::Overflow::kDropOldest;
+	using Clock = TrafficClock;
+};
+
+/**
+* @brief Configuration of the timer service
+*/
+struct TConfig : pw::hsm::TimerConfig
+{
+	using Clock = TrafficClock;
+};
+
 using AbstractEvent = pw::hsm::AbstractEvent<Handler>;
-using Q = LockingQueue<std::unique_ptr<traffic_light::AbstractEvent>>;	
+using Q = pw::hsm::LockingEventQueue<Handler, QConfig>;
+
+/*
+* Timer owned by a state which queues an ETimeout when it expires. Since 
+* states are destroyed when they are exited, their timeouts are cancelled
+* automatically.
+*/
+using Timers = pw::hsm::TimerService<TConfig>;
+using Timeout = pw::hsm::Timer<ETimeout, Q, TConfig>;
+
+/*
+* Sleeps until an event is queued or the next timeout expires
+*/
+using Loop = pw::hsm::RunLoop<Q, Timers>;
+
+/*
+* Lock-free queue into which the SIGINT handler posts; drained into the
+* dispatch queue before its next pop
+*/
+using Signals = pw::hsm::SignalQueue<Handler, 4>;
 
 //==============================================================================
 // STATE DECLARATIONS
@@ -130,6 +140,9 @@ public:
 	HandleResult handle(const EPedestrianButton& e) override;
 	HandleResult handle(const ETimeout& e) override;
 	
+private:
+	Timeout _timeout;
+	
 }; //class SGreen
 
 
@@ -143,6 +156,9 @@ public:
 	
 	HandleResult handle(const ETimeout& e) override;
 	
+private:
+	Timeout _timeout;
+	
 }; //class SYellow
 
 
@@ -157,6 +173,9 @@ public:
 	
 	HandleResult handle(const ETimeout& e) override;
 	
+private:
+	Timeout _timeout;
+	
 }; //class SRed
 
 
@@ -167,34 +186,49 @@ class SRoot : public pw::hsm::State<SRoot, Handler, TrafficLight, SRed, SYellow,
 {
 public:
 	SRoot(Parent& parent);
-		
-	void startTimeout(std::chrono::seconds ms);
 	
-	HandleResult handle(const ETick& e) override;
 	HandleResult handle(const ESigint& e) override;
 
 public:
 	bool pedCrossing = false;
-		
-private:
-	int _timer;
 	
 }; //class SRoot
 
+/**
+* @brief Objects used by the states of the TrafficLight
+*
+* These are held in a base class which precedes pw::hsm::StateMachine so that
+* they are constructed before the StateMachine constructor enters the initial
+* state (which arms a timeout) and destroyed after the last state is exited.
+*/
+class TrafficLightServices
+{
+protected:
+	TrafficLightServices() { _q.attach(_signals); }
+	
+	Q _q;
+	Signals _signals;
+	Timers _timers;
+	Loop _loop{_q, _timers};
+	
+}; //class TrafficLightServices
+
 /**
 * @brief State machine for a basic traffic light that demonstrates queueing
-*        of events
+*        of events and state-owned timeouts
 */
-class TrafficLight : public pw::hsm::StateMachine<TrafficLight, SRoot>
+class TrafficLight : 
+	private TrafficLightServices,
+	public pw::hsm::StateMachine<TrafficLight, SRoot>
 {
 public:
 	/**
-	* @brief Create a copy of an event on the heap and add it to the dispatch
-	*        queue @ref _q to be dispatched into the state machine once the
+	* @brief Move (or copy, if it is an lvalue) an event into the dispatch 
+	*        queue @ref _q to be dispatched into the state machine once the 
 	*        current RTC step completes.
 	*/
 	template <typename E>
-	void dispatchLater(const E& e);
+	void dispatchLater(E&& e);
 	
 	/**
 	* @brief Start the event processing loop
@@ -202,7 +236,28 @@ public:
 	int exec();
 	
 	/**
-	* @brief Queue a ESigint event
+	* @brief Run the event processing loop for duration d of clock time
+	*/
+	template <typename REP, typename PERIOD>
+	void execFor(std::chrono::duration<REP, PERIOD> d) { _loop.run_for(*this, d); }
+	
+	/**
+	* @brief Statistics of the event processing loop
+	*/
+	const pw::hsm::RunLoopStats& loopStats() const { return _loop.stats(); }
+	
+	/**
+	* @brief Timer service used by the states' timeouts
+	*/
+	Timers& timers() { return _timers; }
+	
+	/**
+	* @brief Queue into which expired timeouts are posted
+	*/
+	Q& queue() { return _q; }
+	
+	/**
+	* @brief Queue a ESigint event (async-signal-safe)
 	*/
 	void sigint(int signum);
 	
@@ -211,20 +266,18 @@ public:
 	*/
 	void stop();
 	
-private:
-	Q _q;
-	bool _exit = false;
-	
 }; //class TrafficLight
 
 //==============================================================================
 // STATE METHOD DEFINITIONS
 //==============================================================================
 
-SGreen::SGreen(Parent& parent) : State(parent)
+SGreen::SGreen(Parent& parent) : 
+	State(parent),
+	_timeout(sm().timers(), sm().queue())
 {
 	std::cout << "\r\033[0;42m          \033[0;49m" << std::flush;
-	root().startTimeout(15s);
+	_timeout.start(15s);
 }
 	
 SGreen::HandleResult SGreen::handle(const EPedestrianButton& e)
@@ -234,7 +287,7 @@ SGreen::HandleResult SGreen::handle(const EPedestrianButton& e)
 	* presses the button to cross, this should cause the light to timeout
 	* (i.e., transition to red) faster and leave the light red longer.
 	*/
-	root().startTimeout(2s);
+	_timeout.start(2s);
 	root().pedCrossing = true;
 	
 	return kHandled;	
@@ -247,10 +300,12 @@ SGreen::HandleResult SGreen::handle(const ETimeout& e)
 
 //==============================================================================
 
-SYellow::SYellow(Parent& parent) : State(parent)
+SYellow::SYellow(Parent& parent) : 
+	State(parent),
+	_timeout(sm().timers(), sm().queue())
 {
 	std::cout << "\r\033[0;43m          \033[0;49m" << std::flush;
-	root().startTimeout(2s);
+	_timeout.start(2s);
 }
 
 SYellow::HandleResult SYellow::handle(const ETimeout& e)
@@ -260,7 +315,9 @@ SYellow::HandleResult SYellow::handle(const ETimeout& e)
 
 //==============================================================================
 
-SRed::SRed(Parent& parent) : State(parent)
+SRed::SRed(Parent& parent) : 
+	State(parent),
+	_timeout(sm().timers(), sm().queue())
 {
 	std::cout << "\r\033[0;41m          \033[0;49m" << std::flush;
 		
@@ -268,11 +325,11 @@ SRed::SRed(Parent& parent) : State(parent)
 	if (root().pedCrossing)
 	{
 		//Light stays red longer when a pedestrian is crossing
-		root().startTimeout(20s);
+		_timeout.start(20s);
 	}
 	else 
 	{
-		root().startTimeout(10s);
+		_timeout.start(10s);
 	}
 }
 
@@ -289,33 +346,11 @@ SRed::HandleResult SRed::handle(const ETimeout& e)
 //==============================================================================
 
 SRoot::SRoot(Parent& parent): 
-	State(parent), 
-	_timer(-1)
+	State(parent)
 {
 	
 }
 
-void SRoot::startTimeout(std::chrono::seconds sec)
-{
-	_timer = sec.count();
-}
-
-SRoot::HandleResult SRoot::handle(const ETick& e)
-{	
-	std::cout << "." << std::flush;
-	if (_timer > 0)
-	{
-		--_timer;
-	}
-	else if (_timer == 0)
-	{
-		sm().dispatchLater(ETimeout{});
-		_timer = -1;
-	}
-	
-	return kHandled;	
-}
-
 SRoot::HandleResult SRoot::handle(const ESigint& e)
 {	
 	//std::cout << "Unhandled SIGINT(" << e.signum() << ")" << std::endl;
@@ -330,47 +365,64 @@ SRoot::HandleResult SRoot::handle(const ESigint& e)
 //==============================================================================
 
 template <typename E>
-void TrafficLight::dispatchLater(const E& e)
+void TrafficLight::dispatchLater(E&& e)
 {
-	_q.push(std::make_unique<E>(e));
+	_q.push(std::forward<E>(e));
 }
 
 int TrafficLight::exec()
 {
-	while(!_exit)
-	{
-		std::unique_ptr<traffic_light::AbstractEvent> e;
-		bool success = _q.tryWaitAndPop(e, 1s);
-		if (success)
-		{
-			dispatch(*e);
-		}
-		else
-		{
-			dispatch(ETick{});
-		}
-	}
-	
+	_loop.run(*this);
 	return 0;
 }
 
 void TrafficLight::sigint(int signum)
 {
-	_q.push(std::make_unique<ESigint>(signum));
+	_signals.post(ESigint{signum});
 }
 
 void TrafficLight::stop()
 {
-	_exit = true;
+	_loop.stop();
 }
 
 } //namespace traffic_light
 
+#ifdef TRAFFIC_LIGHT_SIMULATION
+
+//==============================================================================
+// MAIN
+//==============================================================================
+
+int main()
+{
+	const auto start = std::chrono::steady_clock::now();
+	
+	traffic_light::TrafficLight light;
+	light.execFor(7 * 24h);
+	
+	const auto elapsed = std::chrono::steady_clock::now() - start;
+	const auto& stats = light.loopStats();
+	
+	std::cout << "\033[0;49m\nSimulated 7 days in "
+		<< std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() << " ms ("
+		<< stats.timers << " timeouts, " 
+		<< stats.events << " events dispatched)" << std::endl;
+	
+	return 0;
+}
+
+#else
+
 //==============================================================================
 // GLOBAL VARIABLES
 //==============================================================================
 
-static std::unique_ptr<traffic_light::TrafficLight> gLight;
+/*
+* Read by the signal handler, so it is a lock-free atomic rather than an 
+* owning pointer
+*/
+static std::atomic<traffic_light::TrafficLight*> gLight{nullptr};
 
 //==============================================================================
 // FUNCTIONS
@@ -378,9 +430,9 @@ static std::unique_ptr<traffic_light::TrafficLight> gLight;
 
 static void sigintHandler(int signum)
 {
-	if (gLight)
+	if (auto* light = gLight.load(std::memory_order_acquire))
 	{
-		gLight->sigint(signum);
+		light->sigint(signum);
 	}
 }
 
@@ -390,9 +442,17 @@ static void sigintHandler(int signum)
 
 int main()
 {
-	gLight = std::make_unique<traffic_light::TrafficLight>();
+	traffic_light::TrafficLight light;
+	gLight.store(&light, std::memory_order_release);
 
 	signal(SIGINT, sigintHandler);
 		
-	return gLight->exec();
-}
\ No newline at end of file
+	const int result = light.exec();
+	
+	signal(SIGINT, SIG_DFL);
+	gLight.store(nullptr, std::memory_order_release);
+	
+	return result;
+}
+
+#endif //TRAFFIC_LIGHT_SIMULATION
@@ -0,0 +1,204 @@
+//==============================================================================
+// INCLUDES
+//==============================================================================
+
+#include <pw/hsm.hpp>
+#include <pw/hsm/wait.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+#include <thread>
+#include <time.h>
+
+using namespace std::chrono_literals;
+
+/*
+* A job runner, whose machine is dispatched on a thread of its own, goes from
+* SIdle to SBusy and back kRounds times, kDwell apart. A supervisor follows
+* it, once by blocking in pw::hsm::wait_until_in and once by polling the
+* published active state every kPollPeriod (the way our drivers used to).
+*
+* The program prints, for both, how late the supervisor noticed each
+* transition (measured from the published timestamp) and how much CPU time
+* the supervisor's thread used.
+*/
+
+namespace wait_for_state
+{
+
+//==============================================================================
+// EVENTS
+//==============================================================================
+
+class EStart;
+class EDone;
+
+using Handler = pw::hsm::EventHandler<EStart, EDone>;
+
+class EStart : public pw::hsm::Event<EStart, Handler> {};
+class EDone : public pw::hsm::Event<EDone, Handler> {};
+
+constexpr std::size_t kRounds = 200;
+constexpr auto kDwell = 2ms;
+constexpr auto kPollPeriod = 100us;
+
+/*
+* After which a supervisor gives up on a state, which it may have missed if
+* it was not scheduled for longer than kDwell
+*/
+constexpr auto kTimeout = 100ms;
+
+//==============================================================================
+// STATE MACHINE
+//==============================================================================
+
+class Runner;
+class SRoot;
+class SBusy;
+
+class SIdle : public pw::hsm::State<SIdle, Handler, SRoot>
+{
+public:
+	SIdle(Parent& parent) : State(parent) {}
+
+	HandleResult handle(const EStart& e) override { return transition<SBusy>(); }
+};
+
+class SBusy : public pw::hsm::State<SBusy, Handler, SRoot>
+{
+public:
+	SBusy(Parent& parent) : State(parent) {}
+
+	HandleResult handle(const EDone& e) override { return transition<SIdle>(); }
+};
+
+class SRoot : public pw::hsm::State<SRoot, Handler, Runner, SIdle, SBusy>
+{
+public:
+	SRoot(Parent& parent) : State(parent) {}
+};
+
+struct RunnerConfig : pw::hsm::DefaultConfig
+{
+	static constexpr bool kPublishActiveState = true;
+};
+
+class Runner : public pw::hsm::StateMachine<Runner, SRoot, RunnerConfig>
+{
+public:
+	/**
+	* @brief Go through kRounds jobs
+	*/
+	void run()
+	{
+		for (std::size_t i = 0; i < kRounds; ++i)
+		{
+			std::this_thread::sleep_for(kDwell);
+			dispatch(EStart{});
+			std::this_thread::sleep_for(kDwell);
+			dispatch(EDone{});
+		}
+	}
+};
+
+} //namespace wait_for_state
+
+//==============================================================================
+// MAIN
+//==============================================================================
+
+using namespace wait_for_state;
+
+/**
+* @return CPU time used by the calling thread
+*/
+static std::chrono::nanoseconds threadCpuTime()
+{
+	timespec ts{};
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return std::chrono::seconds(ts.tv_sec) + std::chrono::nanoseconds(ts.tv_nsec);
+}
+
+/**
+* @brief Follow a runner through all its rounds, calling wait<S>(runner) to
+*        wait until it is in S
+*/
+template <typename WAIT>
+static void supervise(const char* name, WAIT&& wait)
+{
+	Runner runner;
+	std::chrono::nanoseconds total{0};
+	std::chrono::nanoseconds worst{0};
+	std::size_t missed = 0;
+
+	std::thread thread([&runner]() { runner.run(); });
+	const auto cpu = threadCpuTime();
+
+	auto follow = [&](auto state) {
+		using S = typename decltype(state)::type;
+		if (!wait.template operator()<S>(runner))
+		{
+			++missed;
+			return;
+		}
+
+		const auto late = std::chrono::steady_clock::now() - runner.active_state().since;
+		total += late;
+		worst = std::max<std::chrono::nanoseconds>(worst, late);
+	};
+
+	for (std::size_t i = 0; i < kRounds; ++i)
+	{
+		follow(std::common_type<SBusy>{});
+		follow(std::common_type<SIdle>{});
+	}
+
+	const std::chrono::duration<double, std::milli> used = threadCpuTime() - cpu;
+	thread.join();
+
+	std::cout << "  " << name << ": noticed " << std::chrono::duration<double, std::micro>(total).count() / (2 * kRounds - missed)
+		<< " us late on average, " << std::chrono::duration<double, std::micro>(worst).count() << " us at worst, "
+		<< used.count() << " ms of CPU, " << missed << " missed" << std::endl;
+}
+
+/**
+* @brief Wait with pw::hsm::wait_until_in
+*/
+struct Block
+{
+	template <typename S>
+	bool operator()(Runner& runner) { return pw::hsm::wait_until_in<S>(runner, kTimeout); }
+};
+
+/**
+* @brief Wait by polling the published state
+*/
+struct Poll
+{
+	template <typename S>
+	bool operator()(Runner& runner)
+	{
+		const auto deadline = std::chrono::steady_clock::now() + kTimeout;
+		while (!Runner::is_within<S>(runner.active_state().leaf))
+		{
+			if (std::chrono::steady_clock::now() >= deadline)
+			{
+				return false;
+			}
+			std::this_thread::sleep_for(kPollPeriod);
+		}
+		return true;
+	}
+};
+
+int main()
+{
+	std::cout << kRounds << " rounds, " << 2 * kRounds << " transitions:" << std::endl;
+
+	supervise("wait_until_in", Block{});
+	supervise("poll", Poll{});
+
+	return 0;
+}
@@ -3,6 +3,17 @@
 
 #include <variant>
 #include <tuple>
+#include <algorithm>
+#include <cstddef>
+#include <new>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <iterator>
+#include <utility>
+#include <cassert>
+#include <chrono>
+#include <thread>
 
 //==============================================================================
 
@@ -36,6 +47,143 @@ struct nearest_ancestor<T, U, std::enable_if_t<std::is_same_v<T, typename U::Par
 	using type = U;
 };
 
+/**
+* @brief Compile-time list of types
+*/
+template <typename ... Ts>
+struct TypeList {};
+
+/**
+* @brief Trait which concatenates any number of @ref TypeList into one
+*/
+template <typename ... LISTS>
+struct concat
+{
+	using type = TypeList<>;
+};
+
+template <typename ... As>
+struct concat<TypeList<As...>>
+{
+	using type = TypeList<As...>;
+};
+
+template <typename ... As, typename ... Bs, typename ... REST>
+struct concat<TypeList<As...>, TypeList<Bs...>, REST...>
+{
+	using type = typename concat<TypeList<As..., Bs...>, REST...>::type;
+};
+
+template <typename ... LISTS>
+using concat_t = typename concat<LISTS...>::type;
+
+/**
+* @brief Trait which collects the deferred event types of state S and all of
+*        its extended children into a single @ref TypeList
+*
+* Used by the StateMachine to size its deferred event buffer.
+*/
+template <typename S, typename CHILDREN = typename S::Children>
+struct deferred_events;
+
+template <typename S, typename ... CHILDREN>
+struct deferred_events<S, TypeList<CHILDREN...>>
+{
+	using type = concat_t<
+		typename S::Deferred, 
+		typename deferred_events<CHILDREN>::type...
+	>;
+};
+
+template <typename S>
+using deferred_events_t = typename deferred_events<S>::type;
+
+/**
+* @brief Trait which finds the index of type T in a @ref TypeList
+*/
+template <typename T, typename LIST>
+struct index_of;
+
+template <typename T, typename ... REST>
+struct index_of<T, TypeList<T, REST...>> : std::integral_constant<std::size_t, 0> {};
+
+template <typename T, typename FIRST, typename ... REST>
+struct index_of<T, TypeList<FIRST, REST...>> : 
+	std::integral_constant<std::size_t, 1 + index_of<T, TypeList<REST...>>::value> {};
+
+template <typename T, typename LIST>
+inline constexpr std::size_t index_of_v = index_of<T, LIST>::value;
+
+/**
+* @brief Number of types in a @ref TypeList
+*/
+template <typename LIST>
+struct size;
+
+template <typename ... Ts>
+struct size<TypeList<Ts...>> : std::integral_constant<std::size_t, sizeof...(Ts)> {};
+
+template <typename LIST>
+inline constexpr std::size_t size_v = size<LIST>::value;
+
+/**
+* @brief Trait which extracts the event types of an EventHandler into a
+*        @ref TypeList
+*/
+template <typename HANDLER>
+struct handler_events;
+
+template <typename HANDLER>
+using handler_events_t = typename handler_events<HANDLER>::type;
+
+/**
+* @brief Size and alignment of storage large enough for any type in LIST
+*/
+template <typename LIST>
+struct storage_for;
+
+template <typename ... Ts>
+struct storage_for<TypeList<Ts...>>
+{
+	static constexpr std::size_t size = std::max({sizeof(Ts)...});
+	static constexpr std::size_t align = std::max({alignof(Ts)...});
+};
+
+/**
+* @return The index of the most significant bit set in x (x must not be 0)
+*/
+inline unsigned highest_bit(std::uint32_t x)
+{
+#if defined(__GNUC__)
+	return 31u - static_cast<unsigned>(__builtin_clz(x));
+#else
+	unsigned i = 0;
+	while (x >>= 1)
+	{
+		++i;
+	}
+	return i;
+#endif
+}
+
+/**
+* @return The index of the least significant bit set in x (x must not be 0)
+*/
+inline unsigned lowest_bit(std::uint32_t x)
+{
+#if defined(__GNUC__)
+	return static_cast<unsigned>(__builtin_ctz(x));
+#else
+	unsigned i = 0;
+	while ((x & 1u) == 0)
+	{
+		x >>= 1;
+		++i;
+	}
+	return i;
+#endif
+}
+
 } //namespace pw::hsm::detail
 
 //==============================================================================
@@ -43,7 +191,17 @@ struct nearest_ancestor<T, U, std::enable_if_t<std::is_same_v<T, typename U::Par
 namespace pw::hsm
 {
 
-//using HandleResult = detail::TransitionObject;
+/**
+* @brief Value returned by a state's event handler: true if the event was
+*        handled
+*
+* The StateMachine notices transitions itself (see detail::Step), so a
+* handler which performs a transition and returns kHandled (or true) has
+* deferred events replayed and the new configuration published once the RTC
+* step completes. It must not return kPass (or false), though: the states the
+* event would be passed to may have been exited by the transition. Debug
+* builds assert this.
+*/
 using HandleResult = bool;
 
 /**
@@ -51,14 +209,192 @@ using HandleResult = bool;
 *        has fully "handled" the event and thus it should not be dispatched to
 *        the parent state.
 */
-inline const auto kHandled = true;
+inline constexpr HandleResult kHandled = true;
 
 /**
 * @brief Return from within a state event handler to signify that this state
 *        would like to "pass" the event to its parent (i.e., it has not fully
 *        "handled" the event)
 */
-inline const auto kPass = false;
+inline constexpr HandleResult kPass = false;
+
+/**
+* @brief List of event types which a state defers
+*
+* A state defers events by declaring a member alias named Deferred:
+*     using Deferred = pw::hsm::Defer<EventA, EventB>;
+* An event of a deferred type which reaches the state unhandled by its active
+* children is copied into the StateMachine's deferred event buffer instead of
+* being handled. Buffered events are replayed, in the order in which they were
+* deferred, after the next transition changes the active configuration.
+*
+* An event which cannot be buffered is not deferred but passed to the state's
+* parent: when the buffer is full (which DeferStats::overflows counts), or
+* when the event can only be moved and the machine does not own it (see
+* StateMachine::dispatch(Event&&)).
+*/
+template <typename ... Es>
+using Defer = detail::TypeList<Es...>;
+
+/**
+* @brief Marks the children of a state as orthogonal regions
+*
+* A state declared as
+*     State<T, Handler, Parent, pw::hsm::Orthogonal<RegionA, RegionB>>
+* is an AND-state: while it is active, all of its regions are active at once.
+* Each region is a state whose parent is T, typically a composite state
+* whose children make up the region's own hierarchy.
+*/
+template <typename ... REGIONS>
+struct Orthogonal {};
+
+/**
+* @brief List of the regions of an orthogonal state which may process an
+*        event in parallel
+*
+* An orthogonal state declares its independent regions with a member alias
+* named IndependentRegions:
+*     using IndependentRegions = pw::hsm::Independent<RegionB, RegionC>;
+* For every event, the other regions are dispatched first, in turn, and the
+* independent regions are then dispatched at the same time on the machine's
+* region_pool() (see pw::hsm::RegionPool). The RTC step ends once all of
+* them have finished.
+*
+* An independent region must only transition within itself, must not defer
+* events and must not share unsynchronized data (including machine-wide
+* services such as timers) with the other regions. A transition which leaves
+* an independent region does not compile. A transition within one is noticed
+* by the machine whichever thread ran the region, as in any other state.
+*/
+template <typename ... REGIONS>
+using Independent = detail::TypeList<REGIONS...>;
+
+/**
+* @brief How an event queue treats an event of a type of which an instance is
+*        already pending (see pw::hsm::EventQueue)
+*/
+enum class Coalesce
+{
+	/**
+	* @brief Every event is queued
+	*/
+	kNone,
+	
+	/**
+	* @brief The pending event is replaced by the newer event
+	*/
+	kReplace,
+	
+	/**
+	* @brief The newer event is combined into the pending event by calling
+	*        pending.merge(newer)
+	*/
+	kMerge
+};
+
+/**
+* @brief Compile-time configuration of a StateMachine
+*
+* To change a setting, inherit from DefaultConfig, redeclare the setting and
+* pass the new type as the CONFIG argument of StateMachine.
+*/
+struct DefaultConfig
+{
+	/**
+	* @brief Maximum number of deferred events the StateMachine can buffer
+	*/
+	static constexpr std::size_t kDeferCapacity = 8;
+	
+	/**
+	* @brief Whether the StateMachine publishes, after every transition, the 
+	*        set of event types its active configuration handles
+	*
+	* When enabled, StateMachine::would_handle reads the published set (an
+	* atomic bit test) and may therefore be called from any thread, e.g., to
+	* filter events before they are queued. When disabled it walks the active
+	* configuration and must be called from the thread running the machine.
+	*/
+	static constexpr bool kPublishHandledEvents = false;
+	
+	/**
+	* @brief Whether the StateMachine publishes, after every transition, its
+	*        active leaf state, its number of transitions and the time of
+	*        the last one
+	*
+	* When enabled, StateMachine::active_state may be called from any thread
+	* (e.g., by a monitor) without ever blocking the machine. A transition
+	* costs a walk down the active configuration and a seqlock write.
+	*/
+	static constexpr bool kPublishActiveState = false;
+	
+	/**
+	* @brief Clock which timestamps the published active state
+	*/
+	using Clock = std::chrono::steady_clock;
+};
+
+template <typename T, typename ROOT, typename CONFIG = DefaultConfig>
+class StateMachine;
+
+/**
+* @brief Statistics of a StateMachine's deferred event buffer
+*/
+struct DeferStats
+{
+	std::size_t size;
+	std::size_t capacity;
+	std::size_t highWaterMark;
+	std::size_t overflows;
+};
+
+/**
+* @brief Snapshot of the active state of a StateMachine (see 
+*        DefaultConfig::kPublishActiveState)
+*/
+template <typename CLOCK>
+struct ActiveState
+{
+	/**
+	* @brief ID of the innermost active state (see StateMachine::state_id)
+	*
+	* The regions of an orthogonal state are not described: while one is
+	* active, the orthogonal state itself is reported.
+	*/
+	std::size_t leaf;
+	
+	/**
+	* @brief Number of RTC steps which caused a transition since the machine
+	*        was constructed
+	*/
+	std::uint64_t transitions;
+	
+	/**
+	* @brief When the last of these steps ended (or the machine was
+	*        constructed, if none did)
+	*/
+	typename CLOCK::time_point since;
+};
+
+/**
+* @brief Summary of a StateMachine::dispatch_batch call
+*/
+struct BatchResult
+{
+	/**
+	* @brief Number of events handled (or deferred) by a state
+	*/
+	std::size_t handled;
+	
+	/**
+	* @brief Number of events passed all the way up past the root state
+	*/
+	std::size_t passed;
+	
+	/**
+	* @brief Number of events which caused a transition
+	*/
+	std::size_t transitions;
+};
 
 } //namespace pw::hsm
 
@@ -78,6 +414,13 @@ class AbstractEvent
 {
 public:
 	virtual HandleResult accept(HANDLER& h) const = 0;
+	
+	/**
+	* @brief Visit h with this event as an rvalue, so that a handler declared
+	*        as handle(E&&) may move its payload out (handle(const E&) is
+	*        visited instead unless the event is Movable in HANDLER)
+	*/
+	virtual HandleResult accept_moved(HANDLER& h) = 0;
 };
 
 /**
@@ -89,330 +432,2053 @@ public:
 template <typename T, typename HANDLER>
 class Event : public AbstractEvent<HANDLER>
 {
+public:
+	/*
+	* Priority lane used by pw::hsm::EventQueue when this event is queued.
+	* Events may redeclare this constant; higher lanes are dequeued first.
+	*/
+	static constexpr std::size_t kPriority = 0;
+	
+	/*
+	* Whether pw::hsm::EventQueue keeps at most one pending instance of this
+	* event (see pw::hsm::Coalesce). Events may redeclare this constant.
+	*/
+	static constexpr Coalesce kCoalesce = Coalesce::kNone;
+	
 public:
 	HandleResult accept(HANDLER& h) const final
 	{
 		return h.handle(static_cast<const T&>(*this));
 	}
+	
+	HandleResult accept_moved(HANDLER& h) final
+	{
+		return h.handle(std::move(static_cast<T&>(*this)));
+	}
+};
+
+//==============================================================================
+
+/**
+* @brief Marks an event in an EventHandler's list whose handlers may take it
+*        as an rvalue (see EventHandler)
+*/
+template <typename E>
+struct Movable {};
+
+} //namespace pw::hsm
+
+//==============================================================================
+
+namespace pw::hsm::detail
+{
+
+/**
+* @brief Link of an EventHandler which declares the handlers for events of
+*        type E on top of BASE (the links for the following events, or void)
+*/
+template <typename E, typename BASE>
+class EventHandlerLink : public BASE
+{
+public:
+	using BASE::handle;
+	virtual HandleResult handle(const E& e) { return kPass; }
+};
+
+template <typename E>
+class EventHandlerLink<E, void>
+{
+public:
+	virtual HandleResult handle(const E& e) { return kPass; }
+};
+
+template <typename E, typename BASE>
+class EventHandlerLink<Movable<E>, BASE> : public EventHandlerLink<E, BASE>
+{
+public:
+	using EventHandlerLink<E, BASE>::handle;
+	virtual HandleResult handle(E&& e) { return handle(static_cast<const E&>(e)); }
 };
 
+} //namespace pw::hsm::detail
+
 //==============================================================================
 
+namespace pw::hsm
+{
+
 /**
 * @brief Template class used to declare an event handler base class
 *        (i.e., visitor interface) for events in a state machine.
+*
+* Each event E has a handler handle(const E&), which is called for every
+* event. An event listed as Movable<E> has a second handler, handle(E&&),
+* which is called instead when the machine owns the event (see
+* StateMachine::dispatch(Event&&)) and by default calls handle(const E&). A
+* state which overrides handle(E&&) may move the event's payload out, and
+* should then handle the event rather than pass it, since its ancestors would
+* see what is left of it. It only receives events which the machine owns, so
+* a state which must also see events dispatched as lvalues overrides both.
 */
 template <typename ... Es>
 class EventHandler;
 
 template <typename FIRST>
-class EventHandler<FIRST>
+class EventHandler<FIRST> : public detail::EventHandlerLink<FIRST, void>
 {
-public:
-	virtual HandleResult handle(const FIRST& e) { return kPass; }
+
 };
 
 template <typename FIRST, typename ... REST>
-class EventHandler<FIRST, REST...> : public EventHandler<REST...>
+class EventHandler<FIRST, REST...> : public detail::EventHandlerLink<FIRST, EventHandler<REST...>>
 {
-public:
-	using EventHandler<REST...>::handle;
-	virtual HandleResult handle(const FIRST& e) { return kPass; }
+
 };
 
+} //namespace pw::hsm
+
 //==============================================================================
 
+namespace pw::hsm::detail
+{
+
 /**
-* @brief A state with children
+* @brief Trait which gives the event type E of an entry E or Movable<E> in an
+*        EventHandler's list
+*/
+template <typename E>
+struct unmovable
+{
+	using type = E;
+};
+
+template <typename E>
+struct unmovable<Movable<E>>
+{
+	using type = E;
+};
+
+template <typename E>
+using unmovable_t = typename unmovable<E>::type;
+
+template <typename ... Es>
+struct handler_events<EventHandler<Es...>>
+{
+	using type = TypeList<unmovable_t<Es>...>;
+};
+
+/**
+* @brief Trait which is true if HANDLER lists event type E as Movable<E>
+*/
+template <typename HANDLER, typename E>
+struct handler_moves;
+
+template <typename E, typename ... Es>
+struct handler_moves<EventHandler<Es...>, E> : std::bool_constant<(std::is_same_v<Movable<E>, Es> || ...)> {};
+
+template <typename HANDLER, typename E>
+inline constexpr bool handler_moves_v = handler_moves<HANDLER, E>::value;
+
+/**
+* @brief The RTC step which a StateMachine is running on the calling thread
 *
-* The first child in the CHILDREN parameter pack is considered the "initial
-* state" for performing the initial transition.
+* A state which performs a transition marks the current step, so the machine
+* notices the transition whatever the handler returns. The step is reached
+* through a thread-local pointer rather than through sm(), since a state's
+* transitions may be instantiated where its machine is an incomplete type.
 */
-template <typename T, typename HANDLER, typename PARENT, typename ... CHILDREN>
-class State : public HANDLER
+struct Step
 {
-	/*
-	* All State classes are made friends of each other so that they may call
-	* the private _doTransition method
-	*/
-	template <typename T_, typename VISITOR_, typename PARENT_, typename ... CHILDREN_>
-	friend
-	class State;
-	
-public:
-	using InitialState = detail::first_of_t<CHILDREN...>;
-	using NoState = std::monostate;
-	using Event = AbstractEvent<HANDLER>;
-	using Parent = PARENT;
-	
-	/*
-	* "Import" pw::hsm::HandleResult into State's namespace as a convenience
-	* to the library user. Now, in the state's declaration, instead of having
-	* to type something like
-	*     pw::hsm::HandleResult handle(const MyEvent& e) override;
-	* The user can type
-	*     HandleResult handle(const MyEvent& e) override;
-	*/
-	using HandleResult = ::pw::hsm::HandleResult;
-	
-	/*
-	* Added as a convenience to the user so they can directly return kPass or
-	* kHandled from a state's event handler methods.
-	*/
-	inline static const auto kHandled = ::pw::hsm::kHandled;
-	inline static const auto kPass = ::pw::hsm::kPass;
-	
-public:
-	template <typename ROOT, typename CHILD>
-	static constexpr bool root_has_child()
+	static Step*& current()
 	{
-		return ROOT::template has_child<CHILD>();
+		static thread_local Step* step = nullptr;
+		return step;
+	}
+	
+	static void mark_transition()
+	{
+		//Null outside of dispatch (e.g., when a state transitions from init())
+		if (Step* step = current())
+		{
+			step->transitioned = true;
+		}
+	}
+	
+	bool transitioned = false;
+};
+
+/**
+* @brief Fixed-capacity FIFO of deferred events stored in place
+*
+* Every slot is large enough to hold any of the event types in LIST. One more
+* slot than CAPACITY is allocated so that the event at the front can be
+* dispatched directly from its slot while it is being replayed, leaving
+* CAPACITY slots free for it (or others) to be deferred again.
+*/
+template <typename EVENT, typename LIST, std::size_t CAPACITY>
+class DeferQueue;
+
+template <typename EVENT, std::size_t CAPACITY>
+class DeferQueue<EVENT, TypeList<>, CAPACITY>
+{
+public:
+	static constexpr std::size_t kCapacity = 0;
+	
+	bool empty() const { return true; }
+	std::size_t size() const { return 0; }
+	DeferStats stats() const { return {0, 0, 0, 0}; }
+};
+
+template <typename EVENT, typename ... Es, std::size_t CAPACITY>
+class DeferQueue<EVENT, TypeList<Es...>, CAPACITY>
+{
+	static_assert(CAPACITY > 0, "kDeferCapacity must be greater than 0");
+	
+	static constexpr std::size_t kSlots = CAPACITY + 1;
+	static constexpr std::size_t kSlotSize = storage_for<TypeList<Es...>>::size;
+	static constexpr std::size_t kSlotAlign = storage_for<TypeList<Es...>>::align;
+	
+	struct Slot
+	{
+		alignas(kSlotAlign) unsigned char storage[kSlotSize];
+		EVENT* event;
+		void (*destroy)(void*);
+	};
+	
+public:
+	static constexpr std::size_t kCapacity = CAPACITY;
+	
+	DeferQueue() = default;
+	DeferQueue(const DeferQueue&) = delete;
+	DeferQueue& operator=(const DeferQueue&) = delete;
+	
+	~DeferQueue()
+	{
+		while (_size > 0)
+		{
+			_pop();
+		}
+	}
+	
+	bool empty() const { return _size == 0; }
+	std::size_t size() const { return _size; }
+	
+	DeferStats stats() const 
+	{ 
+		return {_size, CAPACITY, _highWaterMark, _overflows}; 
+	}
+	
+	/**
+	* @brief Copy (or move, if it is an rvalue) event e into the back of the
+	*        queue
+	*
+	* @retval false if the queue is full (the event is not queued, and counted)
+	*/
+	template <typename E>
+	bool push(E&& e)
+	{
+		using U = std::remove_cv_t<std::remove_reference_t<E>>;
+		static_assert(std::is_constructible_v<U, E&&>, "A move-only event can only be deferred as an rvalue");
+		
+		if (_size == CAPACITY)
+		{
+			++_overflows;
+			return false;
+		}
+		
+		Slot& slot = _slots[(_head + _size) % kSlots];
+		slot.event = ::new (static_cast<void*>(slot.storage)) U(std::forward<E>(e));
+		slot.destroy = [](void* p){ static_cast<U*>(p)->~U(); };
+		
+		_highWaterMark = std::max(_highWaterMark, ++_size);
+		return true;
+	}
+	
+	/**
+	* @brief Remove the event at the front of the queue and pass it to f 
+	*        before destroying it (f may move from it)
+	*/
+	template <typename F>
+	void consume_front(F&& f)
+	{
+		Slot& slot = _slots[_head];
+		_head = (_head + 1) % kSlots;
+		--_size;
+		
+		f(*slot.event);
+		slot.destroy(slot.storage);
+	}
+	
+private:
+	void _pop()
+	{
+		consume_front([](const EVENT&){});
+	}
+	
+private:
+	Slot _slots[kSlots];
+	std::size_t _head = 0;
+	std::size_t _size = 0;
+	std::size_t _highWaterMark = 0;
+	std::size_t _overflows = 0;
+};
+
+/**
+* @brief Visitor which copies events of the types Es... into a DeferQueue,
+*        or moves them if the machine owns them and HANDLER lists them as
+*        Movable
+*
+* All other event types fall through to the HANDLER defaults and are thus
+* reported as not deferred (i.e., kPass), as are events which the queue
+* cannot take (see pw::hsm::Defer).
+*/
+template <typename HANDLER, typename QUEUE, typename ... Es>
+class DeferVisitor;
+
+template <typename HANDLER, typename QUEUE>
+class DeferVisitor<HANDLER, QUEUE> : public HANDLER
+{
+public:
+	DeferVisitor(QUEUE& q) : _q(q) {}
+	
+protected:
+	QUEUE& _q;
+};
+
+/**
+* @brief Layer of a DeferVisitor which moves events of type E into the queue
+*        when they are visited as rvalues (i.e., if they are Movable)
+*/
+template <typename BASE, typename E, bool MOVABLE>
+class DeferMoved : public BASE
+{
+public:
+	using BASE::BASE;
+	using BASE::handle;
+};
+
+template <typename BASE, typename E>
+class DeferMoved<BASE, E, true> : public BASE
+{
+public:
+	using BASE::BASE;
+	using BASE::handle;
+	
+	HandleResult handle(E&& e) override
+	{
+		return this->_q.push(std::move(e)) ? kHandled : kPass;
+	}
+};
+
+template <typename HANDLER, typename QUEUE, typename FIRST, typename ... REST>
+class DeferVisitor<HANDLER, QUEUE, FIRST, REST...> : 
+	public DeferMoved<DeferVisitor<HANDLER, QUEUE, REST...>, FIRST, handler_moves_v<HANDLER, FIRST>>
+{
+	using Base = DeferMoved<DeferVisitor<HANDLER, QUEUE, REST...>, FIRST, handler_moves_v<HANDLER, FIRST>>;
+	
+	static_assert(std::is_copy_constructible_v<FIRST> || handler_moves_v<HANDLER, FIRST>, "A move-only event must be Movable to be deferred");
+	
+public:
+	using Base::Base;
+	using Base::handle;
+	
+	HandleResult handle(const FIRST& e) override
+	{
+		if constexpr (std::is_copy_constructible_v<FIRST>)
+		{
+			return this->_q.push(e) ? kHandled : kPass;
+		}
+		else
+		{
+			return kPass;
+		}
+	}
+};
+
+template <typename HANDLER, typename QUEUE, typename LIST>
+struct defer_visitor;
+
+template <typename HANDLER, typename QUEUE, typename ... Es>
+struct defer_visitor<HANDLER, QUEUE, TypeList<Es...>>
+{
+	using type = DeferVisitor<HANDLER, QUEUE, Es...>;
+};
+
+/**
+* @brief Trait which is true if type T is in LIST
+*/
+template <typename T, typename LIST>
+struct contains;
+
+template <typename T, typename ... Ts>
+struct contains<T, TypeList<Ts...>> : std::bool_constant<(std::is_same_v<T, Ts> || ...)> {};
+
+template <typename T, typename LIST>
+inline constexpr bool contains_v = contains<T, LIST>::value;
+
+/**
+* @brief Trait which is true if state S is listed in its parent's
+*        IndependentRegions (see pw::hsm::Independent)
+*/
+template <typename S, typename ENABLE = void>
+struct is_independent_region : std::false_type {};
+
+template <typename S>
+struct is_independent_region<S, std::void_t<typename S::Parent::IndependentRegions>> : 
+	contains<S, typename S::Parent::IndependentRegions> {};
+
+/**
+* @brief Trait which is true if class C is a link of an EventHandler, i.e.,
+*        declares the default handlers of an event
+*/
+template <typename C>
+struct is_handler_link : std::false_type {};
+
+template <typename E, typename BASE>
+struct is_handler_link<EventHandlerLink<E, BASE>> : std::true_type {};
+
+/*
+* Deduces the class C which declares the handle(const E&) overload found by
+* name lookup in a state. Overloads for other events fail deduction.
+*/
+template <typename E, typename C>
+C handler_class_of(HandleResult (C::*)(const E&));
+
+/**
+* @brief Trait which is true if state T may override handle(const E&)
+*
+* Only a lookup which finds the default declared by EventHandler proves that
+* T does not handle E. Any other outcome counts as an override, which errs on
+* the side of offering E to T: a handler declared by T or by a base class of
+* T, but also a lookup which fails because T hides the handler (by declaring
+* handlers for other events only) or overrides it privately, since a virtual
+* call reaches such overrides all the same. A state may declare
+* "using State::handle;" to keep the handlers it does not override visible.
+*/
+template <typename T, typename E, typename ENABLE = void>
+struct overrides_handle : std::true_type {};
+
+template <typename T, typename E>
+struct overrides_handle<T, E, std::void_t<decltype(handler_class_of<E>(&T::handle))>> : 
+	std::negation<is_handler_link<decltype(handler_class_of<E>(&T::handle))>> {};
+
+/*
+* Deduces the class C which declares the handle(E&&) overload found by name
+* lookup in a state
+*/
+template <typename E, typename C>
+C rvalue_handler_class_of(HandleResult (C::*)(E&&));
+
+/**
+* @brief Trait which is true if state T may override handle(E&&), which only
+*        Movable events have (see overrides_handle)
+*/
+template <typename T, typename E, typename ENABLE = void>
+struct overrides_rvalue_handle : std::bool_constant<handler_moves_v<typename T::Handler, E>> {};
+
+template <typename T, typename E>
+struct overrides_rvalue_handle<T, E, std::void_t<decltype(rvalue_handler_class_of<E>(&T::handle))>> : 
+	std::negation<is_handler_link<decltype(rvalue_handler_class_of<E>(&T::handle))>> {};
+
+/**
+* @brief Trait which is true if state T may override handle(E&&) for any of
+*        the events in LIST, and so must be visited with the events which the
+*        machine owns as rvalues
+*/
+template <typename T, typename LIST = handler_events_t<typename T::Handler>>
+struct takes_rvalues;
+
+template <typename T, typename ... Es>
+struct takes_rvalues<T, TypeList<Es...>> : 
+	std::bool_constant<(overrides_rvalue_handle<T, Es>::value || ...)> {};
+
+template <typename T>
+inline constexpr bool takes_rvalues_v = takes_rvalues<T>::value;
+
+/**
+* @brief Trait which is true if state T may handle, or defers, events of
+*        type E (false only if T certainly passes them)
+*/
+template <typename T, typename E>
+inline constexpr bool accepts_v = 
+	overrides_handle<T, E>::value || 
+	overrides_rvalue_handle<T, E>::value || 
+	contains_v<E, typename T::Deferred>;
+
+/**
+* @brief Trait which is true if state S or any of its extended children 
+*        handles or defers events of type E
+*/
+template <typename S, typename E, typename CHILDREN = typename S::Children>
+struct subtree_accepts;
+
+template <typename S, typename E, typename ... CHILDREN>
+struct subtree_accepts<S, E, TypeList<CHILDREN...>> : 
+	std::bool_constant<accepts_v<S, E> || (subtree_accepts<CHILDREN, E>::value || ...)> {};
+
+template <typename S, typename E>
+inline constexpr bool subtree_accepts_v = subtree_accepts<S, E>::value;
+
+/**
+* @brief Trait which is true if state T handles or defers events of type E,
+*        or, if E is void, any of the events in its handler's event list
+*/
+template <typename T, typename E, typename EVENTS = handler_events_t<typename T::Handler>>
+struct chain_accepts : std::bool_constant<accepts_v<T, E>> {};
+
+template <typename T, typename ... Es>
+struct chain_accepts<T, void, TypeList<Es...>> : std::bool_constant<(accepts_v<T, Es> || ...)> {};
+
+/**
+* @brief Trait which computes the number of states on the longest path from
+*        state S down to a leaf (inclusive)
+*/
+template <typename S, typename CHILDREN = typename S::Children>
+struct depth;
+
+template <typename S, typename ... CHILDREN>
+struct depth<S, TypeList<CHILDREN...>> : 
+	std::integral_constant<std::size_t, 1 + std::max({std::size_t(0), depth<CHILDREN>::value...})> {};
+
+/**
+* @brief Trait which lists state S and all of its extended children in
+*        depth-first pre-order, so that the states of every subtree are
+*        contiguous in the list
+*/
+template <typename S, typename CHILDREN = typename S::Children>
+struct states;
+
+template <typename S, typename ... CHILDREN>
+struct states<S, TypeList<CHILDREN...>>
+{
+	using type = concat_t<TypeList<S>, typename states<CHILDREN>::type...>;
+};
+
+template <typename S>
+using states_t = typename states<S>::type;
+
+/**
+* @brief The active states of a configuration, ordered from the leaf up to 
+*        the root, which an event is offered to
+*
+* Each link stores a state and a function which dispatches an event to that
+* state's own handlers, so an event can be dispatched along the chain without
+* visiting the std::variant of every composite state again.
+*/
+template <typename EVENT, std::size_t N>
+struct Chain
+{
+	struct Link
+	{
+		void* state;
+		HandleResult (*dispatch)(void* state, const EVENT& e);
+	};
+	
+	void add(void* state, HandleResult (*dispatch)(void*, const EVENT&))
+	{
+		links[size++] = {state, dispatch};
+	}
+	
+	HandleResult dispatch(const EVENT& e) const
+	{
+		for (std::size_t i = 0; i < size; ++i)
+		{
+			const HandleResult result = links[i].dispatch(links[i].state, e);
+			if (result)
+			{
+				return result;
+			}
+		}
+		
+		return kPass;
+	}
+	
+	Link links[N];
+	std::size_t size = 0;
+};
+
+/**
+* @brief Set of event types (indexed by their position in the handler's
+*        event list) stored as 64-bit words
+*/
+template <std::size_t N>
+using EventMask = std::array<std::uint64_t, (N + 63) / 64>;
+
+/**
+* @return The mask of the events in LIST which state T handles or defers
+*/
+template <typename T, typename ... Es>
+constexpr EventMask<sizeof...(Es)> accepted_mask(TypeList<Es...>)
+{
+	EventMask<sizeof...(Es)> mask{};
+	std::size_t i = 0;
+	((mask[i / 64] |= std::uint64_t(accepts_v<T, Es>) << (i % 64), ++i), ...);
+	return mask;
+}
+
+/**
+* @brief Storage for a region of an orthogonal state, which is constructed
+*        when the state is entered and destroyed when it is exited
+*/
+template <typename R>
+union RegionSlot
+{
+	RegionSlot() {}
+	~RegionSlot() {}
+	
+	R state;
+};
+
+/**
+* @brief Seqlock which publishes the active state of a StateMachine to other
+*        threads
+*
+* There is a single writer (the thread dispatching into the machine), which
+* never waits. Readers retry while a write is in progress or if one happened
+* while they were reading, so they never see a torn snapshot.
+*
+* Threads may also sleep until the next store (see pw/hsm/wait.hpp). While
+* any does, the writer calls the wake function they registered after every
+* store; otherwise a store only checks that nobody waits.
+*/
+template <typename CLOCK>
+class ActiveStateSlot
+{
+public:
+	/**
+	* @brief Function which wakes the threads sleeping on the sequence word
+	*/
+	using Wake = void (*)(std::atomic<std::uint32_t>& word);
+	
+public:
+	void store(std::size_t leaf, std::uint64_t transitions, typename CLOCK::time_point since)
+	{
+		const std::uint32_t seq = _seq.load(std::memory_order_relaxed);
+		_seq.store(seq + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		
+		_leaf.store(leaf, std::memory_order_relaxed);
+		_transitions.store(transitions, std::memory_order_relaxed);
+		_since.store(since.time_since_epoch().count(), std::memory_order_relaxed);
+		
+		//Ordered before the load of _waiters, against enter_wait() (Dekker)
+		_seq.store(seq + 2, std::memory_order_seq_cst);
+		
+		if (_waiters.load(std::memory_order_seq_cst) != 0)
+		{
+			_wake.load(std::memory_order_relaxed)(_seq);
+		}
+	}
+	
+	ActiveState<CLOCK> load() const
+	{
+		for (;;)
+		{
+			const std::uint32_t seq = _seq.load(std::memory_order_acquire);
+			if (seq & 1u)
+			{
+				//The writer may have been preempted in the middle of a store
+				std::this_thread::yield();
+				continue;
+			}
+			
+			const ActiveState<CLOCK> state{
+				_leaf.load(std::memory_order_relaxed),
+				_transitions.load(std::memory_order_relaxed),
+				typename CLOCK::time_point(typename CLOCK::duration(_since.load(std::memory_order_relaxed)))
+			};
+			
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (_seq.load(std::memory_order_relaxed) == seq)
+			{
+				return state;
+			}
+		}
+	}
+	
+	/**
+	* @return Number of transitions last stored (only for the writer)
+	*/
+	std::uint64_t transitions() const { return _transitions.load(std::memory_order_relaxed); }
+	
+	/**
+	* @brief Sequence number, which changes on every store and is odd while
+	*        one is in progress (the word waiting threads sleep on)
+	*/
+	std::atomic<std::uint32_t>& sequence() { return _seq; }
+	
+	/**
+	* @brief Have wake called after every store until the matching
+	*        leave_wait()
+	*
+	* A waiter must read the sequence number after this, so that it either
+	* sees a concurrent store or is woken by it.
+	*/
+	void enter_wait(Wake wake)
+	{
+		_wake.store(wake, std::memory_order_relaxed);
+		_waiters.fetch_add(1, std::memory_order_seq_cst);
+	}
+	
+	void leave_wait()
+	{
+		_waiters.fetch_sub(1, std::memory_order_relaxed);
+	}
+	
+private:
+	std::atomic<std::uint32_t> _seq{0};
+	std::atomic<std::uint32_t> _waiters{0};
+	std::atomic<Wake> _wake{nullptr};
+	std::atomic<std::size_t> _leaf{0};
+	std::atomic<std::uint64_t> _transitions{0};
+	std::atomic<typename CLOCK::rep> _since{0};
+};
+
+} //namespace pw::hsm::detail
+
+//==============================================================================
+
+namespace pw::hsm
+{
+
+/**
+* @brief A state with children
+*
+* The first child in the CHILDREN parameter pack is considered the "initial
+* state" for performing the initial transition.
+*/
+template <typename T, typename HANDLER, typename PARENT, typename ... CHILDREN>
+class State : public HANDLER
+{
+	/*
+	* All State classes are made friends of each other so that they may call
+	* the private _doTransition method
+	*/
+	template <typename T_, typename VISITOR_, typename PARENT_, typename ... CHILDREN_>
+	friend
+	class State;
+	
+	template <typename T_, typename ROOT_, typename CONFIG_>
+	friend
+	class StateMachine;
+	
+public:
+	using InitialState = detail::first_of_t<CHILDREN...>;
+	using NoState = std::monostate;
+	using Event = AbstractEvent<HANDLER>;
+	using Handler = HANDLER;
+	using Parent = PARENT;
+	using Children = detail::TypeList<CHILDREN...>;
+	
+	/*
+	* By default a state defers no events. A state may redeclare this alias
+	* (see pw::hsm::Defer) to defer events until the next transition.
+	*/
+	using Deferred = Defer<>;
+	
+	/*
+	* "Import" pw::hsm::HandleResult into State's namespace as a convenience
+	* to the library user. Now, in the state's declaration, instead of having
+	* to type something like
+	*     pw::hsm::HandleResult handle(const MyEvent& e) override;
+	* The user can type
+	*     HandleResult handle(const MyEvent& e) override;
+	*/
+	using HandleResult = ::pw::hsm::HandleResult;
+	
+	/*
+	* Added as a convenience to the user so they can directly return kPass or
+	* kHandled from a state's event handler methods.
+	*/
+	inline static const auto kHandled = ::pw::hsm::kHandled;
+	inline static const auto kPass = ::pw::hsm::kPass;
+	
+public:
+	template <typename ROOT, typename CHILD>
+	static constexpr bool root_has_child()
+	{
+		return ROOT::template has_child<CHILD>();
+	}
+	
+	/**
+	* @retval true if this state has CHILD among any of its immediate or
+	*         extended children (i.e., its children's children)
+	*/
+	template <typename CHILD>
+	static constexpr bool has_child()
+	{
+		//Does this state contain CHILD?
+		if constexpr ((std::is_same_v<CHILD, CHILDREN> || ...))
+		{
+			return true;
+		}
+		else
+		{
+			//Do any of this state's children contain CHILD?
+			return (root_has_child<CHILDREN, CHILD>() || ...);
+		}
+	}
+	
+public:
+	State(Parent& parent) : _parent(parent) {}
+	
+	/**
+	* @return A const reference to this state's parent
+	*/	
+	const auto& parent() const { return _parent; }
+	
+	/**
+	* @return A const reference to the root state
+	*/
+	const auto& root() const { return _parent.root(); }
+	
+	/**
+	* @return A const reference to the StateMachine encompassing this state
+	*/
+	const auto& sm() const { return _parent.sm(); }
+	
+	auto& parent() { return _parent; }
+	auto& root() { return _parent.root(); }
+	auto& sm() { return _parent.sm(); }
+	
+	/**
+	* @brief Perform the initial transition into this state's initial state
+	*/
+	void init()
+	{
+		//Construct instance of initial state in variant
+		_children.template emplace<InitialState>(static_cast<T&>(*this));
+		
+		/*
+		* Since We know that _children holds InitialState (because we just
+		* emplaced it above), we can used std::get directly rather than the
+		* slower and larger std::visit
+		*/
+		std::get<InitialState>(_children).init();
+	}
+	
+	/**
+	* @brief Exit all child states by transitioning to NoState
+	*/
+	void deinit()
+	{
+		/*
+		* Since we don't know which state is currently "active" (i.e., which
+		* alternative is held by the variant), we must use std::visit here
+		*/
+		std::visit([](auto&& arg){
+			using U = std::decay_t<decltype(arg)>;
+			if constexpr (!std::is_same_v<U, NoState>)
+			{
+				arg.deinit();
+			}
+		}, _children);
+		
+		_children.template emplace<NoState>();
+	}
+	
+	/**
+	* @brief Send an event to this state to be handled
+	*
+	* Since this state has children, the event will first be sent to the
+	* active child state. If the child state does not "handle" the event, then
+	* the event will be dispatched to this state.
+	*/
+	HandleResult dispatch(const Event& e)
+	{
+		HandleResult result = kPass;
+		
+		//Dispatch to active child state
+		std::visit([&result, &e](auto&& arg){
+			using U = std::decay_t<decltype(arg)>;
+			if constexpr (!std::is_same_v<U, NoState>)
+			{
+				//Dispatch to child state and execute return result functor
+				result = arg.dispatch(e);
+			}
+		}, _children);
+
+		if (result)
+		{
+			return result;
+		}
+		else
+		{
+			return _dispatchToSelf(e);
+		}
+	}
+	
+	/**
+	* @retval true if this state or one of its active extended children 
+	*         handles or defers events of type E
+	*/
+	template <typename E>
+	bool would_handle() const
+	{
+		if constexpr (detail::accepts_v<T, E>)
+		{
+			return true;
+		}
+		else if constexpr (!detail::subtree_accepts_v<T, E>)
+		{
+			//Nothing below this state cares about E, no need to look
+			return false;
+		}
+		else
+		{
+			return std::visit([](const auto& arg){
+				using U = std::decay_t<decltype(arg)>;
+				if constexpr (std::is_same_v<U, NoState>)
+				{
+					return false;
+				}
+				else
+				{
+					return arg.template would_handle<E>();
+				}
+			}, _children);
+		}
+	}
+	
+	/**
+	* @brief Generate a @ref HandleResult to perform a transition from this
+	*        state to state @ref DEST
+	*/
+	template <typename DEST>
+	HandleResult transition()
+	{
+		if constexpr (has_child<DEST>())
+		{
+			detail::Step::mark_transition();
+			this->template _doTransition<DEST>(); 
+			return ::pw::hsm::kHandled;
+		}
+		else
+		{
+			static_assert(!detail::is_independent_region<T>::value, "An independent region can only transition within itself");
+			return this->_parent.template transition<DEST>(); 
+		}
+	}
+	
+private:
+	template <typename DEST> 
+	void _doTransition()
+	{
+		if constexpr (std::is_same_v<T, DEST>)
+		{
+			this->init();
+		}
+		else
+		{
+			this->deinit();
+			
+			using U = typename detail::nearest_ancestor<T, DEST>::type;
+					
+			//Create my child which is on the path to DEST
+			_children.template emplace<U>(static_cast<T&>(*this));
+			
+			std::get<U>(_children).template _doTransition<DEST>();
+		}
+	}
+	
+	/**
+	* @brief Add the event types handled or deferred by this state and its
+	*        active extended children to mask
+	*/
+	template <typename MASK>
+	void _collectAccepted(MASK& mask) const
+	{
+		constexpr auto own = detail::accepted_mask<T>(detail::handler_events_t<HANDLER>{});
+		for (std::size_t i = 0; i < own.size(); ++i)
+		{
+			mask[i] |= own[i];
+		}
+		
+		std::visit([&mask](const auto& arg){
+			using U = std::decay_t<decltype(arg)>;
+			if constexpr (!std::is_same_v<U, NoState>)
+			{
+				arg._collectAccepted(mask);
+			}
+		}, _children);
+	}
+	
+	/**
+	* @return Index in the state list LIST of the innermost active state of
+	*         this state's subtree
+	*/
+	template <typename LIST>
+	std::size_t _activeLeaf() const
+	{
+		return std::visit([](const auto& arg){
+			using U = std::decay_t<decltype(arg)>;
+			if constexpr (std::is_same_v<U, NoState>)
+			{
+				return detail::index_of_v<T, LIST>;
+			}
+			else
+			{
+				return arg.template _activeLeaf<LIST>();
+			}
+		}, _children);
+	}
+	
+	/**
+	* @brief Append this state's active extended children and then this state
+	*        to chain
+	*
+	* Only states which handle or defer E (any event if E is void) are added.
+	*/
+	template <typename E, typename CHAIN>
+	void _resolveChain(CHAIN& chain)
+	{
+		if constexpr (std::is_void_v<E> || detail::subtree_accepts_v<T, E>)
+		{
+			std::visit([&chain](auto&& arg){
+				using U = std::decay_t<decltype(arg)>;
+				if constexpr (!std::is_same_v<U, NoState>)
+				{
+					arg.template _resolveChain<E>(chain);
+				}
+			}, _children);
+		}
+		
+		if constexpr (detail::chain_accepts<T, E>::value)
+		{
+			chain.add(this, &State::_dispatchToSelf);
+		}
+	}
+	
+	static HandleResult _dispatchToSelf(void* self, const Event& e)
+	{
+		return static_cast<State*>(self)->_dispatchToSelf(e);
+	}
+	
+	/**
+	* @brief Dispatch an event to this state's own handlers, or copy it into 
+	*        the StateMachine's deferred event buffer if T defers its type
+	*
+	* If the machine owns the event and it is Movable, it is offered as an
+	* rvalue to a state which overrides handle(E&&) for some event, and moved
+	* into the buffer.
+	*/
+	HandleResult _dispatchToSelf(const Event& e)
+	{
+		using Deferred = typename T::Deferred;
+		
+		if constexpr (!std::is_same_v<Deferred, Defer<>>)
+		{
+			auto& q = this->sm()._deferred;
+			typename detail::defer_visitor<HANDLER, std::decay_t<decltype(q)>, Deferred>::type v(q);
+			
+			//An event which the machine owns is moved into the buffer
+			Event* const owned = this->sm()._ownedEvent(e);
+			if (owned ? owned->accept_moved(v) : e.accept(v))
+			{
+				return kHandled;
+			}
+		}
+		
+		if constexpr (detail::takes_rvalues_v<T>)
+		{
+			if (Event* const owned = this->sm()._ownedEvent(e))
+			{
+				return owned->accept_moved(*this);
+			}
+		}
+		
+		//Dispatch to self (use visitor pattern)
+		return e.accept(*this);
+	}
+	
+public:
+	Parent& _parent;
+	std::variant<NoState, CHILDREN...> _children;
+};
+
+/**
+* @brief Specialization of State for state with no children (i.e., a leaf state)
+*/
+template <typename T, typename HANDLER, typename PARENT>
+class State<T, HANDLER, PARENT> : public HANDLER
+{
+	template <typename T_, typename VISITOR_, typename PARENT_, typename ... CHILDREN_>
+	friend
+	class State;
+	
+	template <typename T_, typename ROOT_, typename CONFIG_>
+	friend
+	class StateMachine;
+	
+public:
+	using Event = AbstractEvent<HANDLER>;
+	using Handler = HANDLER;
+	using Parent = PARENT;
+	using Children = detail::TypeList<>;
+	using Deferred = Defer<>;
+	using HandleResult = ::pw::hsm::HandleResult;
+	
+	inline static const auto kHandled = ::pw::hsm::kHandled;
+	inline static const auto kPass = ::pw::hsm::kPass;
+	
+public:
+	template <typename CHILD>
+	inline static constexpr bool has_child() { return false; }
+	
+public:
+	State(Parent& parent) : _parent(parent) {}
+		
+	const auto& parent() const { return _parent; }
+	const auto& root() const { return _parent.root(); }
+	const auto& sm() const { return _parent.sm(); }
+	auto& parent() { return _parent; }
+	auto& root() { return _parent.root(); }
+	auto& sm() { return _parent.sm(); }
+	
+	void init() {}
+	void deinit() {}
+	
+	HandleResult dispatch(const Event& e)
+	{
+		return _dispatchToSelf(e);
+	}
+	
+	template <typename E>
+	bool would_handle() const
+	{
+		return detail::accepts_v<T, E>;
+	}
+	
+	template <typename DEST>
+	HandleResult transition()
+	{
+		static_assert(!detail::is_independent_region<T>::value, "An independent region can only transition within itself");
+		return this->_parent.template transition<DEST>();
+	}
+	
+private:
+	template <typename DEST> 
+	void _doTransition()
+	{ 
+		this->init();
+	}	
+	
+	template <typename MASK>
+	void _collectAccepted(MASK& mask) const
+	{
+		constexpr auto own = detail::accepted_mask<T>(detail::handler_events_t<HANDLER>{});
+		for (std::size_t i = 0; i < own.size(); ++i)
+		{
+			mask[i] |= own[i];
+		}
+	}
+	
+	template <typename LIST>
+	std::size_t _activeLeaf() const
+	{
+		return detail::index_of_v<T, LIST>;
+	}
+	
+	template <typename E, typename CHAIN>
+	void _resolveChain(CHAIN& chain)
+	{
+		if constexpr (detail::chain_accepts<T, E>::value)
+		{
+			chain.add(this, &State::_dispatchToSelf);
+		}
+	}
+	
+	static HandleResult _dispatchToSelf(void* self, const Event& e)
+	{
+		return static_cast<State*>(self)->_dispatchToSelf(e);
+	}
+	
+	HandleResult _dispatchToSelf(const Event& e)
+	{
+		using Deferred = typename T::Deferred;
+		
+		if constexpr (!std::is_same_v<Deferred, Defer<>>)
+		{
+			auto& q = this->sm()._deferred;
+			typename detail::defer_visitor<HANDLER, std::decay_t<decltype(q)>, Deferred>::type v(q);
+			
+			//An event which the machine owns is moved into the buffer
+			Event* const owned = this->sm()._ownedEvent(e);
+			if (owned ? owned->accept_moved(v) : e.accept(v))
+			{
+				return kHandled;
+			}
+		}
+		
+		if constexpr (detail::takes_rvalues_v<T>)
+		{
+			if (Event* const owned = this->sm()._ownedEvent(e))
+			{
+				return owned->accept_moved(*this);
+			}
+		}
+		
+		return e.accept(*this);
+	}
+	
+private:
+	Parent& _parent;
+	
+};
+
+/**
+* @brief Specialization of State for a state with orthogonal regions (i.e.,
+*        an AND-state, see @ref Orthogonal)
+*
+* The regions are held in one block, entered in the order they are listed
+* and exited in reverse order. An event is offered to every region in turn
+* (in a statically unrolled loop) and only reaches this state's own handlers
+* if no region handled it. If a region's transition exits or re-enters this
+* state, the event is not offered to the remaining regions.
+*
+* A transition from one region to a state of another region is performed as
+* a transition which re-enters this state: all regions are exited, and the
+* region containing the target enters it while the others enter their
+* initial states.
+*
+* Regions listed in the state's IndependentRegions alias are dispatched in
+* parallel after the others (see @ref Independent).
+*/
+template <typename T, typename HANDLER, typename PARENT, typename ... REGIONS>
+class State<T, HANDLER, PARENT, Orthogonal<REGIONS...>> : public HANDLER
+{
+	template <typename T_, typename VISITOR_, typename PARENT_, typename ... CHILDREN_>
+	friend
+	class State;
+	
+	template <typename T_, typename ROOT_, typename CONFIG_>
+	friend
+	class StateMachine;
+	
+	static_assert(sizeof...(REGIONS) > 0, "An orthogonal state needs at least one region");
+	
+	using Indices = std::index_sequence_for<REGIONS...>;
+	
+	template <std::size_t I>
+	using RegionAt = std::tuple_element_t<I, std::tuple<REGIONS...>>;
+	
+public:
+	using Event = AbstractEvent<HANDLER>;
+	using Handler = HANDLER;
+	using Parent = PARENT;
+	using Children = detail::TypeList<REGIONS...>;
+	using Regions = Children;
+	using Deferred = Defer<>;
+	using HandleResult = ::pw::hsm::HandleResult;
+	
+	/*
+	* By default the regions are dispatched one after the other. A state may
+	* redeclare this alias (see pw::hsm::Independent) to dispatch some of its
+	* regions in parallel.
+	*/
+	using IndependentRegions = ::pw::hsm::Independent<>;
+	
+	inline static const auto kHandled = ::pw::hsm::kHandled;
+	inline static const auto kPass = ::pw::hsm::kPass;
+	
+public:
+	template <typename ROOT, typename CHILD>
+	static constexpr bool root_has_child()
+	{
+		return ROOT::template has_child<CHILD>();
+	}
+	
+	/**
+	* @retval true if CHILD is one of this state's regions or is contained
+	*         in one
+	*/
+	template <typename CHILD>
+	static constexpr bool has_child()
+	{
+		return ((std::is_same_v<CHILD, REGIONS> || root_has_child<REGIONS, CHILD>()) || ...);
+	}
+	
+public:
+	State(Parent& parent) : _parent(parent) {}
+	
+	State(const State&) = delete;
+	State& operator=(const State&) = delete;
+	
+	~State()
+	{
+		deinit();
+	}
+	
+	const auto& parent() const { return _parent; }
+	const auto& root() const { return _parent.root(); }
+	const auto& sm() const { return _parent.sm(); }
+	auto& parent() { return _parent; }
+	auto& root() { return _parent.root(); }
+	auto& sm() { return _parent.sm(); }
+	
+	/**
+	* @return The state of region R (only while this state is active)
+	*/
+	template <typename R>
+	R& region()
+	{
+		return std::get<detail::index_of_v<R, Regions>>(_regions).state;
+	}
+	
+	template <typename R>
+	const R& region() const
+	{
+		return std::get<detail::index_of_v<R, Regions>>(_regions).state;
+	}
+	
+	/**
+	* @brief Enter every region and its initial state
+	*/
+	void init()
+	{
+		deinit();
+		_enter<T>(Indices{});
+	}
+	
+	/**
+	* @brief Exit every region
+	*/
+	void deinit()
+	{
+		if (!_entered)
+		{
+			return;
+		}
+		
+		//Tell a dispatch in progress to stop offering the event to regions
+		if (_exited)
+		{
+			*_exited = true;
+			_exited = nullptr;
+		}
+		
+		_exit(std::make_index_sequence<sizeof...(REGIONS)>{});
+		_entered = false;
+	}
+	
+	/**
+	* @brief Send an event to every region, then to this state if no region
+	*        handled it
+	*/
+	HandleResult dispatch(const Event& e)
+	{
+		HandleResult result = kPass;
+		bool exited = false;
+		_exited = &exited;
+		
+		//Every region is offered the event, so none of them may move from it
+		auto& machine = this->sm();
+		Event* const owned = std::exchange(machine._owned, nullptr);
+		
+		_dispatchRegions(e, result, exited, Indices{});
+		
+		if (exited)
+		{
+			//This state may be gone, touch nothing
+			machine._owned = owned;
+			return result;
+		}
+		
+		_exited = nullptr;
+		
+		if constexpr (detail::size_v<typename T::IndependentRegions> > 0)
+		{
+			_dispatchParallel(e, result, typename T::IndependentRegions{});
+		}
+		
+		machine._owned = owned;
+		
+		if (result)
+		{
+			return result;
+		}
+		
+		return _dispatchToSelf(e);
+	}
+	
+	template <typename E>
+	bool would_handle() const
+	{
+		if constexpr (detail::accepts_v<T, E>)
+		{
+			return true;
+		}
+		else if constexpr (!detail::subtree_accepts_v<T, E>)
+		{
+			return false;
+		}
+		else
+		{
+			return _entered && (region<REGIONS>().template would_handle<E>() || ...);
+		}
+	}
+	
+	template <typename DEST>
+	HandleResult transition()
+	{
+		if constexpr (has_child<DEST>())
+		{
+			detail::Step::mark_transition();
+			this->template _doTransition<DEST>();
+			return ::pw::hsm::kHandled;
+		}
+		else
+		{
+			static_assert(!detail::is_independent_region<T>::value, "An independent region can only transition within itself");
+			return this->_parent.template transition<DEST>();
+		}
+	}
+	
+private:
+	template <typename DEST>
+	void _doTransition()
+	{
+		deinit();
+		_enter<DEST>(Indices{});
+	}
+	
+	/**
+	* @brief Construct the regions in order, each entering DEST if it
+	*        contains it or else its initial state
+	*/
+	template <typename DEST, std::size_t ... Is>
+	void _enter(std::index_sequence<Is...>)
+	{
+		_entered = true;
+		(_enterRegion<DEST, Is>(), ...);
+	}
+	
+	template <typename DEST, std::size_t I>
+	void _enterRegion()
+	{
+		using R = RegionAt<I>;
+		
+		R* r = ::new (static_cast<void*>(&std::get<I>(_regions).state)) R(static_cast<T&>(*this));
+		
+		if constexpr (std::is_same_v<R, DEST> || R::template has_child<DEST>())
+		{
+			r->template _doTransition<DEST>();
+		}
+		else
+		{
+			r->init();
+		}
+	}
+	
+	/**
+	* @brief Exit and destroy the regions in reverse order
+	*/
+	template <std::size_t ... Is>
+	void _exit(std::index_sequence<Is...>)
+	{
+		(_exitRegion<sizeof...(REGIONS) - 1 - Is>(), ...);
+	}
+	
+	template <std::size_t I>
+	void _exitRegion()
+	{
+		using R = RegionAt<I>;
+		
+		R& r = std::get<I>(_regions).state;
+		r.deinit();
+		r.~R();
+	}
+	
+	template <std::size_t ... Is>
+	void _dispatchRegions(const Event& e, HandleResult& result, const bool& exited, std::index_sequence<Is...>)
+	{
+		//Stops early (without touching this state) once a region's transition has exited it
+		((_dispatchRegion<Is>(e, result), !exited) && ...);
+	}
+	
+	template <std::size_t I>
+	void _dispatchRegion(const Event& e, HandleResult& result)
+	{
+		//Independent regions are dispatched afterwards, all at once
+		if constexpr (!detail::contains_v<RegionAt<I>, typename T::IndependentRegions>)
+		{
+			_merge(result, std::get<I>(_regions).state.dispatch(e));
+		}
+	}
+	
+	/**
+	* @brief Dispatch e to the regions Rs on the machine's region pool, and
+	*        wait for all of them
+	*
+	* Each region runs as a step of its own, on whichever thread runs it, and
+	* its transitions are then reported to the step of the calling thread.
+	*/
+	template <typename ... Rs>
+	void _dispatchParallel(const Event& e, HandleResult& result, detail::TypeList<Rs...>)
+	{
+		static_assert((detail::contains_v<Rs, Regions> && ...), "Independent regions must be regions of the state");
+		static_assert((std::is_same_v<detail::deferred_events_t<Rs>, detail::TypeList<>> && ...), 
+			"Independent regions cannot defer events");
+		
+		using Dispatch = HandleResult (*)(State& self, const Event& e);
+		static constexpr Dispatch kDispatch[] = {&State::_dispatchIndependent<Rs>...};
+		
+		HandleResult results[] = {_passFor<Rs>()...};
+		bool transitioned[sizeof...(Rs)] = {};
+		
+		this->sm().region_pool().fork_join(sizeof...(Rs), [this, &e, &results, &transitioned](std::size_t i) {
+			detail::Step step;
+			detail::Step*& current = detail::Step::current();
+			detail::Step* const outer = std::exchange(current, &step);
+			results[i] = kDispatch[i](*this, e);
+			current = outer;
+			transitioned[i] = step.transitioned;
+		});
+		
+		for (std::size_t i = 0; i < sizeof...(Rs); ++i)
+		{
+			if (transitioned[i])
+			{
+				detail::Step::mark_transition();
+			}
+			
+			_merge(result, results[i]);
+		}
+	}
+	
+	template <typename R>
+	static HandleResult _dispatchIndependent(State& self, const Event& e)
+	{
+		return self.template region<R>().dispatch(e);
+	}
+	
+	template <typename R>
+	static constexpr HandleResult _passFor()
+	{
+		return ::pw::hsm::kPass;
+	}
+	
+	/**
+	* @brief Combine the result r of a region into the result of the state
+	*        (handling outweighs passing)
+	*/
+	static void _merge(HandleResult& result, HandleResult r)
+	{
+		result = result || r;
+	}
+	
+	template <typename MASK>
+	void _collectAccepted(MASK& mask) const
+	{
+		constexpr auto own = detail::accepted_mask<T>(detail::handler_events_t<HANDLER>{});
+		for (std::size_t i = 0; i < own.size(); ++i)
+		{
+			mask[i] |= own[i];
+		}
+		
+		if (_entered)
+		{
+			(region<REGIONS>()._collectAccepted(mask), ...);
+		}
+	}
+	
+	/*
+	* Regions are not described, so an orthogonal state counts as a leaf
+	*/
+	template <typename LIST>
+	std::size_t _activeLeaf() const
+	{
+		return detail::index_of_v<T, LIST>;
+	}
+	
+	/**
+	* @brief Append this state to chain
+	*
+	* Since an event is offered to all regions rather than to the first
+	* state which handles it, the chain holds this state's whole dispatch
+	* (regions included) as a single link.
+	*/
+	template <typename E, typename CHAIN>
+	void _resolveChain(CHAIN& chain)
+	{
+		if constexpr (std::is_void_v<E> || detail::subtree_accepts_v<T, E>)
+		{
+			chain.add(this, &State::_dispatchAll);
+		}
+	}
+	
+	static HandleResult _dispatchAll(void* self, const Event& e)
+	{
+		return static_cast<State*>(self)->dispatch(e);
+	}
+	
+	HandleResult _dispatchToSelf(const Event& e)
+	{
+		using Deferred = typename T::Deferred;
+		
+		if constexpr (!std::is_same_v<Deferred, Defer<>>)
+		{
+			auto& q = this->sm()._deferred;
+			typename detail::defer_visitor<HANDLER, std::decay_t<decltype(q)>, Deferred>::type v(q);
+			
+			//An event which the machine owns is moved into the buffer
+			Event* const owned = this->sm()._ownedEvent(e);
+			if (owned ? owned->accept_moved(v) : e.accept(v))
+			{
+				return kHandled;
+			}
+		}
+		
+		if constexpr (detail::takes_rvalues_v<T>)
+		{
+			if (Event* const owned = this->sm()._ownedEvent(e))
+			{
+				return owned->accept_moved(*this);
+			}
+		}
+		
+		return e.accept(*this);
+	}
+	
+private:
+	Parent& _parent;
+	std::tuple<detail::RegionSlot<REGIONS>...> _regions;
+	bool _entered = false;
+	
+	/*
+	* Flag of the dispatch in progress, set when this state is exited or
+	* re-entered
+	*/
+	bool* _exited = nullptr;
+};
+
+/**
+* @brief A state which mounts a reusable state machine as its only child
+*
+* A machine meant for reuse is written with a root state template
+* SUBROOT<OWNER>, where OWNER is whatever holds the root:
+*     template <typename OWNER>
+*     class SRetry : public pw::hsm::State<SRetry<OWNER>, Handler, OWNER, ...>
+* On its own, it runs as a StateMachine<RetryMachine, SRetry<RetryMachine>>.
+* Inside a bigger machine, it is mounted by a state declared as
+*     class SConnecting : public pw::hsm::Submachine<SConnecting, Handler, SRoot, SRetry>
+* Entering the Submachine state enters SUBROOT and its initial state, and
+* exiting it exits the whole submachine.
+*
+* Within the submachine, root() is SUBROOT, as it is when the machine runs on
+* its own, so data kept in the root state works unchanged (except in the
+* constructor of SUBROOT itself). sm() still is the enclosing machine: the
+* submachine's states push into its queue, arm its timers and report to its
+* tracing, so a nested protocol adds no queue hops or allocations. The
+* enclosing machine must therefore provide the services which the
+* submachine's states use through sm().
+*
+* The submachine reports its outcome as it would to an owner of its own,
+* typically by queuing an event which the Submachine state (or one of its
+* ancestors) handles to leave it.
+*
+* @tparam T Typename of the state (CRTP)
+* @tparam HANDLER Typename of the handler/visitor base class (shared with the
+*         submachine)
+* @tparam PARENT Typename of the parent state
+* @tparam SUBROOT Template of the submachine's root state
+*/
+template <typename T, typename HANDLER, typename PARENT, template <typename> class SUBROOT>
+class Submachine : public State<T, HANDLER, PARENT, SUBROOT<T>>
+{
+public:
+	using Subroot = SUBROOT<T>;
+	
+public:
+	Submachine(PARENT& parent) : State<T, HANDLER, PARENT, SUBROOT<T>>(parent) {}
+	
+	/**
+	* @return The submachine's root state
+	*/
+	const Subroot& root() const { return *std::get_if<Subroot>(&this->_children); }
+	Subroot& root() { return *std::get_if<Subroot>(&this->_children); }
+	
+	/**
+	* @return The root state of the enclosing machine
+	*/
+	const auto& outer_root() const { return this->parent().root(); }
+	auto& outer_root() { return this->parent().root(); }
+};
+
+/**
+* @brief Container of a hierarchy of states rooted at ROOT
+*
+* @tparam T Typename of the state machine (CRTP)
+* @tparam ROOT Typename of the root state
+* @tparam CONFIG Compile-time configuration (see @ref DefaultConfig)
+*/
+template <typename T, typename ROOT, typename CONFIG>
+class StateMachine
+{
+	template <typename T_, typename VISITOR_, typename PARENT_, typename ... CHILDREN_>
+	friend
+	class State;
+	
+public:
+	using RootState = ROOT;
+	using Event = typename RootState::Event;
+	using Parent = void;
+	using Config = CONFIG;
+	
+	const auto& root() const { return _root; }
+	const auto& sm() const { return static_cast<const T&>(*this); }
+	auto& root() { return _root; }
+	auto& sm() { return static_cast<T&>(*this); }
+	
+	using ActiveState = ::pw::hsm::ActiveState<typename CONFIG::Clock>;
+	
+	StateMachine() : _root(static_cast<T&>(*this))
+	{
+		//Peform the initial transition into the root state
+		_root.init();
+		_publishHandled();
+		_publishActive(false);
+	}
+	
+	~StateMachine()
+	{
+		//Exit the root state
+		_root.deinit();
+	}
+	
+	void dispatch(const Event& e)
+	{
+		if (_step([this, &e]{ return _root.dispatch(e); }).transitioned)
+		{
+			_onTransition();
+		}
 	}
 	
 	/**
-	* @retval true if this state has CHILD among any of its immediate or
-	*         extended children (i.e., its children's children)
+	* @brief Dispatch an event which the caller gives up (a temporary, or
+	*        std::move(e))
+	*
+	* The machine owns the event until the RTC step ends: if it is Movable,
+	* states which override handle(E&&) are offered it as an rvalue and may
+	* move its payload out, and a state which defers it moves it into the
+	* deferred event buffer (from which it is replayed as an rvalue too).
+	* Orthogonal regions all see the same event, so within them it is offered
+	* as const E& only.
 	*/
-	template <typename CHILD>
-	static constexpr bool has_child()
+	void dispatch(Event&& e)
 	{
-		//Does this state contain CHILD?
-		if constexpr ((std::is_same_v<CHILD, CHILDREN> || ...))
+		if (_step([this, &e]{ return _dispatchOwned(e); }).transitioned)
 		{
-			return true;
+			_onTransition();
 		}
-		else
+	}
+	
+	/**
+	* @brief Dispatch a sequence of events in one call
+	*
+	* The chain of active states is resolved once and reused for every event
+	* until an event causes a transition, after which it is resolved again.
+	* When the elements are events of one concrete type E (e.g., a 
+	* std::vector<E>), only the active states which may handle or defer E are
+	* put in the chain. Elements may also be pointers (raw or smart) to events
+	* of any type, in which case the chain holds the active states which may
+	* handle or defer at least one event type. Either way, the events have the
+	* same effect as if they were dispatched one by one (see
+	* detail::overrides_handle for which states are left out).
+	*
+	* @return How many events were handled, passed or caused a transition
+	*/
+	template <typename IT>
+	BatchResult dispatch_batch(IT first, IT last)
+	{
+		using Element = std::decay_t<decltype(*first)>;
+		using Filter = std::conditional_t<
+			detail::contains_v<Element, Events>, 
+			Element, 
+			void
+		>;
+		
+		BatchResult summary{0, 0, 0};
+		Chain chain;
+		_root.template _resolveChain<Filter>(chain);
+		
+		for (; first != last; ++first)
 		{
-			//Do any of this state's children contain CHILD?
-			return (root_has_child<CHILDREN, CHILD>() || ...);
+			//A transition exits states of the chain, even if it is not returned
+			const Event& e = _asEvent(*first);
+			const StepResult result = _step([&chain, &e]{ return chain.dispatch(e); });
+			
+			if (result.transitioned)
+			{
+				++summary.transitions;
+				_onTransition();
+				
+				chain.size = 0;
+				_root.template _resolveChain<Filter>(chain);
+			}
+			
+			if (result.handled)
+			{
+				++summary.handled;
+			}
+			else
+			{
+				++summary.passed;
+			}
 		}
+		
+		return summary;
 	}
 	
-public:
-	State(Parent& parent) : _parent(parent) {}
+	/**
+	* @brief Dispatch all events of a range (e.g., a container or an array) in
+	*        one call (see above)
+	*/
+	template <typename RANGE>
+	BatchResult dispatch_batch(const RANGE& events)
+	{
+		using std::begin;
+		using std::end;
+		return dispatch_batch(begin(events), end(events));
+	}
 	
 	/**
-	* @return A const reference to this state's parent
-	*/	
-	const auto& parent() const { return _parent; }
+	* @return Statistics of the deferred event buffer
+	*/
+	DeferStats deferred_stats() const { return _deferred.stats(); }
 	
 	/**
-	* @return A const reference to the root state
+	* @retval true if a state in the active configuration handles or defers
+	*         events of type E (i.e., dispatching E would not just be passed
+	*         all the way up to the root)
+	*
+	* Thread-safe only if Config::kPublishHandledEvents is enabled.
 	*/
-	const auto& root() const { return _parent.root(); }
+	template <typename E>
+	bool would_handle() const
+	{
+		if constexpr (Config::kPublishHandledEvents)
+		{
+			constexpr std::size_t i = detail::index_of_v<E, Events>;
+			const auto word = _handled[i / 64].load(std::memory_order_acquire);
+			return (word >> (i % 64)) & 1u;
+		}
+		else
+		{
+			return _root.template would_handle<E>();
+		}
+	}
 	
 	/**
-	* @return A const reference to the StateMachine encompassing this state
+	* @return ID of state S, its index in a depth-first pre-order walk of
+	*         the hierarchy starting with 0 for the root state
 	*/
-	const auto& sm() const { return _parent.sm(); }
+	template <typename S>
+	static constexpr std::size_t state_id() { return detail::index_of_v<S, States>; }
 	
-	auto& parent() { return _parent; }
-	auto& root() { return _parent.root(); }
-	auto& sm() { return _parent.sm(); }
+	/**
+	* @retval true if the state with ID leaf is S or one of S's extended
+	*         children, i.e., if S is active while leaf is
+	*/
+	template <typename S>
+	static constexpr bool is_within(std::size_t leaf)
+	{
+		return leaf >= state_id<S>() && leaf < state_id<S>() + detail::size_v<detail::states_t<S>>;
+	}
 	
 	/**
-	* @brief Perform the initial transition into this state's initial state
+	* @return A consistent snapshot of the published active state
+	*
+	* Thread-safe; requires Config::kPublishActiveState. Never blocks the
+	* thread dispatching into the machine, but may retry while it publishes.
 	*/
-	void init()
+	ActiveState active_state() const
 	{
-		//Construct instance of initial state in variant
-		_children.template emplace<InitialState>(static_cast<T&>(*this));
-		
-		/*
-		* Since We know that _children holds InitialState (because we just
-		* emplaced it above), we can used std::get directly rather than the
-		* slower and larger std::visit
-		*/
-		std::get<InitialState>(_children).init();
+		static_assert(Config::kPublishActiveState, "The active state is only published if Config::kPublishActiveState is enabled");
+		return _active.load();
 	}
 	
 	/**
-	* @brief Exit all child states by transitioning to NoState
+	* @return The seqlock the active state is published in, on which other
+	*         threads may wait for transitions (see pw/hsm/wait.hpp)
 	*/
-	void deinit()
+	auto& active_state_slot()
 	{
-		/*
-		* Since we don't know which state is currently "active" (i.e., which
-		* alternative is held by the variant), we must use std::visit here
-		*/
-		std::visit([](auto&& arg){
-			using U = std::decay_t<decltype(arg)>;
-			if constexpr (!std::is_same_v<U, NoState>)
-			{
-				arg.deinit();
-			}
-		}, _children);
+		static_assert(Config::kPublishActiveState, "The active state is only published if Config::kPublishActiveState is enabled");
+		return _active;
+	}
+	
+private:
+	/**
+	* @brief Outcome of an RTC step
+	*/
+	struct StepResult
+	{
+		HandleResult handled;
+		bool transitioned;
+	};
+	
+	/**
+	* @brief Called once an RTC step has changed the active configuration
+	*/
+	void _onTransition()
+	{
+		if constexpr (DeferQueue::kCapacity > 0)
+		{
+			_replayDeferred();
+		}
 		
-		_children.template emplace<NoState>();
+		_publishHandled();
+		_publishActive(true);
 	}
 	
 	/**
-	* @brief Send an event to this state to be handled
+	* @brief Run f, which dispatches an event to the root state, as an RTC
+	*        step
 	*
-	* Since this state has children, the event will first be sent to the
-	* active child state. If the child state does not "handle" the event, then
-	* the event will be dispatched to this state.
+	* @return The result of f, and whether a state performed a transition
+	*         (whatever its handler returned)
 	*/
-	HandleResult dispatch(const Event& e)
+	template <typename F>
+	StepResult _step(F&& f)
 	{
-		bool handled = false;
+		detail::Step step;
+		detail::Step*& current = detail::Step::current();
+		detail::Step* const outer = std::exchange(current, &step);
 		
-		//Dispatch to active child state
-		std::visit([&handled, &e](auto&& arg){
-			using U = std::decay_t<decltype(arg)>;
-			if constexpr (!std::is_same_v<U, NoState>)
-			{
-				//Dispatch to child state and execute return result functor
-				handled = arg.dispatch(e);
-			}
-		}, _children);
-
-		if (handled)
-		{
-			return kHandled;
-		}
-		else
-		{
-			//Dispatch to self (use visitor pattern)
-			return e.accept(*this);
-		}
+		const HandleResult result = f();
+		current = outer;
+		
+		//A handler which transitions must not pass the event (see HandleResult)
+		assert(result || !step.transitioned);
+		
+		return {result || step.transitioned, step.transitioned};
 	}
 	
 	/**
-	* @brief Generate a @ref HandleResult to perform a transition from this
-	*        state to state @ref DEST
+	* @brief Dispatch event e, which the machine owns for the RTC step
 	*/
-	template <typename DEST>
-	HandleResult transition()
+	HandleResult _dispatchOwned(Event& e)
 	{
-		if constexpr (has_child<DEST>())
+		Event* const outer = std::exchange(_owned, &e);
+		const HandleResult result = _root.dispatch(e);
+		_owned = outer;
+		return result;
+	}
+	
+	/**
+	* @return e as a mutable event if the machine owns it (i.e., it may be
+	*         moved from), otherwise nullptr
+	*/
+	Event* _ownedEvent(const Event& e) const
+	{
+		return &e == _owned ? _owned : nullptr;
+	}
+	
+	/**
+	* @return The event held by an element of a batch (an event or a pointer
+	*         to one)
+	*/
+	template <typename U>
+	static const Event& _asEvent(const U& u)
+	{
+		if constexpr (std::is_base_of_v<Event, U>)
 		{
-			this->template _doTransition<DEST>(); 
-			return true;
+			return u;
 		}
 		else
 		{
-			return this->_parent.template transition<DEST>(); 
+			return *u;
 		}
 	}
 	
-private:
-	template <typename DEST> 
-	void _doTransition()
+	/**
+	* @brief Publish the set of events handled by the active configuration
+	*        (if enabled)
+	*/
+	void _publishHandled()
 	{
-		if constexpr (std::is_same_v<T, DEST>)
-		{
-			this->init();
-		}
-		else
+		if constexpr (Config::kPublishHandledEvents)
 		{
-			this->deinit();
-			
-			using U = typename detail::nearest_ancestor<T, DEST>::type;
-					
-			//Create my child which is on the path to DEST
-			_children.template emplace<U>(static_cast<T&>(*this));
+			Mask mask{};
+			_root._collectAccepted(mask);
 			
-			std::get<U>(_children).template _doTransition<DEST>();
+			for (std::size_t i = 0; i < mask.size(); ++i)
+			{
+				_handled[i].store(mask[i], std::memory_order_release);
+			}
 		}
 	}
 	
-public:
-	Parent& _parent;
-	std::variant<NoState, CHILDREN...> _children;
-};
-
-/**
-* @brief Specialization of State for state with no children (i.e., a leaf state)
-*/
-template <typename T, typename HANDLER, typename PARENT>
-class State<T, HANDLER, PARENT> : public HANDLER
-{
-	template <typename T_, typename VISITOR_, typename PARENT_, typename ... CHILDREN_>
-	friend
-	class State;
-	
-public:
-	using Event = AbstractEvent<HANDLER>;
-	using Parent = PARENT;
-	using HandleResult = ::pw::hsm::HandleResult;
-	
-	inline static const auto kHandled = ::pw::hsm::kHandled;
-	inline static const auto kPass = ::pw::hsm::kPass;
-	
-public:
-	template <typename CHILD>
-	inline static constexpr bool has_child() { return false; }
-	
-public:
-	State(Parent& parent) : _parent(parent) {}
-		
-	const auto& parent() const { return _parent; }
-	const auto& root() const { return _parent.root(); }
-	const auto& sm() const { return _parent.sm(); }
-	auto& parent() { return _parent; }
-	auto& root() { return _parent.root(); }
-	auto& sm() { return _parent.sm(); }
-	
-	void init() {}
-	void deinit() {}
-	
-	HandleResult dispatch(const Event& e)
+	/**
+	* @brief Publish the active leaf state (if enabled)
+	*/
+	void _publishActive(bool transitioned)
 	{
-		//Dispatch to self (use visitor pattern)
-		return e.accept(*this);
+		if constexpr (Config::kPublishActiveState)
+		{
+			_active.store(
+				_root.template _activeLeaf<States>(),
+				_active.transitions() + (transitioned ? 1 : 0),
+				Config::Clock::now()
+			);
+		}
 	}
 	
-	template <typename DEST>
-	HandleResult transition()
+	/**
+	* @brief Re-dispatch deferred events in the order in which they were 
+	*        deferred
+	*
+	* Events which are deferred again are put back in the buffer. If one of
+	* the replayed events causes a transition, the remaining events are given
+	* another chance in the new active configuration.
+	*/
+	void _replayDeferred()
 	{
-		return this->_parent.template transition<DEST>();
+		bool transitioned;
+		
+		do
+		{
+			transitioned = false;
+			
+			for (std::size_t n = _deferred.size(); n > 0; --n)
+			{
+				_deferred.consume_front([this, &transitioned](Event& e){
+					transitioned |= _step([this, &e]{ return _dispatchOwned(e); }).transitioned;
+				});
+			}
+		} while (transitioned && !_deferred.empty());
 	}
 	
 private:
-	template <typename DEST> 
-	void _doTransition()
-	{ 
-		this->init();
-	}	
-	
-private:
-	Parent& _parent;
-	
-};
-
-template <typename T, typename ROOT>
-class StateMachine
-{
-public:
-	using RootState = ROOT;
-	using Event = typename RootState::Event;
-	using Parent = void;
+	using Events = detail::handler_events_t<typename RootState::Handler>;
+	using Mask = detail::EventMask<detail::size_v<Events>>;
+	using PublishedMask = std::conditional_t<
+		Config::kPublishHandledEvents, 
+		std::array<std::atomic<std::uint64_t>, std::tuple_size_v<Mask>>, 
+		detail::TypeList<>
+	>;
 	
-	const auto& root() const { return _root; }
-	const auto& sm() const { return static_cast<const T&>(*this); }
-	auto& root() { return _root; }
-	auto& sm() { return static_cast<T&>(*this); }
+	using Chain = detail::Chain<Event, detail::depth<RootState>::value>;
 	
-	StateMachine() : _root(static_cast<T&>(*this))
-	{
-		//Peform the initial transition into the root state
-		_root.init();
-	}
+	using States = detail::states_t<RootState>;
+	using PublishedActive = std::conditional_t<
+		Config::kPublishActiveState, 
+		detail::ActiveStateSlot<typename Config::Clock>, 
+		detail::TypeList<>
+	>;
 	
-	~StateMachine()
-	{
-		//Exit the root state
-		_root.deinit();
-	}
+	using DeferQueue = detail::DeferQueue<
+		Event, 
+		detail::deferred_events_t<RootState>, 
+		Config::kDeferCapacity
+	>;
 	
-	void dispatch(const Event& e)
-	{
-		_root.dispatch(e);
-	}
-		
-private:
 	RootState _root;
+	DeferQueue _deferred;
+	PublishedMask _handled;
+	PublishedActive _active;
+	Event* _owned = nullptr;
 };
 
 } //namespace pw::hsm
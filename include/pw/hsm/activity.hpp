@@ -0,0 +1,534 @@
+#ifndef INCLUDE_PW_HSM_ACTIVITY_HPP_
+#define INCLUDE_PW_HSM_ACTIVITY_HPP_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+//==============================================================================
+
+namespace pw::hsm
+{
+
+/**
+* @brief Compile-time configuration of an ActivityPool
+*
+* To change a setting, inherit from ActivityConfig, redeclare the setting and
+* pass the new type as the CONFIG argument of ActivityPool.
+*/
+struct ActivityConfig
+{
+	/**
+	* @brief Number of activities which can be queued or running at once
+	*/
+	static constexpr std::size_t kJobs = 64;
+
+	/**
+	* @brief Size in bytes of the storage for the function an activity runs
+	*        (i.e., of its captures)
+	*/
+	static constexpr std::size_t kStorage = 64;
+};
+
+/**
+* @brief Statistics of an ActivityPool
+*/
+struct ActivityStats
+{
+	/**
+	* @brief Number of activities started
+	*/
+	std::size_t started;
+
+	/**
+	* @brief Number of activities whose completion event was pushed
+	*/
+	std::size_t completed;
+
+	/**
+	* @brief Number of activities which completed but whose completion event
+	*        the sink did not take (e.g., because it was full)
+	*/
+	std::size_t dropped;
+
+	/**
+	* @brief Number of activities cancelled before they completed
+	*/
+	std::size_t cancelled;
+
+	/**
+	* @brief Number of activities not started because all jobs were in use
+	*/
+	std::size_t rejected;
+};
+
+} //namespace pw::hsm
+
+//==============================================================================
+
+namespace pw::hsm::detail
+{
+
+/**
+* @brief Progress of an activity, as seen by both the Activity and the worker
+*/
+enum ActivityPhase : std::uint32_t
+{
+	kPending,    //Queued or running
+	kCompleting, //The worker is pushing the completion event
+	kCancelled,  //The Activity let go before completion
+	kDone,       //The completion event has been pushed
+	kDropped     //The sink did not take the completion event
+};
+
+/**
+* @brief Trait which is true if SINK has a try_push(E&&) which never waits
+*        for room (see LockingEventQueue::try_push)
+*/
+template <typename SINK, typename E, typename ENABLE = void>
+struct has_try_push : std::false_type {};
+
+template <typename SINK, typename E>
+struct has_try_push<SINK, E, std::void_t<decltype(std::declval<SINK&>().try_push(std::declval<E>()))>> : std::true_type {};
+
+/**
+* @brief Slot of an ActivityPool holding one queued or running activity
+*
+* A job is shared by the Activity which started it and the worker which runs
+* it, and returns to the pool once both have let go of it.
+*/
+template <std::size_t STORAGE>
+struct ActivityJob
+{
+	/**
+	* @brief Link in the pool's free list or run queue
+	*/
+	ActivityJob* next = nullptr;
+
+	std::atomic<std::uint32_t> phase{kPending};
+	std::atomic<std::uint32_t> refs{0};
+
+	/**
+	* @brief Run the function in storage and push its result into sink (unless
+	*        cancelled meanwhile), then destroy the function
+	*/
+	void (*run)(ActivityJob& job) = nullptr;
+
+	/**
+	* @brief Destroy the function in storage without running it
+	*/
+	void (*discard)(ActivityJob& job) = nullptr;
+
+	void* sink = nullptr;
+
+	alignas(std::max_align_t) unsigned char storage[STORAGE];
+};
+
+} //namespace pw::hsm::detail
+
+//==============================================================================
+
+namespace pw::hsm
+{
+
+/**
+* @brief Passed to the function of an activity, which should check it now
+*        and then and return early once the activity has been cancelled
+*/
+class CancelToken
+{
+	template <typename E_, typename SINK_, typename POOL_>
+	friend class Activity;
+
+public:
+	/**
+	* @return Whether the state which started the activity has been exited
+	*/
+	bool cancelled() const
+	{
+		return _phase.load(std::memory_order_relaxed) == detail::kCancelled;
+	}
+
+private:
+	explicit CancelToken(const std::atomic<std::uint32_t>& phase) : _phase(phase) {}
+
+private:
+	const std::atomic<std::uint32_t>& _phase;
+};
+
+/**
+* @brief Fixed pool of worker threads which runs the do-activities of states
+*
+* The pool is shared by any number of state machines. Jobs are preallocated,
+* so starting an activity only takes a job from a free list and queues it;
+* when all jobs are in use, the activity is not started.
+*
+* The pool must outlive the activities started on it.
+*
+* @tparam CONFIG Compile-time configuration (see @ref ActivityConfig)
+*/
+template <typename CONFIG = ActivityConfig>
+class ActivityPool
+{
+	template <typename E_, typename SINK_, typename POOL_>
+	friend class Activity;
+
+public:
+	using Job = detail::ActivityJob<CONFIG::kStorage>;
+	static constexpr std::size_t kStorage = CONFIG::kStorage;
+
+public:
+	/**
+	* @brief Start the worker threads
+	*/
+	explicit ActivityPool(std::size_t workers = std::thread::hardware_concurrency()) :
+		_size(workers > 0 ? workers : 1),
+		_threads(new std::thread[_size])
+	{
+		for (std::size_t i = 0; i < CONFIG::kJobs; ++i)
+		{
+			_jobs[i].next = _free;
+			_free = &_jobs[i];
+		}
+
+		for (std::size_t i = 0; i < _size; ++i)
+		{
+			_threads[i] = std::thread([this]() { _work(); });
+		}
+	}
+
+	ActivityPool(const ActivityPool&) = delete;
+	ActivityPool& operator=(const ActivityPool&) = delete;
+
+	/**
+	* @brief Let the running activities finish, then stop and join the
+	*        workers
+	*
+	* Activities still queued are discarded without running.
+	*/
+	~ActivityPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_guard);
+			_stop = true;
+		}
+		_wake.notify_all();
+
+		for (std::size_t i = 0; i < _size; ++i)
+		{
+			_threads[i].join();
+		}
+
+		while (Job* job = _head)
+		{
+			_head = job->next;
+			job->discard(*job);
+		}
+	}
+
+	/**
+	* @return Number of worker threads
+	*/
+	std::size_t size() const { return _size; }
+
+	ActivityStats stats() const
+	{
+		return ActivityStats{
+			_started.load(std::memory_order_relaxed),
+			_completed.load(std::memory_order_relaxed),
+			_dropped.load(std::memory_order_relaxed),
+			_cancelled.load(std::memory_order_relaxed),
+			_rejected.load(std::memory_order_relaxed)
+		};
+	}
+
+private:
+	/**
+	* @return A job owned by the caller and the worker, or nullptr if all
+	*         jobs are in use
+	*/
+	Job* _acquire()
+	{
+		std::lock_guard<std::mutex> lock(_guard);
+
+		Job* job = _free;
+		if (!job)
+		{
+			_rejected.fetch_add(1, std::memory_order_relaxed);
+			return nullptr;
+		}
+
+		_free = job->next;
+		job->next = nullptr;
+		job->phase.store(detail::kPending, std::memory_order_relaxed);
+		job->refs.store(2, std::memory_order_relaxed);
+		return job;
+	}
+
+	void _submit(Job& job)
+	{
+		_started.fetch_add(1, std::memory_order_relaxed);
+		{
+			std::lock_guard<std::mutex> lock(_guard);
+			if (_tail)
+			{
+				_tail->next = &job;
+			}
+			else
+			{
+				_head = &job;
+			}
+			_tail = &job;
+		}
+		_wake.notify_one();
+	}
+
+	/**
+	* @brief Let go of job (by its Activity or its worker)
+	*/
+	void _release(Job& job)
+	{
+		if (job.refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			std::lock_guard<std::mutex> lock(_guard);
+			job.next = _free;
+			_free = &job;
+		}
+	}
+
+	void _work()
+	{
+		for (;;)
+		{
+			Job* job;
+			{
+				std::unique_lock<std::mutex> lock(_guard);
+				_wake.wait(lock, [this]() { return _stop || _head; });
+
+				if (_stop)
+				{
+					return;
+				}
+
+				job = _head;
+				_head = job->next;
+				if (!_head)
+				{
+					_tail = nullptr;
+				}
+			}
+
+			if (job->phase.load(std::memory_order_acquire) == detail::kCancelled)
+			{
+				job->discard(*job);
+			}
+			else
+			{
+				job->run(*job);
+			}
+
+			const std::uint32_t phase = job->phase.load(std::memory_order_relaxed);
+			if (phase == detail::kDone)
+			{
+				_completed.fetch_add(1, std::memory_order_relaxed);
+			}
+			else if (phase == detail::kDropped)
+			{
+				_dropped.fetch_add(1, std::memory_order_relaxed);
+			}
+			else
+			{
+				_cancelled.fetch_add(1, std::memory_order_relaxed);
+			}
+
+			_release(*job);
+		}
+	}
+
+private:
+	const std::size_t _size;
+	std::unique_ptr<std::thread[]> _threads;
+	Job _jobs[CONFIG::kJobs];
+
+	std::mutex _guard;
+	std::condition_variable _wake;
+	Job* _free = nullptr;
+	Job* _head = nullptr;
+	Job* _tail = nullptr;
+	bool _stop = false;
+
+	std::atomic<std::size_t> _started{0};
+	std::atomic<std::size_t> _completed{0};
+	std::atomic<std::size_t> _dropped{0};
+	std::atomic<std::size_t> _cancelled{0};
+	std::atomic<std::size_t> _rejected{0};
+};
+
+/**
+* @brief A UML do-activity: work which a state runs on an ActivityPool while
+*        it is active, and whose result is posted into SINK as event E
+*
+* A state which owns an Activity as a member starts the work in its
+* constructor, so that the entry action itself stays short. The work is a
+* function taking a @ref CancelToken and returning E. When the state is
+* exited, the Activity's destructor cancels the work: the function should
+* check the token now and then and return early, and its result is then
+* discarded. Cancelling never waits for the function, so it does not stretch
+* the run-to-completion step of the exit; the function keeps running on its
+* worker until it notices the cancellation and must therefore capture what it
+* needs by value, not refer to the state.
+*
+* The completion event is pushed into SINK from the worker thread, so SINK
+* must accept push(E&&) from any thread (e.g., a @ref LockingEventQueue).
+* Exiting the state waits for a push in progress, on the thread which would
+* pop from SINK, so the push must not wait for room: a SINK with a try_push
+* (such as LockingEventQueue, even under Overflow::kBlock) is pushed into
+* with it, and any other SINK must not block. An event which SINK does not
+* take is counted in ActivityStats::dropped. An event pushed just before the
+* state was exited is still dispatched, to whichever state is then active.
+*
+* @tparam E Typename of the event posted on completion
+* @tparam SINK Typename of the queue the event is pushed into
+* @tparam POOL Typename of the pool which runs the work
+*/
+template <typename E, typename SINK, typename POOL = ActivityPool<>>
+class Activity
+{
+	using Job = typename POOL::Job;
+
+public:
+	Activity(POOL& pool, SINK& sink) :
+		_pool(pool),
+		_sink(sink)
+	{
+
+	}
+
+	Activity(const Activity&) = delete;
+	Activity& operator=(const Activity&) = delete;
+
+	~Activity()
+	{
+		cancel();
+	}
+
+	/**
+	* @brief Run f(token) on the pool and push the E it returns into the sink
+	*
+	* An activity which is already running is cancelled first.
+	*
+	* @retval false if all of the pool's jobs were in use
+	*/
+	template <typename F>
+	bool start(F&& f)
+	{
+		using Fn = std::decay_t<F>;
+		static_assert(sizeof(Fn) <= POOL::kStorage && alignof(Fn) <= alignof(std::max_align_t),
+			"The captures of the activity's function do not fit the pool's job storage");
+		static_assert(std::is_invocable_r_v<E, Fn&, const CancelToken&>,
+			"The activity's function must take a const CancelToken& and return the completion event");
+
+		cancel();
+
+		Job* job = _pool._acquire();
+		if (!job)
+		{
+			return false;
+		}
+
+		::new (job->storage) Fn(std::forward<F>(f));
+		job->run = &Activity::_run<Fn>;
+		job->discard = &Activity::_discard<Fn>;
+		job->sink = &_sink;
+
+		_job = job;
+		_pool._submit(*job);
+		return true;
+	}
+
+	/**
+	* @brief Cancel the activity (does nothing if none is running)
+	*
+	* Once this returns, the activity's event is not pushed into the sink
+	* unless it already has been.
+	*/
+	void cancel()
+	{
+		if (!_job)
+		{
+			return;
+		}
+
+		std::uint32_t phase = detail::kPending;
+		if (!_job->phase.compare_exchange_strong(phase, detail::kCancelled, std::memory_order_acq_rel))
+		{
+			//Wait for a push in progress, which never blocks, so that the sink may go away
+			while (phase == detail::kCompleting)
+			{
+				std::this_thread::yield();
+				phase = _job->phase.load(std::memory_order_acquire);
+			}
+		}
+
+		_pool._release(*_job);
+		_job = nullptr;
+	}
+
+	/**
+	* @return Whether an activity was started and has neither completed nor
+	*         been cancelled
+	*/
+	bool running() const
+	{
+		return _job && _job->phase.load(std::memory_order_acquire) == detail::kPending;
+	}
+
+private:
+	template <typename Fn>
+	static void _run(Job& job)
+	{
+		Fn& f = *std::launder(reinterpret_cast<Fn*>(job.storage));
+		E event = f(CancelToken(job.phase));
+		f.~Fn();
+
+		std::uint32_t phase = detail::kPending;
+		if (job.phase.compare_exchange_strong(phase, detail::kCompleting, std::memory_order_acq_rel))
+		{
+			SINK& sink = *static_cast<SINK*>(job.sink);
+			bool pushed;
+
+			if constexpr (detail::has_try_push<SINK, E>::value)
+			{
+				pushed = sink.try_push(std::move(event));
+			}
+			else
+			{
+				pushed = sink.push(std::move(event));
+			}
+
+			job.phase.store(pushed ? detail::kDone : detail::kDropped, std::memory_order_release);
+		}
+	}
+
+	template <typename Fn>
+	static void _discard(Job& job)
+	{
+		std::launder(reinterpret_cast<Fn*>(job.storage))->~Fn();
+	}
+
+private:
+	POOL& _pool;
+	SINK& _sink;
+	Job* _job = nullptr;
+};
+
+} //namespace pw::hsm
+
+#endif //INCLUDE_PW_HSM_ACTIVITY_HPP_
@@ -0,0 +1,339 @@
+#ifndef INCLUDE_PW_HSM_BUS_HPP_
+#define INCLUDE_PW_HSM_BUS_HPP_
+
+#include <pw/hsm.hpp>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <tuple>
+
+//==============================================================================
+
+namespace pw::hsm
+{
+
+/**
+* @brief Compile-time configuration of an EventBus
+*
+* To change a setting, inherit from BusConfig, redeclare the setting and pass
+* the new type as the CONFIG argument of EventBus.
+*/
+struct BusConfig
+{
+	/**
+	* @brief Number of machines which can subscribe to each event type
+	*/
+	static constexpr std::size_t kSubscribers = 8;
+
+	/**
+	* @brief Whether publish() keeps the statistics returned by stats()
+	*
+	* This costs a few atomic increments per publish() on counters shared by
+	* all publishing threads.
+	*/
+	static constexpr bool kStats = false;
+};
+
+/**
+* @brief Statistics of an EventBus (kept only if BusConfig::kStats is set)
+*/
+struct BusStats
+{
+	/**
+	* @brief Number of publish() calls
+	*/
+	std::size_t published;
+
+	/**
+	* @brief Number of deliveries made by dispatching straight into the
+	*        subscriber on the publishing thread
+	*/
+	std::size_t direct;
+
+	/**
+	* @brief Number of deliveries made by pushing into the subscriber's mailbox
+	*/
+	std::size_t queued;
+
+	/**
+	* @brief Number of deliveries which the subscriber's mailbox rejected
+	*/
+	std::size_t dropped;
+};
+
+} //namespace pw::hsm
+
+//==============================================================================
+
+namespace pw::hsm::detail
+{
+
+/**
+* @brief Subscription of one machine to events of type E
+*/
+template <typename E>
+struct BusSubscriber
+{
+	void* sm;
+	void* mailbox;
+	void (*call)(void* sm, const E& e);
+	bool (*post)(void* mailbox, const E& e);
+
+	/**
+	* @brief Thread on which the machine may be dispatched into directly
+	*/
+	std::thread::id owner;
+};
+
+/**
+* @brief A direct call of a bus into a machine, linked to the calls in
+*        progress on the same thread (by any bus, for any event type)
+*/
+struct BusCall
+{
+	/**
+	* @return The innermost call in progress on the calling thread
+	*/
+	static BusCall*& current()
+	{
+		static thread_local BusCall* call = nullptr;
+		return call;
+	}
+
+	/**
+	* @return Whether a bus is dispatching into sm on the calling thread
+	*/
+	static bool active(const void* sm)
+	{
+		for (const BusCall* call = current(); call; call = call->outer)
+		{
+			if (call->sm == sm)
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	const void* sm;
+	BusCall* outer;
+};
+
+/**
+* @brief Subscribers to events of type E
+*/
+template <typename E, std::size_t N>
+struct BusTopic
+{
+	std::array<BusSubscriber<E>, N> subscribers;
+	std::size_t size = 0;
+};
+
+template <typename LIST, template <typename> class TOPIC>
+struct bus_topics;
+
+template <typename ... Es, template <typename> class TOPIC>
+struct bus_topics<TypeList<Es...>, TOPIC>
+{
+	using type = std::tuple<TOPIC<Es>...>;
+};
+
+} //namespace pw::hsm::detail
+
+//==============================================================================
+
+namespace pw::hsm
+{
+
+/**
+* @brief Local publish/subscribe bus which delivers each event to the
+*        machines subscribed to its type
+*
+* Every event type of HANDLER has its own fixed array of subscribers, so
+* publishing an event only visits the machines which asked for it, with no
+* lookup and no allocation. A subscriber is a machine together with its
+* mailbox, i.e., any queue with push(const E&) such as @ref EventQueue or
+* @ref LockingEventQueue, which copies the event in place.
+*
+* When the event is published on the subscriber's owner thread (by default,
+* the thread which subscribed it), the bus dispatches it into the machine
+* directly instead of queuing it. A machine which a bus is already
+* dispatching into on that thread (for any event type) gets the event through
+* its mailbox instead, so that a chain of publications, even across event
+* types and buses, cannot re-enter it. The bus cannot see dispatches made by
+* anything else, though: a machine which publishes events of a type it
+* subscribes to from its own handlers must be subscribed with
+* std::thread::id() as its owner, which routes every delivery through its
+* mailbox.
+*
+* Subscriptions are set up before events are published, and must not change
+* while a publish() is in progress on any thread. publish() may be called
+* from any number of threads at once.
+*
+* @tparam HANDLER Typename of the handler/visitor base class
+* @tparam CONFIG Compile-time configuration (see @ref BusConfig)
+*/
+template <typename HANDLER, typename CONFIG = BusConfig>
+class EventBus
+{
+	using Events = detail::handler_events_t<HANDLER>;
+
+	template <typename E>
+	using Topic = detail::BusTopic<E, CONFIG::kSubscribers>;
+
+public:
+	EventBus() = default;
+
+	EventBus(const EventBus&) = delete;
+	EventBus& operator=(const EventBus&) = delete;
+
+	/**
+	* @brief Deliver the events of type E published from now on to sm
+	*
+	* @param owner Thread on which published events are dispatched into sm
+	*        directly, or std::thread::id() to always push them into mailbox
+	*
+	* @retval false if sm already subscribes to E or E has kSubscribers
+	*         subscribers
+	*/
+	template <typename E, typename SM, typename MAILBOX>
+	bool subscribe(SM& sm, MAILBOX& mailbox, std::thread::id owner = std::this_thread::get_id())
+	{
+		static_assert(detail::contains_v<E, Events>, "E is not an event of the bus's handler");
+
+		Topic<E>& topic = std::get<Topic<E>>(_topics);
+
+		if (topic.size == CONFIG::kSubscribers || _find(topic, &sm) < topic.size)
+		{
+			return false;
+		}
+
+		topic.subscribers[topic.size++] = detail::BusSubscriber<E>{
+			&sm,
+			&mailbox,
+			[](void* sm, const E& e) { static_cast<SM*>(sm)->dispatch(e); },
+			[](void* mailbox, const E& e) -> bool { return static_cast<MAILBOX*>(mailbox)->push(e); },
+			owner
+		};
+
+		return true;
+	}
+
+	/**
+	* @brief Stop delivering events of type E to sm
+	*
+	* @retval false if sm did not subscribe to E
+	*/
+	template <typename E, typename SM>
+	bool unsubscribe(const SM& sm)
+	{
+		Topic<E>& topic = std::get<Topic<E>>(_topics);
+
+		const std::size_t i = _find(topic, &sm);
+		if (i == topic.size)
+		{
+			return false;
+		}
+
+		//Keep the order of delivery of the remaining subscribers
+		for (std::size_t j = i + 1; j < topic.size; ++j)
+		{
+			topic.subscribers[j - 1] = topic.subscribers[j];
+		}
+		--topic.size;
+
+		return true;
+	}
+
+	/**
+	* @return Number of machines subscribed to E
+	*/
+	template <typename E>
+	std::size_t subscribers() const
+	{
+		return std::get<Topic<E>>(_topics).size;
+	}
+
+	/**
+	* @brief Deliver e to the subscribers of E, in the order in which they
+	*        subscribed
+	*
+	* @return Number of subscribers which were dispatched e or accepted it into
+	*         their mailbox
+	*/
+	template <typename E>
+	std::size_t publish(const E& e)
+	{
+		static_assert(detail::contains_v<E, Events>, "E is not an event of the bus's handler");
+
+		Topic<E>& topic = std::get<Topic<E>>(_topics);
+		const std::thread::id self = std::this_thread::get_id();
+
+		std::size_t direct = 0;
+		std::size_t queued = 0;
+
+		for (std::size_t i = 0; i < topic.size; ++i)
+		{
+			const detail::BusSubscriber<E>& s = topic.subscribers[i];
+
+			if (s.owner == self && !detail::BusCall::active(s.sm))
+			{
+				detail::BusCall call{s.sm, detail::BusCall::current()};
+				detail::BusCall::current() = &call;
+				s.call(s.sm, e);
+				detail::BusCall::current() = call.outer;
+				++direct;
+			}
+			else if (s.post(s.mailbox, e))
+			{
+				++queued;
+			}
+		}
+
+		if constexpr (CONFIG::kStats)
+		{
+			_published.fetch_add(1, std::memory_order_relaxed);
+			_direct.fetch_add(direct, std::memory_order_relaxed);
+			_queued.fetch_add(queued, std::memory_order_relaxed);
+			_dropped.fetch_add(topic.size - direct - queued, std::memory_order_relaxed);
+		}
+
+		return direct + queued;
+	}
+
+	BusStats stats() const
+	{
+		return BusStats{
+			_published.load(std::memory_order_relaxed),
+			_direct.load(std::memory_order_relaxed),
+			_queued.load(std::memory_order_relaxed),
+			_dropped.load(std::memory_order_relaxed)
+		};
+	}
+
+private:
+	template <typename E>
+	static std::size_t _find(const Topic<E>& topic, const void* sm)
+	{
+		std::size_t i = 0;
+		while (i < topic.size && topic.subscribers[i].sm != sm)
+		{
+			++i;
+		}
+		return i;
+	}
+
+private:
+	typename detail::bus_topics<Events, Topic>::type _topics;
+
+	std::atomic<std::size_t> _published{0};
+	std::atomic<std::size_t> _direct{0};
+	std::atomic<std::size_t> _queued{0};
+	std::atomic<std::size_t> _dropped{0};
+};
+
+} //namespace pw::hsm
+
+#endif //INCLUDE_PW_HSM_BUS_HPP_
@@ -0,0 +1,558 @@
+#ifndef INCLUDE_PW_HSM_BUSY_POLL_HPP_
+#define INCLUDE_PW_HSM_BUSY_POLL_HPP_
+
+#include <pw/hsm.hpp>
+#include <pw/hsm/futex.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+//==============================================================================
+
+namespace pw::hsm
+{
+
+/**
+* @brief How a BusyPollRunner waits for events when its queue is empty
+*/
+enum class PollMode
+{
+	/**
+	* @brief Spin forever with a pause instruction between polls (lowest
+	*        latency; keeps a CPU busy at all times)
+	*/
+	kSpin,
+
+	/**
+	* @brief Spin for kSpins polls, then yield the CPU between polls
+	*/
+	kSpinYield,
+
+	/**
+	* @brief Spin for kSpins polls, yield for kYields polls, then sleep on a
+	*        futex until an event is posted
+	*/
+	kSpinPark
+};
+
+/**
+* @brief Compile-time configuration of a BusyPollRunner
+*
+* To change a setting, inherit from PollConfig, redeclare the setting and
+* pass the new type as the CONFIG argument of BusyPollRunner.
+*/
+struct PollConfig
+{
+	static constexpr PollMode kMode = PollMode::kSpinPark;
+
+	/**
+	* @brief Number of events the queue can hold (must be a power of 2)
+	*/
+	static constexpr std::size_t kCapacity = 1024;
+
+	/**
+	* @brief Number of polls with a pause instruction in between before the
+	*        runner starts yielding (kSpinYield, kSpinPark)
+	*/
+	static constexpr std::size_t kSpins = 1024;
+
+	/**
+	* @brief Number of polls with a yield in between before the runner parks
+	*        (kSpinPark)
+	*/
+	static constexpr std::size_t kYields = 16;
+
+	/**
+	* @brief Clock used to measure wakeup latencies
+	*/
+	using Clock = std::chrono::steady_clock;
+};
+
+/**
+* @brief Distribution of latencies over power-of-2 buckets
+*
+* Bucket i counts the latencies from 2^i up to 2^(i+1) nanoseconds (bucket 0
+* also counts 0); the last bucket counts everything longer.
+*/
+struct LatencyHistogram
+{
+	static constexpr std::size_t kBuckets = 32;
+
+	std::size_t counts[kBuckets];
+
+	/**
+	* @return Index of the bucket which counts latency d
+	*/
+	static std::size_t bucket(std::chrono::nanoseconds d)
+	{
+		const auto ns = d.count() > 0 ? static_cast<std::uint64_t>(d.count()) : 1;
+		const auto clamped = static_cast<std::uint32_t>(std::min<std::uint64_t>(ns, std::numeric_limits<std::uint32_t>::max()));
+		return std::min<std::size_t>(detail::highest_bit(clamped | 1), kBuckets - 1);
+	}
+
+	/**
+	* @return Upper bound of bucket i
+	*/
+	static std::chrono::nanoseconds upper(std::size_t i)
+	{
+		return std::chrono::nanoseconds(std::int64_t(2) << i);
+	}
+
+	void record(std::chrono::nanoseconds d)
+	{
+		++counts[bucket(d)];
+	}
+
+	/**
+	* @return Number of latencies recorded
+	*/
+	std::size_t count() const
+	{
+		std::size_t n = 0;
+		for (std::size_t c : counts)
+		{
+			n += c;
+		}
+		return n;
+	}
+
+	/**
+	* @return Upper bound of the bucket which holds the q-quantile (e.g., 0.99
+	*         for the 99th percentile), or zero if nothing was recorded
+	*/
+	std::chrono::nanoseconds percentile(double q) const
+	{
+		const std::size_t n = count();
+		if (n == 0)
+		{
+			return std::chrono::nanoseconds(0);
+		}
+
+		const auto rank = static_cast<std::size_t>(q * double(n - 1));
+		std::size_t seen = 0;
+
+		for (std::size_t i = 0; i < kBuckets; ++i)
+		{
+			seen += counts[i];
+			if (seen > rank)
+			{
+				return upper(i);
+			}
+		}
+
+		return upper(kBuckets - 1);
+	}
+};
+
+/**
+* @brief Statistics of a BusyPollRunner
+*/
+struct PollStats
+{
+	/**
+	* @brief Number of events dispatched
+	*/
+	std::size_t events;
+
+	/**
+	* @brief Number of events dropped because the queue was full
+	*/
+	std::size_t dropped;
+
+	/**
+	* @brief Number of times the runner yielded the CPU
+	*/
+	std::size_t yields;
+
+	/**
+	* @brief Number of times the runner slept on its futex
+	*/
+	std::size_t parks;
+
+	/**
+	* @brief Time from post() until dispatch of the events which found the
+	*        runner waiting
+	*/
+	LatencyHistogram wakeup;
+};
+
+} //namespace pw::hsm
+
+//==============================================================================
+
+namespace pw::hsm::detail
+{
+
+/**
+* @brief Bounded lock-free multi-producer/single-consumer queue of events,
+*        each stamped with the time it was posted
+*
+* Every slot carries a sequence number which tells producers and the consumer
+* whether it is free or full, so neither side ever waits for the other.
+* Events are stored in place and dispatched straight out of the queue.
+*/
+template <typename HANDLER, std::size_t CAPACITY, typename TIMEPOINT>
+class MpscRing
+{
+	static_assert(CAPACITY > 0 && (CAPACITY & (CAPACITY - 1)) == 0, "CAPACITY must be a power of 2");
+
+	using Event = AbstractEvent<HANDLER>;
+	using Events = handler_events_t<HANDLER>;
+
+	struct Slot
+	{
+		std::atomic<std::size_t> sequence;
+		alignas(storage_for<Events>::align)
+		unsigned char storage[storage_for<Events>::size];
+		Event* event;
+		void (*destroy)(void* p);
+		TIMEPOINT posted;
+	};
+
+public:
+	MpscRing()
+	{
+		for (std::size_t i = 0; i < CAPACITY; ++i)
+		{
+			_slots[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	MpscRing(const MpscRing&) = delete;
+	MpscRing& operator=(const MpscRing&) = delete;
+
+	~MpscRing()
+	{
+		while (consume([](const Event&, TIMEPOINT) {}))
+		{
+
+		}
+	}
+
+	/**
+	* @brief Copy event e (or move it, if it is an rvalue) into the ring (from
+	*        any thread)
+	*
+	* @retval false if the ring was full (an rvalue is not moved from)
+	*/
+	template <typename EV>
+	bool push(EV&& e, TIMEPOINT posted)
+	{
+		using E = std::decay_t<EV>;
+
+		std::size_t tail = _tail.load(std::memory_order_relaxed);
+		Slot* slot;
+
+		for (;;)
+		{
+			slot = &_slots[tail & (CAPACITY - 1)];
+			const std::size_t sequence = slot->sequence.load(std::memory_order_acquire);
+			const auto diff = static_cast<std::ptrdiff_t>(sequence - tail);
+
+			if (diff == 0)
+			{
+				if (_tail.compare_exchange_weak(tail, tail + 1, std::memory_order_relaxed))
+				{
+					break;
+				}
+			}
+			else if (diff < 0)
+			{
+				return false;
+			}
+			else
+			{
+				tail = _tail.load(std::memory_order_relaxed);
+			}
+		}
+
+		slot->event = ::new (slot->storage) E(std::forward<EV>(e));
+		slot->destroy = &_destroy<E>;
+		slot->posted = posted;
+		slot->sequence.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	/**
+	* @brief Pass the oldest event and the time it was posted to f (consumer
+	*        only), which may move from the event
+	*
+	* @retval false if the ring was empty
+	*/
+	template <typename F>
+	bool consume(F&& f)
+	{
+		Slot& slot = _slots[_head & (CAPACITY - 1)];
+
+		if (slot.sequence.load(std::memory_order_acquire) != _head + 1)
+		{
+			return false;
+		}
+
+		f(*slot.event, slot.posted);
+		slot.destroy(slot.storage);
+		slot.sequence.store(_head + CAPACITY, std::memory_order_release);
+		++_head;
+		return true;
+	}
+
+	/**
+	* @return Whether the ring is empty (consumer only)
+	*/
+	bool empty() const
+	{
+		return _slots[_head & (CAPACITY - 1)].sequence.load(std::memory_order_acquire) != _head + 1;
+	}
+
+private:
+	template <typename E>
+	static void _destroy(void* p)
+	{
+		static_cast<E*>(p)->~E();
+	}
+
+private:
+	//Consumer side
+	alignas(64) std::size_t _head = 0;
+
+	//Producer side
+	alignas(64) std::atomic<std::size_t> _tail{0};
+
+	alignas(64) Slot _slots[CAPACITY];
+};
+
+} //namespace pw::hsm::detail
+
+//==============================================================================
+
+namespace pw::hsm
+{
+
+/**
+* @brief Runs a StateMachine on a dedicated thread which polls a lock-free
+*        queue, trading CPU time for wakeup latency
+*
+* Events are posted into the queue from any thread without taking a lock.
+* While the queue is empty the runner waits as chosen by CONFIG::kMode: it
+* spins (kSpin), spins and then yields (kSpinYield), or spins, yields and
+* then sleeps on a futex (kSpinPark). Only in the last mode does post() have
+* to check whether the runner is asleep, and only a post which finds it
+* asleep makes a system call.
+*
+* The runner records the latency from post() to dispatch of every event
+* which found it waiting, so the modes and budgets can be compared for each
+* machine (see @ref PollStats).
+*
+* @tparam SM Typename of the state machine
+* @tparam CONFIG Compile-time configuration (see @ref PollConfig)
+*/
+template <typename SM, typename CONFIG = PollConfig>
+class BusyPollRunner
+{
+	using Handler = typename SM::RootState::Handler;
+	using Event = AbstractEvent<Handler>;
+	using Clock = typename CONFIG::Clock;
+	using TimePoint = typename Clock::time_point;
+	using Ring = detail::MpscRing<Handler, CONFIG::kCapacity, TimePoint>;
+
+public:
+	/**
+	* @brief Construct the state machine with args and start the runner's
+	*        thread
+	*/
+	template <typename ... ARGS>
+	explicit BusyPollRunner(ARGS&& ... args) :
+		_sm(std::forward<ARGS>(args)...)
+	{
+		_thread = std::thread([this]() { _run(); });
+	}
+
+	BusyPollRunner(const BusyPollRunner&) = delete;
+	BusyPollRunner& operator=(const BusyPollRunner&) = delete;
+
+	/**
+	* @brief Stop the runner's thread
+	*
+	* Events which have not been dispatched yet are discarded.
+	*/
+	~BusyPollRunner()
+	{
+		_stop.store(true, std::memory_order_relaxed);
+
+		//Pairs with the fence in _park() so that either the runner sees the stop or our wakeup
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		_wake();
+		_thread.join();
+	}
+
+	/**
+	* @brief Copy event e (or move it, if it is an rvalue) into the queue
+	*        (from any thread)
+	*
+	* @retval false if the queue was full and the event was dropped
+	*/
+	template <typename EV>
+	bool post(EV&& e)
+	{
+		if (!_ring.push(std::forward<EV>(e), Clock::now()))
+		{
+			_dropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+
+		if constexpr (CONFIG::kMode == PollMode::kSpinPark)
+		{
+			//Pairs with the fence in _park() so that either the runner sees the event or we see it parked
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (_parked.load(std::memory_order_relaxed) != 0)
+			{
+				_wake();
+			}
+		}
+
+		return true;
+	}
+
+	/**
+	* @return The state machine (only safe to use from its own handlers)
+	*/
+	SM& machine() { return _sm; }
+	const SM& machine() const { return _sm; }
+
+	/**
+	* @return Statistics of the runner (from any thread)
+	*/
+	PollStats stats() const
+	{
+		PollStats s{
+			_events.load(std::memory_order_relaxed),
+			_dropped.load(std::memory_order_relaxed),
+			_yields.load(std::memory_order_relaxed),
+			_parks.load(std::memory_order_relaxed),
+			{}
+		};
+
+		for (std::size_t i = 0; i < LatencyHistogram::kBuckets; ++i)
+		{
+			s.wakeup.counts[i] = _latency[i].load(std::memory_order_relaxed);
+		}
+
+		return s;
+	}
+
+private:
+	/**
+	* @brief Increment a counter which only the runner's thread writes
+	*/
+	template <typename T>
+	static void _increment(std::atomic<T>& counter)
+	{
+		counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+	}
+
+	void _run()
+	{
+		std::size_t polls = 0;
+
+		while (!_stop.load(std::memory_order_relaxed))
+		{
+			const bool waited = polls > 0;
+
+			const bool dispatched = _ring.consume([this, waited](Event& e, TimePoint posted)
+			{
+				if (waited)
+				{
+					const auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - posted);
+					_increment(_latency[LatencyHistogram::bucket(latency)]);
+				}
+
+				_sm.dispatch(std::move(e));
+				_increment(_events);
+			});
+
+			if (dispatched)
+			{
+				polls = 0;
+			}
+			else
+			{
+				_wait(polls++);
+			}
+		}
+	}
+
+	/**
+	* @brief Wait before the next poll of an empty queue
+	*
+	* @param polls Number of polls which found the queue empty so far
+	*/
+	void _wait(std::size_t polls)
+	{
+		if (CONFIG::kMode == PollMode::kSpin || polls < CONFIG::kSpins)
+		{
+			detail::cpu_relax();
+		}
+		else if (CONFIG::kMode == PollMode::kSpinYield || polls < CONFIG::kSpins + CONFIG::kYields)
+		{
+			_increment(_yields);
+			std::this_thread::yield();
+		}
+		else
+		{
+			_park();
+		}
+	}
+
+	void _park()
+	{
+		_parked.store(1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		if (_ring.empty() && !_stop.load(std::memory_order_relaxed))
+		{
+			_increment(_parks);
+
+			while (_parked.load(std::memory_order_acquire) != 0)
+			{
+				detail::futex_wait(_parked, 1);
+			}
+		}
+
+		_parked.store(0, std::memory_order_relaxed);
+	}
+
+	void _wake()
+	{
+		_parked.store(0, std::memory_order_release);
+		detail::futex_wake(_parked);
+	}
+
+private:
+	SM _sm;
+	Ring _ring;
+
+	alignas(64) std::atomic<std::uint32_t> _parked{0};
+	std::atomic<bool> _stop{false};
+
+	//Written by producers
+	alignas(64) std::atomic<std::size_t> _dropped{0};
+
+	//Written only by the runner's thread
+	alignas(64) std::atomic<std::size_t> _events{0};
+	std::atomic<std::size_t> _yields{0};
+	std::atomic<std::size_t> _parks{0};
+	std::atomic<std::size_t> _latency[LatencyHistogram::kBuckets] = {};
+
+	std::thread _thread;
+};
+
+} //namespace pw::hsm
+
+#endif //INCLUDE_PW_HSM_BUSY_POLL_HPP_
@@ -0,0 +1,107 @@
+#ifndef INCLUDE_PW_HSM_CLOCK_HPP_
+#define INCLUDE_PW_HSM_CLOCK_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <type_traits>
+#include <utility>
+
+//==============================================================================
+
+namespace pw::hsm
+{
+
+/**
+* @brief Clock whose time only moves when it is told to
+*
+* VirtualClock meets the requirements of a std::chrono clock, so it may be
+* used as the Clock of a @ref TimerConfig and a @ref QueueConfig. A
+* @ref RunLoop whose timers use a virtual clock does not sleep when it has
+* nothing to dispatch; it moves the clock straight to the next timer deadline
+* instead. This lets long scenarios (e.g., a week of operation) run in
+* milliseconds while exercising the same state classes as in production.
+*
+* The current time is shared by all users of the clock. Use a distinct TAG for
+* each simulation which must keep its own time.
+*
+* @tparam TAG Type which distinguishes independent virtual clocks
+*/
+template <typename TAG = void>
+struct VirtualClock
+{
+	using rep = std::chrono::nanoseconds::rep;
+	using period = std::chrono::nanoseconds::period;
+	using duration = std::chrono::nanoseconds;
+	using time_point = std::chrono::time_point<VirtualClock, duration>;
+
+	static constexpr bool is_steady = true;
+
+	static time_point now() noexcept
+	{
+		return time_point(duration(_now.load(std::memory_order_acquire)));
+	}
+
+	/**
+	* @brief Move the clock forward to time t (does nothing if t is not in the
+	*        future)
+	*/
+	static void advance_to(time_point t) noexcept
+	{
+		rep current = _now.load(std::memory_order_relaxed);
+		const rep target = t.time_since_epoch().count();
+
+		while (target > current &&
+			!_now.compare_exchange_weak(current, target, std::memory_order_release))
+		{
+
+		}
+	}
+
+	/**
+	* @brief Move the clock forward by d
+	*/
+	template <typename REP, typename PERIOD>
+	static void advance(std::chrono::duration<REP, PERIOD> d) noexcept
+	{
+		_now.fetch_add(std::chrono::duration_cast<duration>(d).count(), std::memory_order_release);
+	}
+
+	/**
+	* @brief Set the clock to time t (which may be in the past)
+	*
+	* Only call this while nothing measures time with the clock, e.g., before
+	* starting a new simulation.
+	*/
+	static void reset(time_point t = time_point{}) noexcept
+	{
+		_now.store(t.time_since_epoch().count(), std::memory_order_release);
+	}
+
+private:
+	static inline std::atomic<rep> _now{0};
+};
+
+} //namespace pw::hsm
+
+//==============================================================================
+
+namespace pw::hsm::detail
+{
+
+/*
+* Detects clocks which are advanced explicitly (see VirtualClock) rather than
+* by the passage of time
+*/
+template <typename CLOCK, typename ENABLE = void>
+struct is_virtual_clock : std::false_type {};
+
+template <typename CLOCK>
+struct is_virtual_clock<CLOCK, std::void_t<decltype(CLOCK::advance_to(std::declval<typename CLOCK::time_point>()))>> :
+	std::true_type {};
+
+template <typename CLOCK>
+constexpr bool is_virtual_clock_v = is_virtual_clock<CLOCK>::value;
+
+} //namespace pw::hsm::detail
+
+#endif //INCLUDE_PW_HSM_CLOCK_HPP_
@@ -0,0 +1,450 @@
+#ifndef INCLUDE_PW_HSM_COROUTINE_HPP_
+#define INCLUDE_PW_HSM_COROUTINE_HPP_
+
+#if __cplusplus < 202002L || !__has_include(<coroutine>)
+#error "pw/hsm/coroutine.hpp requires C++20 coroutines"
+#endif
+
+#include <pw/hsm.hpp>
+#include <coroutine>
+#include <cstddef>
+#include <cstdlib>
+#include <type_traits>
+#include <utility>
+
+//==============================================================================
+
+namespace pw::hsm::detail
+{
+
+/**
+* @brief Stack of coroutine frames carved out of a fixed buffer
+*
+* The frames of coroutine states are created on entry and destroyed on exit,
+* which happens in last-in/first-out order, so a frame is normally released
+* from the top of the stack. A frame released out of order is only marked
+* and its space is reclaimed once the frames above it are released too.
+*/
+class FrameArena
+{
+	struct alignas(__STDCPP_DEFAULT_NEW_ALIGNMENT__) Header
+	{
+		FrameArena* arena;
+		std::size_t previous;
+		bool released;
+	};
+
+	static constexpr std::size_t kAlign = __STDCPP_DEFAULT_NEW_ALIGNMENT__;
+	static constexpr std::size_t kNone = ~std::size_t(0);
+
+public:
+	FrameArena(unsigned char* buffer, std::size_t capacity) :
+		_buffer(buffer),
+		_capacity(capacity)
+	{
+
+	}
+
+	FrameArena(const FrameArena&) = delete;
+	FrameArena& operator=(const FrameArena&) = delete;
+
+	/**
+	* @return Storage for a frame of size bytes, or nullptr if the arena is
+	*         full
+	*/
+	void* allocate(std::size_t size)
+	{
+		const std::size_t block = sizeof(Header) + (size + kAlign - 1) / kAlign * kAlign;
+		if (_capacity - _top < block)
+		{
+			++_failures;
+			return nullptr;
+		}
+
+		Header* header = ::new (_buffer + _top) Header{this, _last, false};
+		_last = _top;
+		_top += block;
+
+		if (_top > _highWaterMark)
+		{
+			_highWaterMark = _top;
+		}
+
+		return header + 1;
+	}
+
+	/**
+	* @brief Release a frame returned by allocate() (of any arena)
+	*/
+	static void release(void* frame)
+	{
+		Header* header = static_cast<Header*>(frame) - 1;
+		header->released = true;
+		header->arena->_pop();
+	}
+
+	/**
+	* @return Number of bytes in use
+	*/
+	std::size_t used() const { return _top; }
+
+	/**
+	* @return Largest number of bytes ever in use
+	*/
+	std::size_t high_water_mark() const { return _highWaterMark; }
+
+	/**
+	* @return Number of frames which did not fit
+	*/
+	std::size_t failures() const { return _failures; }
+
+private:
+	void _pop()
+	{
+		while (_last != kNone)
+		{
+			Header* header = reinterpret_cast<Header*>(_buffer + _last);
+			if (!header->released)
+			{
+				return;
+			}
+
+			_top = _last;
+			_last = header->previous;
+		}
+	}
+
+private:
+	unsigned char* _buffer;
+	std::size_t _capacity;
+	std::size_t _top = 0;
+	std::size_t _last = kNone;
+	std::size_t _highWaterMark = 0;
+	std::size_t _failures = 0;
+};
+
+/**
+* @brief Declares handle(const E&) for each event E in Es, forwarding it to
+*        DERIVED::_resume()
+*/
+template <typename BASE, typename DERIVED, typename ... Es>
+class AwaitHandlers;
+
+template <typename BASE, typename DERIVED>
+class AwaitHandlers<BASE, DERIVED> : public BASE
+{
+public:
+	using BASE::BASE;
+};
+
+template <typename BASE, typename DERIVED, typename E, typename ... REST>
+class AwaitHandlers<BASE, DERIVED, E, REST...> : public AwaitHandlers<BASE, DERIVED, REST...>
+{
+public:
+	using AwaitHandlers<BASE, DERIVED, REST...>::AwaitHandlers;
+
+	HandleResult handle(const E& e) override
+	{
+		return static_cast<DERIVED&>(*this)._resume(e);
+	}
+};
+
+} //namespace pw::hsm::detail
+
+//==============================================================================
+
+namespace pw::hsm
+{
+
+/**
+* @brief Fixed-size arena from which the coroutine frames of a state
+*        machine's @ref CoroutineState "coroutine states" are allocated
+*
+* A machine with coroutine states must provide it through a member function
+* coroutine_arena(). Like other objects used by states, the arena should be
+* held in a base class which precedes pw::hsm::StateMachine, so that it
+* outlives the states. SIZE must fit the frames of all coroutine states
+* which can be active at once; a state whose frame does not fit has no body.
+*
+* @tparam SIZE Size of the arena in bytes
+*/
+template <std::size_t SIZE>
+class CoroutineArena : public detail::FrameArena
+{
+public:
+	CoroutineArena() : FrameArena(_storage, SIZE) {}
+
+private:
+	alignas(__STDCPP_DEFAULT_NEW_ALIGNMENT__) unsigned char _storage[SIZE];
+};
+
+/**
+* @brief Return type of the body of a @ref CoroutineState
+*
+* @tparam HANDLER Typename of the handler/visitor base class
+*/
+template <typename HANDLER>
+class StateCoroutine
+{
+	template <typename T_, typename HANDLER_, typename PARENT_, typename ... AWAITED_>
+	friend class CoroutineState;
+
+public:
+	/**
+	* @brief What the state does when its body returns: a function which
+	*        performs a transition from the state (or nullptr to stay)
+	*/
+	using Completion = HandleResult (*)(void* state);
+
+	/**
+	* @brief Value of promise_type::awaiting while the body awaits nothing
+	*/
+	static constexpr std::size_t kNone = ~std::size_t(0);
+
+	struct promise_type
+	{
+		/**
+		* @brief Allocate the frame from the arena of the machine of the state
+		*        whose member function the body is
+		*/
+		template <typename STATE>
+		static void* operator new(std::size_t size, STATE& state) noexcept
+		{
+			static_assert(std::is_base_of_v<detail::FrameArena, std::decay_t<decltype(state.sm().coroutine_arena())>>,
+				"A machine with coroutine states must provide a CoroutineArena through coroutine_arena()");
+
+			return state.sm().coroutine_arena().allocate(size);
+		}
+
+		static void operator delete(void* frame)
+		{
+			detail::FrameArena::release(frame);
+		}
+
+		static StateCoroutine get_return_object_on_allocation_failure()
+		{
+			return StateCoroutine();
+		}
+
+		StateCoroutine get_return_object()
+		{
+			return StateCoroutine(std::coroutine_handle<promise_type>::from_promise(*this));
+		}
+
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_always final_suspend() noexcept { return {}; }
+
+		void return_value(Completion c)
+		{
+			completion = c;
+			awaiting = kNone;
+		}
+		void unhandled_exception() { std::abort(); }
+
+		/**
+		* @brief Event being delivered to the body
+		*/
+		const AbstractEvent<HANDLER>* event = nullptr;
+
+		/**
+		* @brief Index (in the handler's event list) of the event the body
+		*        waits for
+		*/
+		std::size_t awaiting = kNone;
+
+		Completion completion = nullptr;
+	};
+
+	/**
+	* @brief Awaitable which suspends the body until an event of type E is
+	*        dispatched to the state
+	*
+	* The event is only valid until the body awaits the next one.
+	*/
+	template <typename E>
+	struct Next
+	{
+		bool await_ready() const noexcept { return false; }
+
+		void await_suspend(std::coroutine_handle<promise_type> h) noexcept
+		{
+			promise = &h.promise();
+			promise->awaiting = detail::index_of_v<E, detail::handler_events_t<HANDLER>>;
+		}
+
+		const E& await_resume() const noexcept
+		{
+			return static_cast<const E&>(*promise->event);
+		}
+
+		promise_type* promise = nullptr;
+	};
+
+public:
+	StateCoroutine() = default;
+
+	StateCoroutine(StateCoroutine&& other) noexcept :
+		_handle(std::exchange(other._handle, nullptr))
+	{
+
+	}
+
+	StateCoroutine& operator=(StateCoroutine&& other) noexcept
+	{
+		if (this != &other)
+		{
+			_destroy();
+			_handle = std::exchange(other._handle, nullptr);
+		}
+		return *this;
+	}
+
+	~StateCoroutine()
+	{
+		_destroy();
+	}
+
+private:
+	explicit StateCoroutine(std::coroutine_handle<promise_type> h) : _handle(h) {}
+
+	void _destroy()
+	{
+		if (_handle)
+		{
+			_handle.destroy();
+			_handle = nullptr;
+		}
+	}
+
+private:
+	std::coroutine_handle<promise_type> _handle;
+};
+
+/**
+* @brief A leaf state whose behavior is written as a coroutine which awaits
+*        the events it expects one after the other
+*
+* The state's body is a member function returning Body. The state starts it
+* in its constructor with start(body()); the body then runs until its first
+* co_await next<E>(). Each time an event of the awaited type is dispatched to
+* the state, the body resumes until it awaits the next event. Events of the
+* other types in AWAITED are passed to the parent meanwhile, as are all
+* events once the body has returned.
+*
+* The body ends with co_return transition_to<DEST>() to leave the state
+* (the transition is performed after the body has finished) or co_return
+* stay() to remain in the state without a body. It must await at least one
+* event before returning a transition.
+*
+* The coroutine frame is allocated from the machine's @ref CoroutineArena
+* and destroyed when the state is exited, so a multi-step protocol needs
+* neither a substate per step nor a heap allocation.
+*
+* The state trades speed for readability: entering it creates the frame and
+* runs the body, each awaited event resumes the body through an indirect
+* call, and exiting it destroys the frame, whereas a transition between
+* substates only constructs the next state in place. A three-step handshake
+* (examples/coroutine_states) takes about 1.5 times as long as with one
+* substate per step, so prefer substates for the hottest paths.
+*
+* @tparam T Typename of the state (CRTP)
+* @tparam HANDLER Typename of the handler/visitor base class
+* @tparam PARENT Typename of the parent state
+* @tparam AWAITED Types of the events the body awaits
+*/
+template <typename T, typename HANDLER, typename PARENT, typename ... AWAITED>
+class CoroutineState :
+	public detail::AwaitHandlers<State<T, HANDLER, PARENT>, CoroutineState<T, HANDLER, PARENT, AWAITED...>, AWAITED...>
+{
+	template <typename BASE_, typename DERIVED_, typename ... Es_>
+	friend class detail::AwaitHandlers;
+
+	using Base = detail::AwaitHandlers<State<T, HANDLER, PARENT>, CoroutineState, AWAITED...>;
+
+public:
+	using Body = StateCoroutine<HANDLER>;
+	using Awaited = detail::TypeList<AWAITED...>;
+	using Completion = typename Body::Completion;
+
+public:
+	CoroutineState(PARENT& parent) : Base(parent) {}
+
+protected:
+	/**
+	* @brief Take over body, which has run until it awaits its first event
+	*        (call from the state's constructor)
+	*/
+	void start(Body body)
+	{
+		_body = std::move(body);
+		_promise = _body._handle ? &_body._handle.promise() : nullptr;
+	}
+
+	/**
+	* @brief Awaitable which suspends the body until an event of type E is
+	*        dispatched to the state
+	*/
+	template <typename E>
+	static typename Body::template Next<E> next()
+	{
+		static_assert(detail::contains_v<E, Awaited>, "The body can only await events listed in AWAITED");
+		return {};
+	}
+
+	/**
+	* @brief Completion which transitions from the state to DEST once the
+	*        body has returned
+	*/
+	template <typename DEST>
+	static Completion transition_to()
+	{
+		return [](void* state) { return static_cast<T*>(state)->template transition<DEST>(); };
+	}
+
+	/**
+	* @brief Completion which stays in the state
+	*/
+	static Completion stay()
+	{
+		return nullptr;
+	}
+
+	/**
+	* @return Whether the body has returned (or could not be allocated)
+	*/
+	bool finished() const
+	{
+		return !_body._handle || _body._handle.done();
+	}
+
+private:
+	template <typename E>
+	HandleResult _resume(const E& e)
+	{
+		//awaiting is kNone once the body has returned
+		if (!_promise || _promise->awaiting != detail::index_of_v<E, detail::handler_events_t<HANDLER>>)
+		{
+			return ::pw::hsm::kPass;
+		}
+
+		auto& promise = *_promise;
+		promise.event = &e;
+		_body._handle.resume();
+
+		if (promise.awaiting != Body::kNone || !promise.completion)
+		{
+			return ::pw::hsm::kHandled;
+		}
+
+		//May destroy this state and its body, so nothing may be touched after
+		return promise.completion(static_cast<T*>(this));
+	}
+
+private:
+	Body _body;
+	typename Body::promise_type* _promise = nullptr;
+};
+
+} //namespace pw::hsm
+
+#endif //INCLUDE_PW_HSM_COROUTINE_HPP_
@@ -0,0 +1,558 @@
+#ifndef INCLUDE_PW_HSM_EPOLL_HPP_
+#define INCLUDE_PW_HSM_EPOLL_HPP_
+
+#include <pw/hsm.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <type_traits>
+
+#include <pthread.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+//==============================================================================
+
+namespace pw::hsm::detail
+{
+
+/**
+* @brief A file descriptor watched by an EpollLoop
+*/
+struct EpollSource
+{
+	/**
+	* @brief Called on the loop's thread when fd is ready
+	*
+	* @param events The epoll events which are ready (e.g., EPOLLIN)
+	*/
+	void (*ready)(EpollSource& source, std::uint32_t events) = nullptr;
+
+	int fd = -1;
+};
+
+/**
+* @brief Construct an event of type E from args if E has such a constructor,
+*        otherwise default-construct it
+*/
+template <typename E, typename ... ARGS>
+E make_source_event(ARGS ... args)
+{
+	if constexpr (std::is_constructible_v<E, ARGS...>)
+	{
+		return E(args...);
+	}
+	else
+	{
+		return E();
+	}
+}
+
+/**
+* @brief Read an 8-byte counter from fd (as produced by timerfd and eventfd)
+*
+* @return The counter, or 0 if there was nothing to read
+*/
+inline std::uint64_t read_counter(int fd)
+{
+	std::uint64_t count = 0;
+	return ::read(fd, &count, sizeof(count)) == sizeof(count) ? count : 0;
+}
+
+} //namespace pw::hsm::detail
+
+//==============================================================================
+
+namespace pw::hsm
+{
+
+/**
+* @brief Event loop which multiplexes file descriptors with epoll and
+*        dispatches their readiness straight into state machines (Linux only)
+*
+* Each source (@ref FdSource, @ref TimerSource, @ref EventSource,
+* @ref SignalSource) maps a file descriptor to an event type of one machine.
+* When the descriptor becomes ready, the loop constructs the event and
+* dispatches it on its own thread, so no helper thread or queue sits between
+* the kernel and the machine.
+*
+* Sources register themselves when they are constructed and unregister when
+* they are destroyed. They must outlive the loop's run() and must not be
+* destroyed from a handler.
+*/
+class EpollLoop
+{
+public:
+	/**
+	* @brief Maximum number of ready descriptors taken from the kernel at once
+	*/
+	static constexpr int kMaxEvents = 64;
+
+public:
+	EpollLoop() :
+		_epoll(::epoll_create1(EPOLL_CLOEXEC)),
+		_wakeup(::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK))
+	{
+		epoll_event ev{};
+		ev.events = EPOLLIN;
+		ev.data.ptr = nullptr;
+		if (_epoll >= 0 && _wakeup >= 0 && ::epoll_ctl(_epoll, EPOLL_CTL_ADD, _wakeup, &ev) != 0)
+		{
+			_close();
+		}
+	}
+
+	EpollLoop(const EpollLoop&) = delete;
+	EpollLoop& operator=(const EpollLoop&) = delete;
+
+	~EpollLoop()
+	{
+		_close();
+	}
+
+	/**
+	* @return Whether the loop's descriptors could be created
+	*/
+	bool valid() const { return _epoll >= 0 && _wakeup >= 0; }
+
+	/**
+	* @brief Dispatch the readiness of the sources until stop() is called
+	*/
+	void run()
+	{
+		while (run_once(-1))
+		{
+
+		}
+	}
+
+	/**
+	* @brief Wait up to timeout for descriptors to become ready and dispatch
+	*        them (a negative timeout waits forever)
+	*
+	* @retval false if the loop has been stopped or cannot wait
+	*/
+	template <typename REP, typename PERIOD>
+	bool run_once(std::chrono::duration<REP, PERIOD> timeout)
+	{
+		return run_once(int(std::chrono::duration_cast<std::chrono::milliseconds>(timeout).count()));
+	}
+
+	/**
+	* @brief Wait up to timeout milliseconds for descriptors to become ready
+	*        and dispatch them (-1 waits forever)
+	*
+	* @retval false if the loop has been stopped or cannot wait
+	*/
+	bool run_once(int timeout)
+	{
+		if (_stop.load(std::memory_order_relaxed) || !valid())
+		{
+			return false;
+		}
+
+		epoll_event events[kMaxEvents];
+		const int n = ::epoll_wait(_epoll, events, kMaxEvents, timeout);
+		if (n < 0)
+		{
+			return errno == EINTR;
+		}
+
+		++_wakeups;
+
+		for (int i = 0; i < n; ++i)
+		{
+			if (auto* source = static_cast<detail::EpollSource*>(events[i].data.ptr))
+			{
+				source->ready(*source, events[i].events);
+			}
+			else
+			{
+				detail::read_counter(_wakeup);
+			}
+		}
+
+		return !_stop.load(std::memory_order_relaxed);
+	}
+
+	/**
+	* @brief Make run() return (from any thread, including from a signal
+	*        handler)
+	*/
+	void stop()
+	{
+		_stop.store(true, std::memory_order_relaxed);
+		const std::uint64_t one = 1;
+		[[maybe_unused]] const auto written = ::write(_wakeup, &one, sizeof(one));
+	}
+
+	/**
+	* @return Number of times epoll_wait() returned (must be called from the
+	*         loop's thread)
+	*/
+	std::size_t wakeups() const { return _wakeups; }
+
+	/**
+	* @brief Start watching source for events (normally called by sources)
+	*
+	* @retval false if the descriptor could not be added
+	*/
+	bool add(detail::EpollSource& source, std::uint32_t events)
+	{
+		epoll_event ev{};
+		ev.events = events;
+		ev.data.ptr = &source;
+		return valid() && source.fd >= 0 && ::epoll_ctl(_epoll, EPOLL_CTL_ADD, source.fd, &ev) == 0;
+	}
+
+	/**
+	* @brief Stop watching source (normally called by sources)
+	*/
+	void remove(detail::EpollSource& source)
+	{
+		if (valid() && source.fd >= 0)
+		{
+			::epoll_ctl(_epoll, EPOLL_CTL_DEL, source.fd, nullptr);
+		}
+	}
+
+private:
+	void _close()
+	{
+		if (_epoll >= 0)
+		{
+			::close(_epoll);
+			_epoll = -1;
+		}
+
+		if (_wakeup >= 0)
+		{
+			::close(_wakeup);
+			_wakeup = -1;
+		}
+	}
+
+private:
+	int _epoll;
+	int _wakeup;
+	std::atomic<bool> _stop{false};
+	std::size_t _wakeups = 0;
+};
+
+/**
+* @brief Dispatches an event of type E into sm whenever a file descriptor is
+*        ready
+*
+* E is constructed with (int fd, std::uint32_t events) if it has such a
+* constructor, otherwise it is default-constructed. The handler is expected to
+* read from or write to the descriptor; with the default level-triggered
+* events, E is dispatched again as long as the descriptor stays ready. The
+* descriptor is not owned by the source.
+*
+* @tparam SM Typename of the state machine
+* @tparam E Typename of the event
+*/
+template <typename SM, typename E>
+class FdSource : private detail::EpollSource
+{
+public:
+	FdSource(EpollLoop& loop, SM& sm, int fd, std::uint32_t events = EPOLLIN) :
+		_loop(loop),
+		_sm(sm)
+	{
+		this->ready = &FdSource::_ready;
+		this->fd = fd;
+		_added = _loop.add(*this, events);
+	}
+
+	FdSource(const FdSource&) = delete;
+	FdSource& operator=(const FdSource&) = delete;
+
+	~FdSource()
+	{
+		if (_added)
+		{
+			_loop.remove(*this);
+		}
+	}
+
+	/**
+	* @return Whether the descriptor is being watched
+	*/
+	bool valid() const { return _added; }
+
+private:
+	static void _ready(detail::EpollSource& source, std::uint32_t events)
+	{
+		auto& self = static_cast<FdSource&>(source);
+		self._sm.dispatch(detail::make_source_event<E>(self.fd, events));
+	}
+
+private:
+	EpollLoop& _loop;
+	SM& _sm;
+	bool _added = false;
+};
+
+/**
+* @brief Timer backed by a timerfd which dispatches an event of type E into
+*        sm when it expires
+*
+* E is constructed with (std::uint64_t expirations) if it has such a
+* constructor, otherwise it is default-constructed. expirations is more than
+* 1 if the loop fell behind a periodic timer.
+*
+* @tparam SM Typename of the state machine
+* @tparam E Typename of the event
+*/
+template <typename SM, typename E>
+class TimerSource : private detail::EpollSource
+{
+public:
+	TimerSource(EpollLoop& loop, SM& sm) :
+		_loop(loop),
+		_sm(sm)
+	{
+		this->ready = &TimerSource::_ready;
+		this->fd = ::timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+		_added = _loop.add(*this, EPOLLIN);
+	}
+
+	TimerSource(const TimerSource&) = delete;
+	TimerSource& operator=(const TimerSource&) = delete;
+
+	~TimerSource()
+	{
+		if (_added)
+		{
+			_loop.remove(*this);
+		}
+
+		if (this->fd >= 0)
+		{
+			::close(this->fd);
+		}
+	}
+
+	/**
+	* @return Whether the timer could be created and is being watched
+	*/
+	bool valid() const { return _added; }
+
+	/**
+	* @brief Expire after timeout, then every interval (once if interval is
+	*        zero)
+	*
+	* @retval false if the timer could not be set
+	*/
+	template <typename REP, typename PERIOD, typename IREP = REP, typename IPERIOD = PERIOD>
+	bool start(std::chrono::duration<REP, PERIOD> timeout, std::chrono::duration<IREP, IPERIOD> interval = {})
+	{
+		//A zero it_value would disarm the timer
+		const auto first = std::max<std::chrono::nanoseconds>(timeout, std::chrono::nanoseconds(1));
+
+		itimerspec spec{};
+		spec.it_value = _timespec(first);
+		spec.it_interval = _timespec(interval);
+		return ::timerfd_settime(this->fd, 0, &spec, nullptr) == 0;
+	}
+
+	/**
+	* @brief Disarm the timer
+	*/
+	void cancel()
+	{
+		const itimerspec spec{};
+		::timerfd_settime(this->fd, 0, &spec, nullptr);
+		detail::read_counter(this->fd);
+	}
+
+private:
+	template <typename REP, typename PERIOD>
+	static timespec _timespec(std::chrono::duration<REP, PERIOD> d)
+	{
+		const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+		timespec ts{};
+		ts.tv_sec = time_t(ns / 1000000000);
+		ts.tv_nsec = long(ns % 1000000000);
+		return ts;
+	}
+
+	static void _ready(detail::EpollSource& source, std::uint32_t)
+	{
+		auto& self = static_cast<TimerSource&>(source);
+
+		//Nothing to read if the timer was cancelled after it became ready
+		if (const std::uint64_t expirations = detail::read_counter(self.fd))
+		{
+			self._sm.dispatch(detail::make_source_event<E>(expirations));
+		}
+	}
+
+private:
+	EpollLoop& _loop;
+	SM& _sm;
+	bool _added = false;
+};
+
+/**
+* @brief Counter backed by an eventfd which dispatches an event of type E into
+*        sm after it has been notified
+*
+* notify() may be called from any thread and from signal handlers. Any number
+* of notifications before the loop gets to the source are merged into one
+* event; E is constructed with (std::uint64_t count) if it has such a
+* constructor, otherwise it is default-constructed.
+*
+* @tparam SM Typename of the state machine
+* @tparam E Typename of the event
+*/
+template <typename SM, typename E>
+class EventSource : private detail::EpollSource
+{
+public:
+	EventSource(EpollLoop& loop, SM& sm) :
+		_loop(loop),
+		_sm(sm)
+	{
+		this->ready = &EventSource::_ready;
+		this->fd = ::eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+		_added = _loop.add(*this, EPOLLIN);
+	}
+
+	EventSource(const EventSource&) = delete;
+	EventSource& operator=(const EventSource&) = delete;
+
+	~EventSource()
+	{
+		if (_added)
+		{
+			_loop.remove(*this);
+		}
+
+		if (this->fd >= 0)
+		{
+			::close(this->fd);
+		}
+	}
+
+	/**
+	* @return Whether the eventfd could be created and is being watched
+	*/
+	bool valid() const { return _added; }
+
+	/**
+	* @brief Add count to the counter, making the loop dispatch E
+	*
+	* @retval false if the counter would overflow
+	*/
+	bool notify(std::uint64_t count = 1)
+	{
+		return ::write(this->fd, &count, sizeof(count)) == sizeof(count);
+	}
+
+private:
+	static void _ready(detail::EpollSource& source, std::uint32_t)
+	{
+		auto& self = static_cast<EventSource&>(source);
+
+		if (const std::uint64_t count = detail::read_counter(self.fd))
+		{
+			self._sm.dispatch(detail::make_source_event<E>(count));
+		}
+	}
+
+private:
+	EpollLoop& _loop;
+	SM& _sm;
+	bool _added = false;
+};
+
+/**
+* @brief Dispatches an event of type E into sm when one of a set of signals is
+*        delivered, using a signalfd
+*
+* The signals are blocked on the constructing thread, since a signalfd only
+* sees signals which are not delivered to a handler. Construct the source
+* before starting other threads (which inherit the signal mask), or block the
+* signals in them too. The mask is left blocked when the source is destroyed.
+*
+* E is constructed with (int signo) if it has such a constructor, otherwise it
+* is default-constructed.
+*
+* @tparam SM Typename of the state machine
+* @tparam E Typename of the event
+*/
+template <typename SM, typename E>
+class SignalSource : private detail::EpollSource
+{
+public:
+	SignalSource(EpollLoop& loop, SM& sm, std::initializer_list<int> signals) :
+		_loop(loop),
+		_sm(sm)
+	{
+		sigset_t mask;
+		sigemptyset(&mask);
+		for (int signo : signals)
+		{
+			sigaddset(&mask, signo);
+		}
+
+		this->ready = &SignalSource::_ready;
+		if (::pthread_sigmask(SIG_BLOCK, &mask, nullptr) == 0)
+		{
+			this->fd = ::signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+		}
+		_added = _loop.add(*this, EPOLLIN);
+	}
+
+	SignalSource(const SignalSource&) = delete;
+	SignalSource& operator=(const SignalSource&) = delete;
+
+	~SignalSource()
+	{
+		if (_added)
+		{
+			_loop.remove(*this);
+		}
+
+		if (this->fd >= 0)
+		{
+			::close(this->fd);
+		}
+	}
+
+	/**
+	* @return Whether the signalfd could be created and is being watched
+	*/
+	bool valid() const { return _added; }
+
+private:
+	static void _ready(detail::EpollSource& source, std::uint32_t)
+	{
+		auto& self = static_cast<SignalSource&>(source);
+		signalfd_siginfo info;
+
+		while (::read(self.fd, &info, sizeof(info)) == sizeof(info))
+		{
+			self._sm.dispatch(detail::make_source_event<E>(int(info.ssi_signo)));
+		}
+	}
+
+private:
+	EpollLoop& _loop;
+	SM& _sm;
+	bool _added = false;
+};
+
+} //namespace pw::hsm
+
+#endif //INCLUDE_PW_HSM_EPOLL_HPP_
@@ -0,0 +1,636 @@
+#ifndef INCLUDE_PW_HSM_EXECUTOR_HPP_
+#define INCLUDE_PW_HSM_EXECUTOR_HPP_
+
+#include <pw/hsm/queue.hpp>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+//==============================================================================
+
+namespace pw::hsm
+{
+
+/**
+* @brief Compile-time configuration of an Executor
+*
+* To change a setting, inherit from ExecutorConfig, redeclare the setting and
+* pass the new type as the CONFIG argument of Executor.
+*/
+struct ExecutorConfig
+{
+	/**
+	* @brief Number of ready active objects each worker's deque can hold
+	*        (must be a power of 2)
+	*
+	* Objects scheduled while a worker's deque is full go to the executor's
+	* shared queue instead.
+	*/
+	static constexpr std::size_t kDequeCapacity = 1024;
+
+	/**
+	* @brief Maximum number of events an active object dispatches before its
+	*        worker moves on to other objects
+	*/
+	static constexpr std::size_t kBudget = 16;
+
+	/**
+	* @brief Number of times an idle worker looks for work before it sleeps
+	*/
+	static constexpr std::size_t kSpins = 64;
+
+	/**
+	* @brief Every how many runs a worker takes an object from the shared queue
+	*        before looking at its own deque
+	*/
+	static constexpr std::size_t kSharedInterval = 31;
+};
+
+/**
+* @brief Statistics of an Executor
+*/
+struct ExecutorStats
+{
+	/**
+	* @brief Number of times an active object was run by a worker
+	*/
+	std::size_t runs;
+
+	/**
+	* @brief Number of active objects taken from another worker's deque
+	*/
+	std::size_t steals;
+
+	/**
+	* @brief Number of times a worker went to sleep for lack of work
+	*/
+	std::size_t parks;
+};
+
+} //namespace pw::hsm
+
+//==============================================================================
+
+namespace pw::hsm::detail
+{
+
+/**
+* @brief Something an Executor can run, i.e., an active object with events in
+*        its mailbox
+*/
+struct Task
+{
+	/**
+	* @brief Link in the executor's shared queue
+	*/
+	Task* next = nullptr;
+
+	/**
+	* @brief Run the task for at most budget events
+	*
+	* @retval true if the task is still ready and must be scheduled again
+	*/
+	bool (*run)(Task& task, std::size_t budget) = nullptr;
+};
+
+/**
+* @brief Fixed-capacity Chase-Lev work-stealing deque
+*
+* The owning worker pushes at the bottom. Unlike the classic deque, the owner
+* takes from the top just like the thieves do, so each worker runs its ready
+* objects in FIFO order. When many objects are ready at once, LIFO order lets
+* a few busy objects starve the rest, whose mailboxes then overflow.
+*/
+template <std::size_t CAPACITY>
+class WorkDeque
+{
+	static_assert(CAPACITY > 0 && (CAPACITY & (CAPACITY - 1)) == 0, "CAPACITY must be a power of 2");
+
+	static constexpr std::int64_t kMask = std::int64_t(CAPACITY) - 1;
+
+public:
+	/**
+	* @retval false if the deque is full (owner only)
+	*/
+	bool push(Task* task)
+	{
+		const std::int64_t b = _bottom.load(std::memory_order_relaxed);
+		const std::int64_t t = _top.load(std::memory_order_acquire);
+
+		if (b - t >= std::int64_t(CAPACITY))
+		{
+			return false;
+		}
+
+		_tasks[b & kMask].store(task, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		_bottom.store(b + 1, std::memory_order_relaxed);
+		return true;
+	}
+
+	/**
+	* @return The least recently pushed task or nullptr (any thread, 
+	*         including the owner)
+	*/
+	Task* take()
+	{
+		std::int64_t t = _top.load(std::memory_order_acquire);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		const std::int64_t b = _bottom.load(std::memory_order_acquire);
+
+		if (t >= b)
+		{
+			return nullptr;
+		}
+
+		Task* task = _tasks[t & kMask].load(std::memory_order_relaxed);
+		if (!_top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+		{
+			return nullptr;
+		}
+
+		return task;
+	}
+
+	bool empty() const
+	{
+		return _bottom.load(std::memory_order_acquire) <= _top.load(std::memory_order_acquire);
+	}
+
+private:
+	alignas(64) std::atomic<std::int64_t> _top{0};
+	alignas(64) std::atomic<std::int64_t> _bottom{0};
+	std::atomic<Task*> _tasks[CAPACITY] = {};
+};
+
+} //namespace pw::hsm::detail
+
+//==============================================================================
+
+namespace pw::hsm
+{
+
+/**
+* @brief Fixed pool of worker threads which runs active objects
+*
+* Every worker owns a work-stealing deque of ready active objects. An object
+* which becomes ready on a worker (e.g., because one of its handlers posted to
+* another object) is pushed onto that worker's deque; objects made ready by
+* other threads go to a shared queue. Idle workers steal from the top of the
+* other workers' deques, which spreads load across cores, and sleep when there
+* is no work at all.
+*
+* An active object is only ever run by one worker at a time and its mailbox is
+* FIFO, so each machine still processes its events one at a time in the order
+* they were posted (run-to-completion).
+*
+* @tparam CONFIG Compile-time configuration (see @ref ExecutorConfig)
+*/
+template <typename CONFIG = ExecutorConfig>
+class Executor
+{
+	struct Worker;
+
+public:
+	/**
+	* @brief Start the worker threads
+	*/
+	explicit Executor(std::size_t workers = std::thread::hardware_concurrency()) :
+		_size(workers > 0 ? workers : 1),
+		_workers(new Worker[_size])
+	{
+		for (std::size_t i = 0; i < _size; ++i)
+		{
+			_workers[i].thread = std::thread([this, i]() { _work(i); });
+		}
+	}
+
+	Executor(const Executor&) = delete;
+	Executor& operator=(const Executor&) = delete;
+
+	/**
+	* @brief Stop and join the workers
+	*
+	* Events still in mailboxes are not dispatched; call wait_idle() first to
+	* drain them.
+	*/
+	~Executor()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_guard);
+			_stop.store(true, std::memory_order_relaxed);
+		}
+		_wake.notify_all();
+
+		for (std::size_t i = 0; i < _size; ++i)
+		{
+			_workers[i].thread.join();
+		}
+	}
+
+	/**
+	* @return Number of worker threads
+	*/
+	std::size_t size() const { return _size; }
+
+	/**
+	* @brief Wait until no active object has events left to dispatch
+	*
+	* Must not be called from a worker.
+	*/
+	void wait_idle()
+	{
+		std::unique_lock<std::mutex> lock(_guard);
+		_idle.wait(lock, [this]() { return _ready.load(std::memory_order_acquire) == 0; });
+	}
+
+	ExecutorStats stats() const
+	{
+		ExecutorStats s{};
+		for (std::size_t i = 0; i < _size; ++i)
+		{
+			s.runs += _workers[i].runs.load(std::memory_order_relaxed);
+			s.steals += _workers[i].steals.load(std::memory_order_relaxed);
+			s.parks += _workers[i].parks.load(std::memory_order_relaxed);
+		}
+		return s;
+	}
+
+	/**
+	* @brief Queue task, which has just become ready, to be run by a worker
+	*/
+	void schedule(detail::Task& task)
+	{
+		_ready.fetch_add(1, std::memory_order_relaxed);
+		_enqueue(task);
+	}
+
+private:
+	struct Worker
+	{
+		detail::WorkDeque<CONFIG::kDequeCapacity> deque;
+		std::thread thread;
+		std::atomic<std::size_t> runs{0};
+		std::atomic<std::size_t> steals{0};
+		std::atomic<std::size_t> parks{0};
+		std::size_t ticks = 0;
+	};
+
+	/*
+	* The executor and index of the worker running on this thread (if any)
+	*/
+	struct Current
+	{
+		const Executor* executor = nullptr;
+		std::size_t index = 0;
+	};
+
+	static Current& _current()
+	{
+		static thread_local Current current;
+		return current;
+	}
+
+	void _enqueue(detail::Task& task)
+	{
+		const Current& current = _current();
+
+		if (current.executor != this || !_workers[current.index].deque.push(&task))
+		{
+			_pushShared(task);
+		}
+
+		//Pairs with the fence in _park() so that either the sleeper sees the task or we see the sleeper
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (_sleepers.load(std::memory_order_relaxed) > 0)
+		{
+			{
+				std::lock_guard<std::mutex> lock(_guard);
+				++_signals;
+			}
+			_wake.notify_one();
+		}
+	}
+
+	void _pushShared(detail::Task& task)
+	{
+		std::lock_guard<std::mutex> lock(_guard);
+		task.next = nullptr;
+		if (_tail)
+		{
+			_tail->next = &task;
+		}
+		else
+		{
+			_head = &task;
+		}
+		_tail = &task;
+		_shared.store(true, std::memory_order_relaxed);
+	}
+
+	detail::Task* _popShared()
+	{
+		if (!_shared.load(std::memory_order_relaxed))
+		{
+			return nullptr;
+		}
+
+		std::lock_guard<std::mutex> lock(_guard);
+		detail::Task* task = _head;
+		if (task)
+		{
+			_head = task->next;
+			if (!_head)
+			{
+				_tail = nullptr;
+				_shared.store(false, std::memory_order_relaxed);
+			}
+		}
+		return task;
+	}
+
+	detail::Task* _steal(std::size_t self)
+	{
+		for (std::size_t i = 1; i < _size; ++i)
+		{
+			Worker& victim = _workers[(self + i) % _size];
+			if (detail::Task* task = victim.deque.take())
+			{
+				_workers[self].steals.fetch_add(1, std::memory_order_relaxed);
+				return task;
+			}
+		}
+		return nullptr;
+	}
+
+	detail::Task* _find(std::size_t self)
+	{
+		Worker& worker = _workers[self];
+
+		//Now and then, look at the shared queue first so that objects made ready by other threads are not starved
+		if (++worker.ticks % CONFIG::kSharedInterval == 0)
+		{
+			if (detail::Task* task = _popShared())
+			{
+				return task;
+			}
+		}
+
+		if (detail::Task* task = worker.deque.take())
+		{
+			return task;
+		}
+
+		if (detail::Task* task = _popShared())
+		{
+			return task;
+		}
+
+		return _steal(self);
+	}
+
+	bool _stopping() const
+	{
+		return _stop.load(std::memory_order_relaxed);
+	}
+
+	bool _anyWork() const
+	{
+		if (_shared.load(std::memory_order_relaxed))
+		{
+			return true;
+		}
+
+		for (std::size_t i = 0; i < _size; ++i)
+		{
+			if (!_workers[i].deque.empty())
+			{
+				return true;
+			}
+		}
+		return false;
+	}
+
+	/**
+	* @brief Sleep until work is scheduled
+	*
+	* @retval false if the executor is stopping
+	*/
+	bool _park(std::size_t self)
+	{
+		std::unique_lock<std::mutex> lock(_guard);
+
+		_sleepers.fetch_add(1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		if (!_stopping() && _signals == 0 && !_anyWork())
+		{
+			_workers[self].parks.fetch_add(1, std::memory_order_relaxed);
+			_wake.wait(lock, [this]() { return _stopping() || _signals > 0; });
+		}
+
+		if (_signals > 0)
+		{
+			--_signals;
+		}
+		_sleepers.fetch_sub(1, std::memory_order_relaxed);
+
+		return !_stopping();
+	}
+
+	void _work(std::size_t self)
+	{
+		_current() = Current{this, self};
+		Worker& worker = _workers[self];
+		std::size_t spins = 0;
+
+		while (!_stopping())
+		{
+			detail::Task* task = _find(self);
+
+			if (!task)
+			{
+				if (++spins < CONFIG::kSpins)
+				{
+					std::this_thread::yield();
+				}
+				else
+				{
+					spins = 0;
+					if (!_park(self))
+					{
+						return;
+					}
+				}
+				continue;
+			}
+
+			spins = 0;
+			worker.runs.fetch_add(1, std::memory_order_relaxed);
+
+			if (task->run(*task, CONFIG::kBudget))
+			{
+				//Out of budget: go to the back of the shared queue for fairness
+				_pushShared(*task);
+			}
+			else if (_ready.fetch_sub(1, std::memory_order_acq_rel) == 1)
+			{
+				std::lock_guard<std::mutex> lock(_guard);
+				_idle.notify_all();
+			}
+		}
+	}
+
+private:
+	const std::size_t _size;
+	std::unique_ptr<Worker[]> _workers;
+
+	std::mutex _guard;
+	std::condition_variable _wake;
+	std::condition_variable _idle;
+	detail::Task* _head = nullptr;
+	detail::Task* _tail = nullptr;
+	std::atomic<bool> _shared{false};
+	std::atomic<std::size_t> _sleepers{0};
+	std::size_t _signals = 0;
+	std::atomic<bool> _stop{false};
+
+	/*
+	* Number of active objects which are scheduled or running
+	*/
+	std::atomic<std::size_t> _ready{0};
+};
+
+/**
+* @brief A StateMachine with its own mailbox, run by an Executor
+*
+* Events posted to the object from any thread (including from handlers of
+* other active objects) are queued in its mailbox. The first event posted to
+* an empty mailbox schedules the object on the executor, whose workers then
+* dispatch the mailbox's events in order.
+*
+* The object must not be destroyed while it has events in its mailbox (see
+* Executor::wait_idle()).
+*
+* @tparam SM Typename of the state machine
+* @tparam QCONFIG Configuration of the mailbox (see @ref QueueConfig)
+* @tparam EXECUTOR Typename of the executor
+*/
+template <typename SM, typename QCONFIG = QueueConfig, typename EXECUTOR = Executor<>>
+class ActiveObject : private detail::Task
+{
+	static_assert(QCONFIG::kOverflow != Overflow::kBlock, "Mailboxes cannot block the posting thread");
+
+	using Handler = typename SM::RootState::Handler;
+	using Mailbox = EventQueue<Handler, QCONFIG>;
+
+public:
+	/**
+	* @brief Construct the state machine with args
+	*/
+	template <typename ... ARGS>
+	explicit ActiveObject(EXECUTOR& executor, ARGS&& ... args) :
+		_executor(executor),
+		_sm(std::forward<ARGS>(args)...)
+	{
+		this->run = &ActiveObject::_run;
+	}
+
+	ActiveObject(const ActiveObject&) = delete;
+	ActiveObject& operator=(const ActiveObject&) = delete;
+
+	/**
+	* @brief Copy event e (or move it, if it is an rvalue) into the mailbox
+	*        (from any thread)
+	*
+	* @retval false if the mailbox was full and the event was not queued
+	*/
+	template <typename EV>
+	bool post(EV&& e)
+	{
+		bool queued;
+		{
+			std::lock_guard<std::mutex> lock(_guard);
+			queued = _mailbox.push(std::forward<EV>(e));
+		}
+
+		if (queued && !_scheduled.exchange(true, std::memory_order_acq_rel))
+		{
+			_executor.schedule(*this);
+		}
+
+		return queued;
+	}
+
+	/**
+	* @return The state machine (only safe to use from its own handlers or
+	*         while the executor is idle)
+	*/
+	SM& machine() { return _sm; }
+	const SM& machine() const { return _sm; }
+
+	/**
+	* @return Statistics of the mailbox
+	*/
+	QueueStats stats() const
+	{
+		std::lock_guard<std::mutex> lock(_guard);
+		return _mailbox.stats();
+	}
+
+private:
+	static bool _run(detail::Task& task, std::size_t budget)
+	{
+		auto& self = static_cast<ActiveObject&>(task);
+		typename Mailbox::Envelope e;
+
+		bool drained = false;
+
+		for (std::size_t i = 0; i < budget && !drained; ++i)
+		{
+			{
+				std::lock_guard<std::mutex> lock(self._guard);
+				drained = !self._mailbox.pop(e);
+			}
+
+			if (!drained)
+			{
+				self._sm.dispatch(std::move(*e));
+			}
+		}
+
+		if (!drained)
+		{
+			//Out of budget before the mailbox ran empty
+			return true;
+		}
+
+		//An event posted from here on schedules the object again...
+		self._scheduled.store(false, std::memory_order_seq_cst);
+
+		//...unless it was posted before the flag was cleared
+		return !self._empty() && !self._scheduled.exchange(true, std::memory_order_acq_rel);
+	}
+
+	bool _empty() const
+	{
+		std::lock_guard<std::mutex> lock(_guard);
+		return _mailbox.empty();
+	}
+
+private:
+	EXECUTOR& _executor;
+	SM _sm;
+	mutable std::mutex _guard;
+	Mailbox _mailbox;
+	std::atomic<bool> _scheduled{false};
+};
+
+} //namespace pw::hsm
+
+#endif //INCLUDE_PW_HSM_EXECUTOR_HPP_
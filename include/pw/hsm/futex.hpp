@@ -0,0 +1,108 @@
+#ifndef INCLUDE_PW_HSM_FUTEX_HPP_
+#define INCLUDE_PW_HSM_FUTEX_HPP_
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+//==============================================================================
+
+namespace pw::hsm::detail
+{
+
+static_assert(std::atomic<std::uint32_t>::is_always_lock_free, "Futex words must be lock-free");
+
+/**
+* @brief Whether futex_wait() really sleeps (otherwise it only yields)
+*/
+#if defined(__linux__)
+inline constexpr bool kHasFutex = true;
+#else
+inline constexpr bool kHasFutex = false;
+#endif
+
+/**
+* @brief Sleep while word equals expected (or until woken spuriously, e.g.,
+*        by a signal)
+*
+* Where futexes are not available, this just yields the CPU.
+*/
+inline void futex_wait(std::atomic<std::uint32_t>& word, std::uint32_t expected)
+{
+#if defined(__linux__)
+	syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAIT_PRIVATE, expected, nullptr, nullptr, 0);
+#else
+	(void)word;
+	(void)expected;
+	std::this_thread::yield();
+#endif
+}
+
+/**
+* @brief Sleep while word equals expected, for timeout at most
+*
+* @retval false if the timeout expired
+*/
+inline bool futex_wait_for(std::atomic<std::uint32_t>& word, std::uint32_t expected, std::chrono::nanoseconds timeout)
+{
+#if defined(__linux__)
+	timespec ts{};
+	ts.tv_sec = time_t(timeout.count() / 1000000000);
+	ts.tv_nsec = long(timeout.count() % 1000000000);
+
+	if (syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAIT_PRIVATE, expected, &ts, nullptr, 0) == 0)
+	{
+		return true;
+	}
+
+	return errno != ETIMEDOUT;
+#else
+	(void)timeout;
+	futex_wait(word, expected);
+	return true;
+#endif
+}
+
+/**
+* @brief Hint to the CPU that the caller is spinning
+*/
+inline void cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+	_mm_pause();
+#elif defined(__aarch64__)
+	asm volatile("yield" ::: "memory");
+#endif
+}
+
+/**
+* @brief Wake the threads sleeping on word in futex_wait()
+*
+* This only makes a system call, so it may be used in a signal handler.
+*/
+inline void futex_wake(std::atomic<std::uint32_t>& word)
+{
+#if defined(__linux__)
+	syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAKE_PRIVATE, std::numeric_limits<int>::max(), nullptr, nullptr, 0);
+#else
+	(void)word;
+#endif
+}
+
+} //namespace pw::hsm::detail
+
+#endif //INCLUDE_PW_HSM_FUTEX_HPP_
@@ -0,0 +1,708 @@
+#ifndef INCLUDE_PW_HSM_KERNEL_HPP_
+#define INCLUDE_PW_HSM_KERNEL_HPP_
+
+#include <pw/hsm.hpp>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+//==============================================================================
+
+namespace pw::hsm
+{
+
+/**
+* @brief Compile-time configuration of a Kernel
+*
+* To change a setting, inherit from KernelConfig, redeclare the setting and
+* pass the new type as the CONFIG argument of Kernel.
+*/
+struct KernelConfig
+{
+	/**
+	* @brief Clock used to measure response times
+	*/
+	using Clock = std::chrono::steady_clock;
+};
+
+/**
+* @brief Response times of one priority level of a Kernel
+*
+* The response time of an event is the time from when it was posted until
+* the RTC step which handled it completed.
+*/
+struct ResponseStats
+{
+	/**
+	* @brief Number of events handled
+	*/
+	std::size_t count;
+
+	/**
+	* @brief Longest response time
+	*/
+	std::chrono::nanoseconds worst;
+
+	/**
+	* @brief Sum of all response times (divide by count for the mean)
+	*/
+	std::chrono::nanoseconds total;
+};
+
+} //namespace pw::hsm
+
+//==============================================================================
+
+namespace pw::hsm::detail
+{
+
+/**
+* @brief Bounded FIFO of events, each stamped with the time it was posted
+*
+* Any thread may push; only the thread running the owning machine pops.
+*/
+template <typename HANDLER, std::size_t CAPACITY, typename TIMEPOINT>
+class TimedMailbox
+{
+	using Event = AbstractEvent<HANDLER>;
+	using Events = handler_events_t<HANDLER>;
+
+	struct Ops
+	{
+		void (*destroy)(void* p);
+		Event* (*relocate)(void* dst, void* src);
+	};
+
+	struct Slot
+	{
+		alignas(storage_for<Events>::align)
+		unsigned char storage[storage_for<Events>::size];
+		const Ops* ops;
+		TIMEPOINT posted;
+	};
+
+public:
+	/**
+	* @brief Holds the event popped last so that it can be dispatched without
+	*        holding the mailbox's lock
+	*/
+	class Envelope
+	{
+		friend class TimedMailbox;
+
+	public:
+		Envelope() = default;
+		Envelope(const Envelope&) = delete;
+		Envelope& operator=(const Envelope&) = delete;
+
+		~Envelope()
+		{
+			reset();
+		}
+
+		Event& operator*() { return *_event; }
+		const Event& operator*() const { return *_event; }
+		TIMEPOINT posted() const { return _posted; }
+
+		void reset()
+		{
+			if (_event)
+			{
+				_ops->destroy(_storage);
+				_event = nullptr;
+			}
+		}
+
+	private:
+		alignas(storage_for<Events>::align)
+		unsigned char _storage[storage_for<Events>::size];
+		Event* _event = nullptr;
+		const Ops* _ops = nullptr;
+		TIMEPOINT _posted;
+	};
+
+public:
+	TimedMailbox() = default;
+	TimedMailbox(const TimedMailbox&) = delete;
+	TimedMailbox& operator=(const TimedMailbox&) = delete;
+
+	~TimedMailbox()
+	{
+		for (; _head != _tail; ++_head)
+		{
+			Slot& slot = _slots[_head % CAPACITY];
+			slot.ops->destroy(slot.storage);
+		}
+	}
+
+	/**
+	* @brief Copy event e (or move it, if it is an rvalue) into the mailbox
+	*
+	* @retval false if the mailbox was full (an rvalue is not moved from)
+	*/
+	template <typename EV>
+	bool push(EV&& e, TIMEPOINT posted)
+	{
+		using E = std::decay_t<EV>;
+
+		std::lock_guard<std::mutex> lock(_guard);
+
+		if (_tail - _head == CAPACITY)
+		{
+			return false;
+		}
+
+		Slot& slot = _slots[_tail % CAPACITY];
+		::new (slot.storage) E(std::forward<EV>(e));
+		slot.ops = &kOps<E>;
+		slot.posted = posted;
+		++_tail;
+		return true;
+	}
+
+	/**
+	* @brief Move the oldest event into out
+	*
+	* @retval false if the mailbox was empty
+	*/
+	bool pop(Envelope& out)
+	{
+		out.reset();
+
+		std::lock_guard<std::mutex> lock(_guard);
+
+		if (_head == _tail)
+		{
+			return false;
+		}
+
+		Slot& slot = _slots[_head % CAPACITY];
+		out._event = slot.ops->relocate(out._storage, slot.storage);
+		out._ops = slot.ops;
+		out._posted = slot.posted;
+		++_head;
+		return true;
+	}
+
+	bool empty() const
+	{
+		std::lock_guard<std::mutex> lock(_guard);
+		return _head == _tail;
+	}
+
+private:
+	template <typename E>
+	static void _destroy(void* p)
+	{
+		static_cast<E*>(p)->~E();
+	}
+
+	template <typename E>
+	static Event* _relocate(void* dst, void* src)
+	{
+		E* e = static_cast<E*>(src);
+		Event* moved = ::new (dst) E(std::move(*e));
+		e->~E();
+		return moved;
+	}
+
+	template <typename E>
+	inline static constexpr Ops kOps = {&_destroy<E>, &_relocate<E>};
+
+private:
+	mutable std::mutex _guard;
+	std::size_t _head = 0;
+	std::size_t _tail = 0;
+	Slot _slots[CAPACITY];
+};
+
+/**
+* @brief A machine as seen by the Kernel
+*/
+struct KernelObject
+{
+	/**
+	* @brief Run one RTC step, i.e., dispatch the oldest event in the mailbox
+	*
+	* @return The event's response time, or a negative duration if the
+	*         mailbox was empty
+	*/
+	std::chrono::nanoseconds (*step)(KernelObject& o) = nullptr;
+
+	/**
+	* @return Whether the mailbox is empty
+	*/
+	bool (*idle)(const KernelObject& o) = nullptr;
+
+	unsigned priority = 0;
+
+	//Used when the kernel runs each object on its own thread
+	std::mutex guard;
+	std::condition_variable wakeup;
+	bool signalled = false;
+};
+
+} //namespace pw::hsm::detail
+
+//==============================================================================
+
+namespace pw::hsm
+{
+
+/**
+* @brief Preemptive, priority-based run-to-completion kernel for a set of
+*        machines (see @ref PriorityObject)
+*
+* Every machine has a unique, static priority from 1 (lowest) to kLevels - 1.
+* The kernel runs in one of two modes:
+*
+* - run(): a single-threaded kernel in the style of QK. The highest-priority
+*   machine with a pending event always runs next. When a handler posts to a
+*   machine of higher priority than the one running, the higher-priority
+*   machine's RTC steps run straight away, nested inside post(), before the
+*   handler continues. Events posted from other threads (e.g., from an
+*   interrupt-like I/O thread) preempt at the next RTC-step boundary.
+* - start_threads(): every machine runs on its own thread with a real-time
+*   (SCHED_FIFO) priority which matches its own, so the operating system
+*   preempts lower-priority machines even in the middle of an RTC step.
+*
+* Either way, the kernel records the worst and mean response time of each
+* priority level.
+*
+* @tparam CONFIG Compile-time configuration (see @ref KernelConfig)
+*/
+template <typename CONFIG = KernelConfig>
+class Kernel
+{
+	template <typename SM, std::size_t CAPACITY, typename KERNEL>
+	friend class PriorityObject;
+
+public:
+	using Clock = typename CONFIG::Clock;
+	using TimePoint = typename Clock::time_point;
+
+	/**
+	* @brief Number of priority levels (priority 0 is the idle level)
+	*/
+	static constexpr unsigned kLevels = 32;
+
+public:
+	Kernel() = default;
+	Kernel(const Kernel&) = delete;
+	Kernel& operator=(const Kernel&) = delete;
+
+	~Kernel()
+	{
+		stop();
+	}
+
+	/**
+	* @brief Run the machines on the calling thread until stop() is called
+	*/
+	void run()
+	{
+		_thread.store(std::this_thread::get_id(), std::memory_order_relaxed);
+
+		while (!_stop.load(std::memory_order_relaxed))
+		{
+			_schedule();
+			_park();
+		}
+
+		_thread.store(std::thread::id(), std::memory_order_relaxed);
+	}
+
+	/**
+	* @brief Start one thread per machine, each with a real-time priority
+	*        matching the machine's
+	*
+	* @retval false if real-time priorities could not be set (e.g., for lack
+	*         of privileges); the threads then run with the default policy
+	*/
+	bool start_threads()
+	{
+		bool realtime = true;
+		_threaded.store(true, std::memory_order_release);
+
+		//Highest first: a busy real-time thread may starve the caller on a single CPU
+		for (unsigned p = kLevels - 1; p > 0; --p)
+		{
+			if (_objects[p])
+			{
+				_threads[p] = std::thread([this, p]() { _serve(*_objects[p]); });
+				realtime = _setPriority(_threads[p], p) && realtime;
+			}
+		}
+
+		return realtime;
+	}
+
+	/**
+	* @brief Make run() return and stop the machines' threads (from any
+	*        thread)
+	*
+	* In threaded mode, this also joins the machines' threads (except the
+	* calling one), so that the machines may be destroyed afterwards.
+	*/
+	void stop()
+	{
+		_stop.store(true, std::memory_order_relaxed);
+
+		{
+			std::lock_guard<std::mutex> lock(_guard);
+			_signalled = true;
+		}
+		_wakeup.notify_all();
+
+		for (unsigned p = 1; p < kLevels; ++p)
+		{
+			if (_objects[p])
+			{
+				_signal(*_objects[p]);
+			}
+		}
+
+		_join();
+	}
+
+	/**
+	* @return Response times of the machine with priority
+	*/
+	ResponseStats response(unsigned priority) const
+	{
+		const Level& level = _levels[priority];
+		return {
+			level.count.load(std::memory_order_relaxed),
+			std::chrono::nanoseconds(level.worst.load(std::memory_order_relaxed)),
+			std::chrono::nanoseconds(level.total.load(std::memory_order_relaxed))
+		};
+	}
+
+private:
+	struct Level
+	{
+		std::atomic<std::size_t> count{0};
+		std::atomic<std::int64_t> worst{0};
+		std::atomic<std::int64_t> total{0};
+	};
+
+	/**
+	* @retval false if priority is out of range or already taken
+	*/
+	bool _attach(detail::KernelObject& o)
+	{
+		if (o.priority == 0 || o.priority >= kLevels || _objects[o.priority])
+		{
+			return false;
+		}
+
+		_objects[o.priority] = &o;
+		return true;
+	}
+
+	void _detach(detail::KernelObject& o)
+	{
+		if (_objects[o.priority] == &o)
+		{
+			_objects[o.priority] = nullptr;
+		}
+	}
+
+	/**
+	* @brief Called after an event has been posted to o
+	*/
+	void _post(detail::KernelObject& o)
+	{
+		if (_threaded.load(std::memory_order_acquire))
+		{
+			_signal(o);
+			return;
+		}
+
+		_ready.fetch_or(std::uint32_t(1) << o.priority, std::memory_order_acq_rel);
+
+		if (_thread.load(std::memory_order_relaxed) == std::this_thread::get_id())
+		{
+			//Synchronous preemption
+			if (o.priority > _current)
+			{
+				_schedule();
+			}
+			return;
+		}
+
+		//Pairs with the fence in _park() so that either the kernel sees the event or we see it sleeping
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (_sleeping.load(std::memory_order_relaxed))
+		{
+			{
+				std::lock_guard<std::mutex> lock(_guard);
+				_signalled = true;
+			}
+			_wakeup.notify_one();
+		}
+	}
+
+	/**
+	* @brief Run RTC steps of machines of higher priority than the one
+	*        running until none has an event left
+	*/
+	void _schedule()
+	{
+		const unsigned preempted = _current;
+		const std::uint32_t above = ~((std::uint32_t(2) << preempted) - 1);
+
+		while (!_stop.load(std::memory_order_relaxed))
+		{
+			const std::uint32_t ready = _ready.load(std::memory_order_acquire) & above;
+			if (ready == 0)
+			{
+				break;
+			}
+
+			const unsigned p = detail::highest_bit(ready);
+			detail::KernelObject& o = *_objects[p];
+
+			_current = p;
+			_record(p, o.step(o));
+
+			if (o.idle(o))
+			{
+				const std::uint32_t bit = std::uint32_t(1) << p;
+				_ready.fetch_and(~bit, std::memory_order_acq_rel);
+
+				//An event posted just before the bit was cleared
+				if (!o.idle(o))
+				{
+					_ready.fetch_or(bit, std::memory_order_acq_rel);
+				}
+			}
+		}
+
+		_current = preempted;
+	}
+
+	void _park()
+	{
+		std::unique_lock<std::mutex> lock(_guard);
+
+		_sleeping.store(true, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		if (_ready.load(std::memory_order_relaxed) == 0)
+		{
+			_wakeup.wait(lock, [this]() { return _signalled; });
+		}
+
+		_signalled = false;
+		_sleeping.store(false, std::memory_order_relaxed);
+	}
+
+	void _signal(detail::KernelObject& o)
+	{
+		{
+			std::lock_guard<std::mutex> lock(o.guard);
+			o.signalled = true;
+		}
+		o.wakeup.notify_one();
+	}
+
+	/**
+	* @brief Thread function of object o in threaded mode
+	*/
+	void _serve(detail::KernelObject& o)
+	{
+		while (!_stop.load(std::memory_order_relaxed))
+		{
+			const auto response = o.step(o);
+			if (response.count() >= 0)
+			{
+				_record(o.priority, response);
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(o.guard);
+			o.wakeup.wait(lock, [&o]() { return o.signalled; });
+			o.signalled = false;
+		}
+	}
+
+	void _record(unsigned priority, std::chrono::nanoseconds response)
+	{
+		if (response.count() < 0)
+		{
+			return;
+		}
+
+		//Each level is only written by the one thread running its machine
+		Level& level = _levels[priority];
+		level.count.store(level.count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+		level.total.store(level.total.load(std::memory_order_relaxed) + response.count(), std::memory_order_relaxed);
+		if (response.count() > level.worst.load(std::memory_order_relaxed))
+		{
+			level.worst.store(response.count(), std::memory_order_relaxed);
+		}
+	}
+
+	static bool _setPriority(std::thread& thread, unsigned priority)
+	{
+#if defined(__linux__)
+		sched_param param{};
+		param.sched_priority = sched_get_priority_min(SCHED_FIFO) + int(priority);
+		return pthread_setschedparam(thread.native_handle(), SCHED_FIFO, &param) == 0;
+#else
+		(void)thread;
+		(void)priority;
+		return false;
+#endif
+	}
+
+	void _join()
+	{
+		for (auto& thread : _threads)
+		{
+			if (thread.joinable() && thread.get_id() != std::this_thread::get_id())
+			{
+				thread.join();
+			}
+		}
+	}
+
+private:
+	detail::KernelObject* _objects[kLevels] = {};
+	Level _levels[kLevels];
+
+	//Bit p is set while the machine with priority p has events
+	std::atomic<std::uint32_t> _ready{0};
+
+	//Priority of the machine whose RTC step is running on the kernel thread
+	unsigned _current = 0;
+
+	std::atomic<std::thread::id> _thread{};
+	std::atomic<bool> _stop{false};
+	std::atomic<bool> _sleeping{false};
+	std::mutex _guard;
+	std::condition_variable _wakeup;
+	bool _signalled = false;
+
+	std::atomic<bool> _threaded{false};
+	std::thread _threads[kLevels];
+};
+
+/**
+* @brief A StateMachine with a static priority and a mailbox, run by a
+*        Kernel
+*
+* @tparam SM Typename of the state machine
+* @tparam CAPACITY Number of events the mailbox can hold
+* @tparam KERNEL Typename of the kernel
+*/
+template <typename SM, std::size_t CAPACITY = 32, typename KERNEL = Kernel<>>
+class PriorityObject : private detail::KernelObject
+{
+	using Handler = typename SM::RootState::Handler;
+	using Mailbox = detail::TimedMailbox<Handler, CAPACITY, typename KERNEL::TimePoint>;
+
+public:
+	/**
+	* @brief Construct the state machine with args and attach it to kernel at
+	*        priority (from 1 to KERNEL::kLevels - 1, unique per kernel)
+	*
+	* Objects must be created before the kernel is started.
+	*/
+	template <typename ... ARGS>
+	PriorityObject(KERNEL& kernel, unsigned priority, ARGS&& ... args) :
+		_kernel(kernel),
+		_sm(std::forward<ARGS>(args)...)
+	{
+		detail::KernelObject::priority = priority;
+		this->step = &PriorityObject::_step;
+		this->idle = &PriorityObject::_idle;
+		_attached = _kernel._attach(*this);
+	}
+
+	PriorityObject(const PriorityObject&) = delete;
+	PriorityObject& operator=(const PriorityObject&) = delete;
+
+	~PriorityObject()
+	{
+		_kernel._detach(*this);
+	}
+
+	/**
+	* @return Whether the object got its priority; posts fail if it did not
+	*/
+	bool attached() const { return _attached; }
+
+	unsigned priority() const { return detail::KernelObject::priority; }
+
+	/**
+	* @brief Copy event e (or move it, if it is an rvalue) into the mailbox
+	*        (from any thread)
+	*
+	* If called from a handler of a lower-priority machine in a single-
+	* threaded kernel, this machine handles e before post() returns.
+	*
+	* @retval false if the mailbox was full or the object is not attached
+	*/
+	template <typename EV>
+	bool post(EV&& e)
+	{
+		if (!_attached || !_mailbox.push(std::forward<EV>(e), KERNEL::Clock::now()))
+		{
+			return false;
+		}
+
+		_kernel._post(*this);
+		return true;
+	}
+
+	/**
+	* @return The state machine (only safe to use from its own handlers or
+	*         while the kernel is stopped)
+	*/
+	SM& machine() { return _sm; }
+	const SM& machine() const { return _sm; }
+
+private:
+	static std::chrono::nanoseconds _step(detail::KernelObject& o)
+	{
+		auto& self = static_cast<PriorityObject&>(o);
+		typename Mailbox::Envelope e;
+
+		if (!self._mailbox.pop(e))
+		{
+			return std::chrono::nanoseconds(-1);
+		}
+
+		self._sm.dispatch(std::move(*e));
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(KERNEL::Clock::now() - e.posted());
+	}
+
+	static bool _idle(const detail::KernelObject& o)
+	{
+		return static_cast<const PriorityObject&>(o)._mailbox.empty();
+	}
+
+private:
+	KERNEL& _kernel;
+	SM _sm;
+	Mailbox _mailbox;
+	bool _attached = false;
+};
+
+} //namespace pw::hsm
+
+#endif //INCLUDE_PW_HSM_KERNEL_HPP_
@@ -0,0 +1,493 @@
+#ifndef INCLUDE_PW_HSM_LOCKING_QUEUE_HPP_
+#define INCLUDE_PW_HSM_LOCKING_QUEUE_HPP_
+
+#include <pw/hsm/queue.hpp>
+#include <pw/hsm/futex.hpp>
+#include <pw/hsm/signal_queue.hpp>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+//==============================================================================
+
+namespace pw::hsm
+{
+
+/**
+* @brief Thread-safe, bounded EventQueue for feeding a StateMachine from other
+*        threads
+*
+* Producers on any thread push events while the thread running the state
+* machine pops them. Events are moved out of the queue into an Envelope before
+* they are dispatched, so handlers may push into the same queue (e.g., to
+* dispatch an event later) without deadlocking.
+*
+* When the queue is full, CONFIG::kOverflow selects whether the producer is
+* blocked, the push is rejected, or the newest/oldest event is dropped.
+* Statistics are published to atomics after every operation so that stats()
+* may be called cheaply from any thread without taking the lock.
+*
+* Signal handlers must not push directly; they post into a @ref SignalQueue
+* attached to the queue instead, whose events are moved into this queue
+* before the next pop. On Linux, the consumer sleeps on a futex, which the
+* signal queue's post wakes without taking a lock.
+*
+* @tparam HANDLER Typename of the handler/visitor base class
+* @tparam CONFIG Compile-time configuration (see @ref QueueConfig)
+*/
+template <typename HANDLER, typename CONFIG = QueueConfig>
+class LockingEventQueue
+{
+	using Queue = EventQueue<HANDLER, CONFIG>;
+
+public:
+	using Event = typename Queue::Event;
+	using Envelope = typename Queue::Envelope;
+	using Clock = typename Queue::Clock;
+	using TimePoint = typename Queue::TimePoint;
+
+	static constexpr TimePoint kNoDeadline = Queue::kNoDeadline;
+
+public:
+	/**
+	* @brief Copy event e (or move it, if it is an rvalue) into the queue,
+	*        applying the overflow policy if the queue is full
+	*
+	* @retval false if the event was not queued
+	*/
+	template <typename EV>
+	bool push(EV&& e, TimePoint deadline = kNoDeadline)
+	{
+		bool queued;
+
+		{
+			std::unique_lock<std::mutex> lock(_guard);
+			queued = _q.push(std::forward<EV>(e), deadline);
+
+			if constexpr (CONFIG::kOverflow == Overflow::kBlock)
+			{
+				if (!queued)
+				{
+					const auto start = std::chrono::steady_clock::now();
+					++_blocked;
+
+					//A rejected event was not moved from, so it is pushed again
+					do
+					{
+						_notFull.wait(lock);
+						queued = _q.push(std::forward<EV>(e), deadline);
+					} while (!queued);
+
+					_blockedTime += std::chrono::steady_clock::now() - start;
+				}
+			}
+
+			_publish();
+		}
+
+		if (queued)
+		{
+			_notifyNotEmpty();
+		}
+
+		return queued;
+	}
+
+	/**
+	* @brief Copy event e (or move it, if it is an rvalue) into the queue
+	*        without ever waiting for room, even under Overflow::kBlock
+	*
+	* @retval false if the event was not queued (an rvalue is not moved from)
+	*/
+	template <typename EV>
+	bool try_push(EV&& e, TimePoint deadline = kNoDeadline)
+	{
+		bool queued;
+
+		{
+			std::lock_guard<std::mutex> lock(_guard);
+			queued = _q.push(std::forward<EV>(e), deadline);
+			_publish();
+		}
+
+		if (queued)
+		{
+			_notifyNotEmpty();
+		}
+
+		return queued;
+	}
+
+	/**
+	* @brief Copy (or move) event e into the queue with a deadline relative
+	*        to now
+	*/
+	template <typename EV, typename REP, typename PERIOD>
+	bool push(EV&& e, std::chrono::duration<REP, PERIOD> timeout)
+	{
+		return push(std::forward<EV>(e), Clock::now() + timeout);
+	}
+
+	/**
+	* @brief Copy event e into the queue only if a state in the active 
+	*        configuration of sm would handle (or defer) it
+	*
+	* Producers call this from threads other than the one running sm, so sm
+	* must publish its handled events (see
+	* DefaultConfig::kPublishHandledEvents) rather than have its active
+	* configuration walked while it changes.
+	*
+	* @retval false if the event was filtered out or was not queued
+	*/
+	template <typename SM, typename EV>
+	bool push_if_handled(const SM& sm, EV&& e, TimePoint deadline = kNoDeadline)
+	{
+		static_assert(SM::Config::kPublishHandledEvents, 
+			"Filtering from other threads requires the machine to publish its handled events (kPublishHandledEvents)");
+
+		if (!sm.template would_handle<std::decay_t<EV>>())
+		{
+			_stats.filtered.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+
+		return push(std::forward<EV>(e), deadline);
+	}
+
+	/**
+	* @brief Move the next event into out without waiting
+	*
+	* @retval false if the queue was empty
+	*/
+	bool try_pop(Envelope& out)
+	{
+		std::lock_guard<std::mutex> lock(_guard);
+		return _pop(out);
+	}
+
+	/**
+	* @brief Move the next event into out, waiting for one to be pushed if the
+	*        queue is empty
+	*
+	* @retval false if the wait was interrupted by wake()
+	*/
+	bool wait_and_pop(Envelope& out)
+	{
+		std::unique_lock<std::mutex> lock(_guard);
+		for (;;)
+		{
+			const std::uint32_t epoch = _epochBeforePop();
+			if (_pop(out))
+			{
+				return true;
+			}
+			
+			if (_consumeWake())
+			{
+				return false;
+			}
+			
+			_waitNotEmpty(lock, epoch, std::chrono::steady_clock::time_point::max());
+		}
+	}
+
+	/**
+	* @brief Move the next event into out, waiting at most timeout for one to
+	*        be pushed if the queue is empty
+	*
+	* @retval false if no event arrived before the timeout
+	*/
+	template <typename REP, typename PERIOD>
+	bool try_wait_and_pop(Envelope& out, std::chrono::duration<REP, PERIOD> timeout)
+	{
+		return try_wait_and_pop_until(out, std::chrono::steady_clock::now() + timeout);
+	}
+
+	/**
+	* @brief Move the next event into out, waiting until time until at the
+	*        latest for one to be pushed if the queue is empty
+	*
+	* If until is the maximum time point of its clock, this waits without a
+	* timeout.
+	*
+	* @retval false if no event arrived before until or the wait was 
+	*         interrupted by wake()
+	*/
+	template <typename CLOCK, typename DURATION>
+	bool try_wait_and_pop_until(Envelope& out, std::chrono::time_point<CLOCK, DURATION> until)
+	{
+		std::unique_lock<std::mutex> lock(_guard);
+		for (;;)
+		{
+			const std::uint32_t epoch = _epochBeforePop();
+			if (_pop(out))
+			{
+				return true;
+			}
+			
+			if (_consumeWake())
+			{
+				return false;
+			}
+			
+			if (!_waitNotEmpty(lock, epoch, until))
+			{
+				return _pop(out);
+			}
+		}
+	}
+	
+	/**
+	* @brief Make the current (or, if there is none, the next) wait for an 
+	*        event return without one
+	*
+	* This lets another thread interrupt the consumer, e.g., to stop a run
+	* loop or because the deadline it is waiting for has changed.
+	*/
+	void wake()
+	{
+		{
+			std::lock_guard<std::mutex> lock(_guard);
+			_woken = true;
+		}
+		
+		_notifyNotEmpty();
+	}
+
+	/**
+	* @brief Move the events posted into source into this queue before every
+	*        pop, and let source wake up the consumer
+	*
+	* Call this before any signal handler may post into source. Events which
+	* do not fit into this queue are handled by its overflow policy, except
+	* that Overflow::kBlock drops them (counted in QueueStats::dropped).
+	*/
+	template <std::size_t CAPACITY>
+	void attach(SignalQueue<HANDLER, CAPACITY>& source)
+	{
+		{
+			std::lock_guard<std::mutex> lock(_guard);
+			_signals = &source;
+			_drainSignals = &LockingEventQueue::_drain<SignalQueue<HANDLER, CAPACITY>>;
+		}
+
+		source.set_doorbell(&LockingEventQueue::_ring, this);
+	}
+
+	bool empty() const
+	{
+		return size() == 0;
+	}
+
+	std::size_t size() const
+	{
+		return _stats.size.load(std::memory_order_relaxed);
+	}
+
+	/**
+	* @return Statistics of the queue (wait-free; may be called from any thread)
+	*/
+	QueueStats stats() const
+	{
+		return {
+			_stats.size.load(std::memory_order_relaxed),
+			CONFIG::kCapacity,
+			_stats.highWaterMark.load(std::memory_order_relaxed),
+			_stats.dropped.load(std::memory_order_relaxed),
+			_stats.expired.load(std::memory_order_relaxed),
+			_stats.coalesced.load(std::memory_order_relaxed),
+			_stats.filtered.load(std::memory_order_relaxed),
+			_stats.blocked.load(std::memory_order_relaxed),
+			std::chrono::nanoseconds(_stats.blockedTime.load(std::memory_order_relaxed))
+		};
+	}
+
+private:
+	bool _pop(Envelope& out)
+	{
+		if (_signals)
+		{
+			_drainSignals(_signals, *this);
+		}
+
+		const bool popped = _q.pop(out);
+		_publish();
+
+		if constexpr (CONFIG::kOverflow == Overflow::kBlock)
+		{
+			if (popped)
+			{
+				_notFull.notify_one();
+			}
+		}
+
+		return popped;
+	}
+
+	template <typename SOURCE>
+	static void _drain(void* source, LockingEventQueue& self)
+	{
+		static_cast<SOURCE*>(source)->drain([&self](const auto& e) {
+			//EventQueue counts the events it rejects, except under Overflow::kBlock
+			if (!self._q.push(e) && CONFIG::kOverflow == Overflow::kBlock)
+			{
+				++self._droppedSignals;
+			}
+		});
+	}
+
+	/**
+	* @brief Doorbell of an attached SignalQueue (async-signal-safe on Linux)
+	*/
+	static void _ring(void* self)
+	{
+		if constexpr (detail::kHasFutex)
+		{
+			static_cast<LockingEventQueue*>(self)->_notifyNotEmpty();
+		}
+	}
+
+	/**
+	* @brief Wake up the consumer after the queue may have become non-empty
+	*        (must be called without _guard held)
+	*/
+	void _notifyNotEmpty()
+	{
+		if constexpr (detail::kHasFutex)
+		{
+			//Pairs with the increment of _sleepers in _waitNotEmpty()
+			_epoch.fetch_add(1, std::memory_order_seq_cst);
+			if (_sleepers.load(std::memory_order_seq_cst) != 0)
+			{
+				detail::futex_wake(_epoch);
+			}
+		}
+		else
+		{
+			_notEmpty.notify_all();
+		}
+	}
+
+	/**
+	* @return The wakeup epoch to wait on if the _pop() which follows finds
+	*         nothing (must be called with _guard held)
+	*
+	* Pushes hold _guard, but an attached SignalQueue rings the doorbell
+	* without it. The epoch is therefore read before _pop() drains the
+	* signals, so a signal posted after the drain moves the epoch on.
+	*/
+	std::uint32_t _epochBeforePop() const
+	{
+		return _epoch.load(std::memory_order_acquire);
+	}
+
+	/**
+	* @brief Wait until _notifyNotEmpty() is called after epoch was read (see
+	*        _epochBeforePop()) or until passes (must be called with _guard
+	*        held through lock)
+	*
+	* A maximum until waits without a timeout. This may return early, e.g.,
+	* when a signal is delivered to the thread.
+	*
+	* @retval false if until passed
+	*/
+	template <typename CLOCK, typename DURATION>
+	bool _waitNotEmpty(std::unique_lock<std::mutex>& lock, std::uint32_t epoch, std::chrono::time_point<CLOCK, DURATION> until)
+	{
+		using TP = std::chrono::time_point<CLOCK, DURATION>;
+
+		if constexpr (detail::kHasFutex)
+		{
+			_sleepers.fetch_add(1, std::memory_order_seq_cst);
+			lock.unlock();
+
+			bool notified = true;
+			if (until == TP::max())
+			{
+				detail::futex_wait(_epoch, epoch);
+			}
+			else
+			{
+				const auto left = std::chrono::duration_cast<std::chrono::nanoseconds>(until - CLOCK::now());
+				notified = left.count() > 0 && detail::futex_wait_for(_epoch, epoch, left);
+			}
+
+			_sleepers.fetch_sub(1, std::memory_order_relaxed);
+			lock.lock();
+			return notified;
+		}
+		else if (until == TP::max())
+		{
+			_notEmpty.wait(lock);
+			return true;
+		}
+		else
+		{
+			return _notEmpty.wait_until(lock, until) != std::cv_status::timeout;
+		}
+	}
+
+	/**
+	* @brief Clear a pending wake() (must be called with _guard held)
+	*
+	* @retval true if there was one
+	*/
+	bool _consumeWake()
+	{
+		const bool woken = _woken;
+		_woken = false;
+		return woken;
+	}
+
+	/**
+	* @brief Copy the queue's statistics into the atomics read by stats()
+	*        (must be called with _guard held)
+	*/
+	void _publish()
+	{
+		const QueueStats s = _q.stats();
+		_stats.size.store(s.size, std::memory_order_relaxed);
+		_stats.highWaterMark.store(s.highWaterMark, std::memory_order_relaxed);
+		_stats.dropped.store(s.dropped + _droppedSignals, std::memory_order_relaxed);
+		_stats.expired.store(s.expired, std::memory_order_relaxed);
+		_stats.coalesced.store(s.coalesced, std::memory_order_relaxed);
+		_stats.blocked.store(_blocked, std::memory_order_relaxed);
+		_stats.blockedTime.store(_blockedTime.count(), std::memory_order_relaxed);
+	}
+
+private:
+	struct AtomicStats
+	{
+		std::atomic<std::size_t> size{0};
+		std::atomic<std::size_t> highWaterMark{0};
+		std::atomic<std::size_t> dropped{0};
+		std::atomic<std::size_t> expired{0};
+		std::atomic<std::size_t> coalesced{0};
+		std::atomic<std::size_t> filtered{0};
+		std::atomic<std::size_t> blocked{0};
+		std::atomic<std::chrono::nanoseconds::rep> blockedTime{0};
+	};
+
+	Queue _q;
+	mutable std::mutex _guard;
+	std::condition_variable _notEmpty;
+	std::condition_variable _notFull;
+	std::size_t _blocked = 0;
+	std::chrono::nanoseconds _blockedTime{0};
+	std::size_t _droppedSignals = 0;
+	bool _woken = false;
+	AtomicStats _stats;
+
+	//Consumer wakeups where futexes are available (see _waitNotEmpty())
+	std::atomic<std::uint32_t> _epoch{0};
+	std::atomic<std::uint32_t> _sleepers{0};
+
+	void* _signals = nullptr;
+	void (*_drainSignals)(void* source, LockingEventQueue& self) = nullptr;
+};
+
+} //namespace pw::hsm
+
+#endif //INCLUDE_PW_HSM_LOCKING_QUEUE_HPP_
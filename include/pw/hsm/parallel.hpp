@@ -0,0 +1,285 @@
+#ifndef INCLUDE_PW_HSM_PARALLEL_HPP_
+#define INCLUDE_PW_HSM_PARALLEL_HPP_
+
+#include <pw/hsm/futex.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+
+//==============================================================================
+
+namespace pw::hsm
+{
+
+/**
+* @brief Compile-time configuration of a RegionPool
+*
+* To change a setting, inherit from RegionPoolConfig, redeclare the setting
+* and pass the new type as the CONFIG argument of RegionPool.
+*/
+struct RegionPoolConfig
+{
+	/**
+	* @brief Number of times an idle worker (or the dispatching thread waiting
+	*        for the workers) checks for news before it sleeps on a futex
+	*
+	* Spinning keeps the fork and join of back-to-back events cheap, but
+	* burns the CPU in between.
+	*/
+	static constexpr std::size_t kSpins = 4096;
+};
+
+/**
+* @brief Statistics of a RegionPool
+*/
+struct RegionPoolStats
+{
+	/**
+	* @brief Number of fork_join() calls
+	*/
+	std::size_t forks;
+
+	/**
+	* @brief Number of tasks run by the workers (the rest were run by the
+	*        threads which called fork_join())
+	*/
+	std::size_t stolen;
+
+	/**
+	* @brief Number of times a worker went to sleep for lack of work
+	*/
+	std::size_t parks;
+};
+
+/**
+* @brief Fixed pool of worker threads which runs the independent regions of
+*        orthogonal states in parallel (see @ref Independent)
+*
+* A machine with independent regions provides the pool through a member
+* function region_pool(). For every event, the dispatching thread forks one
+* task per independent region, runs tasks itself along with the workers and
+* returns once all of them have finished, so the RTC step of the event still
+* ends after every region has processed it.
+*
+* Forks are serialized, so one pool may be shared by machines running on
+* different threads.
+*
+* @tparam CONFIG Compile-time configuration (see @ref RegionPoolConfig)
+*/
+template <typename CONFIG = RegionPoolConfig>
+class RegionPool
+{
+public:
+	/**
+	* @brief Start the worker threads
+	*
+	* @param workers Number of workers; the thread calling fork_join() runs
+	*        tasks too, so by default there is one worker per remaining CPU
+	*        (none if the number of CPUs is not known)
+	*/
+	explicit RegionPool(std::size_t workers = std::max(1u, std::thread::hardware_concurrency()) - 1) :
+		_size(workers),
+		_threads(new std::thread[workers])
+	{
+		for (std::size_t i = 0; i < _size; ++i)
+		{
+			_threads[i] = std::thread([this]() { _work(); });
+		}
+	}
+
+	RegionPool(const RegionPool&) = delete;
+	RegionPool& operator=(const RegionPool&) = delete;
+
+	~RegionPool()
+	{
+		_stop.store(true, std::memory_order_relaxed);
+		_epoch.fetch_add(1, std::memory_order_seq_cst);
+		detail::futex_wake(_epoch);
+
+		for (std::size_t i = 0; i < _size; ++i)
+		{
+			_threads[i].join();
+		}
+	}
+
+	/**
+	* @return Number of worker threads
+	*/
+	std::size_t size() const { return _size; }
+
+	RegionPoolStats stats() const
+	{
+		return RegionPoolStats{
+			_forks.load(std::memory_order_relaxed),
+			_stolen.load(std::memory_order_relaxed),
+			_parks.load(std::memory_order_relaxed)
+		};
+	}
+
+	/**
+	* @brief Call f(i) for every i in [0, n) on the workers and the calling
+	*        thread, and return once all calls have returned
+	*/
+	template <typename F>
+	void fork_join(std::size_t n, F&& f)
+	{
+		using Fn = std::remove_reference_t<F>;
+
+		if (n == 0)
+		{
+			return;
+		}
+
+		std::lock_guard<std::mutex> lock(_guard);
+		_forks.fetch_add(1, std::memory_order_relaxed);
+
+		_run = [](void* fn, std::size_t i) { (*static_cast<Fn*>(fn))(i); };
+		_fn = const_cast<void*>(static_cast<const void*>(&f));
+		_pending.store(std::uint32_t(n), std::memory_order_relaxed);
+
+		//Opens the fork to workers which look for tasks, even before they see the new epoch
+		_claim.store(std::uint64_t(n) << 32, std::memory_order_release);
+
+		_epoch.fetch_add(1, std::memory_order_seq_cst);
+		if (_sleepers.load(std::memory_order_seq_cst) > 0)
+		{
+			detail::futex_wake(_epoch);
+		}
+
+		_runTasks(false);
+		_join();
+	}
+
+private:
+	/**
+	* @brief Claim and run tasks of the current fork until none are left
+	*
+	* A task is claimed by incrementing the index in _claim, which also holds
+	* the fork's number of tasks. Both are checked in one snapshot, so a
+	* thread which looked at a finished fork cannot claim a task: either the
+	* snapshot has no tasks left, or it no longer matches _claim, or it
+	* matches the current fork (whose task is then claimed legitimately).
+	*/
+	void _runTasks(bool worker)
+	{
+		std::uint64_t claim = _claim.load(std::memory_order_acquire);
+
+		for (;;)
+		{
+			const std::size_t i = std::size_t(claim & 0xffffffffu);
+			if (i >= std::size_t(claim >> 32))
+			{
+				return;
+			}
+
+			if (!_claim.compare_exchange_weak(claim, claim + 1, std::memory_order_acq_rel, std::memory_order_acquire))
+			{
+				continue;
+			}
+
+			_run(_fn, i);
+
+			if (worker)
+			{
+				_stolen.fetch_add(1, std::memory_order_relaxed);
+			}
+
+			if (_pending.fetch_sub(1, std::memory_order_seq_cst) == 1 && _joining.load(std::memory_order_seq_cst))
+			{
+				detail::futex_wake(_pending);
+			}
+
+			claim = _claim.load(std::memory_order_acquire);
+		}
+	}
+
+	/**
+	* @brief Wait for the tasks which workers are still running
+	*/
+	void _join()
+	{
+		for (std::size_t spins = 0; _pending.load(std::memory_order_acquire) != 0; ++spins)
+		{
+			if (spins < CONFIG::kSpins)
+			{
+				detail::cpu_relax();
+				continue;
+			}
+
+			_joining.store(true, std::memory_order_seq_cst);
+			const std::uint32_t pending = _pending.load(std::memory_order_seq_cst);
+			if (pending != 0)
+			{
+				detail::futex_wait(_pending, pending);
+			}
+			_joining.store(false, std::memory_order_relaxed);
+		}
+	}
+
+	void _work()
+	{
+		std::uint32_t seen = _epoch.load(std::memory_order_acquire);
+
+		while (!_stop.load(std::memory_order_relaxed))
+		{
+			std::uint32_t epoch = _epoch.load(std::memory_order_acquire);
+
+			for (std::size_t spins = 0; epoch == seen; ++spins)
+			{
+				if (spins < CONFIG::kSpins)
+				{
+					detail::cpu_relax();
+				}
+				else
+				{
+					_sleepers.fetch_add(1, std::memory_order_seq_cst);
+					if (_epoch.load(std::memory_order_seq_cst) == seen)
+					{
+						_parks.fetch_add(1, std::memory_order_relaxed);
+						detail::futex_wait(_epoch, seen);
+					}
+					_sleepers.fetch_sub(1, std::memory_order_relaxed);
+					spins = 0;
+				}
+
+				epoch = _epoch.load(std::memory_order_acquire);
+			}
+
+			seen = epoch;
+			_runTasks(true);
+		}
+	}
+
+private:
+	const std::size_t _size;
+	std::unique_ptr<std::thread[]> _threads;
+	std::mutex _guard;
+
+	//Current fork (written by the forking thread before it opens the fork)
+	void (*_run)(void* fn, std::size_t i) = nullptr;
+	void* _fn = nullptr;
+
+	/*
+	* Number of tasks of the current fork (upper half) and index of the next
+	* task to claim (lower half)
+	*/
+	alignas(64) std::atomic<std::uint64_t> _claim{0};
+	alignas(64) std::atomic<std::uint32_t> _pending{0};
+	std::atomic<bool> _joining{false};
+	alignas(64) std::atomic<std::uint32_t> _epoch{0};
+	std::atomic<std::uint32_t> _sleepers{0};
+	std::atomic<bool> _stop{false};
+
+	std::atomic<std::size_t> _forks{0};
+	std::atomic<std::size_t> _stolen{0};
+	std::atomic<std::size_t> _parks{0};
+};
+
+} //namespace pw::hsm
+
+#endif //INCLUDE_PW_HSM_PARALLEL_HPP_
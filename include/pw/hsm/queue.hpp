@@ -0,0 +1,565 @@
+#ifndef INCLUDE_PW_HSM_QUEUE_HPP_
+#define INCLUDE_PW_HSM_QUEUE_HPP_
+
+#include <pw/hsm.hpp>
+#include <chrono>
+#include <cstdint>
+#include <new>
+#include <utility>
+
+//==============================================================================
+
+namespace pw::hsm
+{
+
+/**
+* @brief What an event queue does with an event pushed while it is full
+*/
+enum class Overflow
+{
+	/**
+	* @brief The event is not queued and push returns false
+	*/
+	kReject,
+
+	/**
+	* @brief The event is silently discarded (push returns false)
+	*/
+	kDropNewest,
+
+	/**
+	* @brief The oldest event of the lowest non-empty priority lane is 
+	*        discarded to make room for the event
+	*/
+	kDropOldest,
+
+	/**
+	* @brief The producer waits until there is room for the event (only
+	*        supported by LockingEventQueue; EventQueue returns false without
+	*        counting a drop)
+	*/
+	kBlock
+};
+
+/**
+* @brief Compile-time configuration of an EventQueue
+*
+* To change a setting, inherit from QueueConfig, redeclare the setting and
+* pass the new type as the CONFIG argument of EventQueue.
+*/
+struct QueueConfig
+{
+	/**
+	* @brief Maximum number of events queued across all lanes
+	*/
+	static constexpr std::size_t kCapacity = 32;
+
+	/**
+	* @brief Number of priority lanes (at most 32)
+	*
+	* An event is queued in the lane given by its kPriority constant (see
+	* pw::hsm::Event). Higher lanes are always dequeued first.
+	*/
+	static constexpr std::size_t kLanes = 1;
+
+	/**
+	* @brief Policy applied when an event is pushed into a full queue
+	*/
+	static constexpr Overflow kOverflow = Overflow::kReject;
+
+	/**
+	* @brief Clock used to evaluate event deadlines
+	*/
+	using Clock = std::chrono::steady_clock;
+};
+
+/**
+* @brief Statistics of an EventQueue
+*/
+struct QueueStats
+{
+	std::size_t size;
+	std::size_t capacity;
+	std::size_t highWaterMark;
+	std::size_t dropped;
+	std::size_t expired;
+	std::size_t coalesced;
+	std::size_t filtered;
+	std::size_t blocked;
+	std::chrono::nanoseconds blockedTime;
+};
+
+/**
+* @brief Fixed-capacity queue of events stored in place (no dynamic memory)
+*
+* Events are copied (or moved, if pushed as rvalues) into slots large enough
+* for any event of HANDLER, so all of HANDLER's events must be complete types
+* where the queue is declared. Events which can only be moved may be queued.
+* Each priority lane is a FIFO; a bitmap of non-empty lanes lets both push and
+* pop run in O(1). An event may be given a deadline when it is pushed. Events
+* whose deadline has passed by the time they reach the front of the queue are
+* dropped and counted rather than dispatched.
+*
+* At most one instance of an event whose kCoalesce constant is not
+* Coalesce::kNone is pending at any time. Pushing another instance replaces
+* or merges into the pending one in place, so it keeps its position in the
+* queue and the push never fails for lack of capacity.
+*
+* When the queue is full, the CONFIG::kOverflow policy decides whether the new
+* event or the oldest one is discarded. Discarded events are counted in
+* QueueStats::dropped.
+*
+* This queue is not thread-safe.
+*
+* @tparam HANDLER Typename of the handler/visitor base class
+* @tparam CONFIG Compile-time configuration (see @ref QueueConfig)
+*/
+template <typename HANDLER, typename CONFIG = QueueConfig>
+class EventQueue
+{
+	using Events = detail::handler_events_t<HANDLER>;
+	using Index = std::uint32_t;
+
+	static constexpr std::size_t kCapacity = CONFIG::kCapacity;
+	static constexpr std::size_t kLanes = CONFIG::kLanes;
+	static constexpr Overflow kOverflow = CONFIG::kOverflow;
+	static constexpr Index kNone = ~Index(0);
+
+	static_assert(kCapacity > 0, "kCapacity must be greater than 0");
+	static_assert(kLanes > 0 && kLanes <= 32, "kLanes must be in [1, 32]");
+
+public:
+	using Event = AbstractEvent<HANDLER>;
+	using Clock = typename CONFIG::Clock;
+	using TimePoint = typename Clock::time_point;
+
+	/**
+	* @brief Deadline of events which never expire
+	*/
+	static constexpr TimePoint kNoDeadline = TimePoint::max();
+
+private:
+	/**
+	* @brief Type-erased operations on an event stored in a slot
+	*/
+	struct Ops
+	{
+		void (*destroy)(void* p);
+		Event* (*relocate)(void* dst, void* src);
+	};
+
+public:
+	/**
+	* @brief Holds a single event removed from the queue so that it can be
+	*        dispatched after the queue has been released (e.g., unlocked)
+	*/
+	class Envelope
+	{
+		friend class EventQueue;
+
+	public:
+		Envelope() = default;
+		Envelope(const Envelope&) = delete;
+		Envelope& operator=(const Envelope&) = delete;
+
+		~Envelope()
+		{
+			reset();
+		}
+
+		explicit operator bool() const { return _event != nullptr; }
+		const Event& operator*() const { return *_event; }
+		const Event* operator->() const { return _event; }
+		
+		/**
+		* @brief The held event, which may be moved from (e.g., dispatched
+		*        with sm.dispatch(std::move(*e)))
+		*/
+		Event& operator*() { return *_event; }
+
+		/**
+		* @brief Destroy the held event (if any)
+		*/
+		void reset()
+		{
+			if (_event)
+			{
+				_ops->destroy(_storage);
+				_event = nullptr;
+			}
+		}
+
+	private:
+		alignas(detail::storage_for<Events>::align)
+		unsigned char _storage[detail::storage_for<Events>::size];
+		Event* _event = nullptr;
+		const Ops* _ops = nullptr;
+	};
+
+public:
+	EventQueue()
+	{
+		for (Index i = 0; i < kCapacity; ++i)
+		{
+			_slots[i].next = i + 1 < kCapacity ? i + 1 : kNone;
+		}
+
+		for (auto& lane : _lanes)
+		{
+			lane.head = kNone;
+			lane.tail = kNone;
+		}
+
+		for (auto& pending : _pending)
+		{
+			pending = kNone;
+		}
+	}
+
+	EventQueue(const EventQueue&) = delete;
+	EventQueue& operator=(const EventQueue&) = delete;
+
+	~EventQueue()
+	{
+		clear();
+	}
+
+	bool empty() const { return _nonEmpty == 0; }
+	std::size_t size() const { return _size; }
+
+	QueueStats stats() const
+	{
+		return {
+			_size, kCapacity, _highWaterMark, _dropped, _expired, _coalesced,
+			_filtered, 0, std::chrono::nanoseconds(0)
+		};
+	}
+
+	/**
+	* @brief Copy event e (or move it, if it is an rvalue) into the back of the
+	*        lane given by E::kPriority
+	*
+	* An rvalue is only moved from if it is queued (or coalesced), so it can
+	* be pushed again if the queue was full.
+	*
+	* @param deadline Time after which the event is dropped instead of
+	*        dispatched
+	*
+	* @retval false if the event was not queued because the queue is full
+	*/
+	template <typename EV>
+	bool push(EV&& e, TimePoint deadline = kNoDeadline)
+	{
+		using E = std::decay_t<EV>;
+		
+		static_assert(E::kPriority < kLanes, "E::kPriority must be less than kLanes");
+
+		if constexpr (E::kCoalesce != Coalesce::kNone)
+		{
+			Index& pending = _pending[detail::index_of_v<E, Events>];
+			if (pending != kNone)
+			{
+				_coalesce(_slots[pending], std::forward<EV>(e), deadline);
+				return true;
+			}
+		}
+
+		Index i = _allocate();
+		if (i == kNone)
+		{
+			if constexpr (kOverflow == Overflow::kDropOldest)
+			{
+				_discard(_unlink(detail::lowest_bit(_nonEmpty)));
+				++_dropped;
+				i = _allocate();
+			}
+			else
+			{
+				if constexpr (kOverflow != Overflow::kBlock)
+				{
+					++_dropped;
+				}
+				return false;
+			}
+		}
+
+		Slot& slot = _slots[i];
+		slot.event = ::new (static_cast<void*>(slot.storage)) E(std::forward<EV>(e));
+		slot.ops = &kOps<E>;
+		slot.deadline = deadline;
+		slot.pending = nullptr;
+
+		if constexpr (E::kCoalesce != Coalesce::kNone)
+		{
+			slot.pending = &_pending[detail::index_of_v<E, Events>];
+			*slot.pending = i;
+		}
+
+		_link(E::kPriority, i);
+		return true;
+	}
+
+	/**
+	* @brief Copy (or move) event e into the queue with a deadline relative
+	*        to now
+	*/
+	template <typename EV, typename REP, typename PERIOD>
+	bool push(EV&& e, std::chrono::duration<REP, PERIOD> timeout)
+	{
+		return push(std::forward<EV>(e), Clock::now() + timeout);
+	}
+
+	/**
+	* @brief Copy event e into the queue only if a state in the active 
+	*        configuration of sm would handle (or defer) it
+	*
+	* Events which would only be passed up to the root are discarded 
+	* immediately and counted in QueueStats::filtered.
+	*
+	* @retval false if the event was filtered out or could not be queued
+	*/
+	template <typename SM, typename EV>
+	bool push_if_handled(const SM& sm, EV&& e, TimePoint deadline = kNoDeadline)
+	{
+		if (!sm.template would_handle<std::decay_t<EV>>())
+		{
+			++_filtered;
+			return false;
+		}
+
+		return push(std::forward<EV>(e), deadline);
+	}
+
+	/**
+	* @brief Remove the highest-priority event which has not expired and
+	*        pass it to f before destroying it (f may move from it)
+	*
+	* @retval false if there was no such event
+	*/
+	template <typename F>
+	bool pop(F&& f)
+	{
+		while (_nonEmpty != 0)
+		{
+			const Index i = _unlink(detail::highest_bit(_nonEmpty));
+			Slot& slot = _slots[i];
+
+			if (_expire(slot))
+			{
+				_discard(i);
+				continue;
+			}
+
+			f(*slot.event);
+			_discard(i);
+			return true;
+		}
+
+		return false;
+	}
+
+	/**
+	* @brief Move the highest-priority event which has not expired into out
+	*
+	* @retval false if there was no such event
+	*/
+	bool pop(Envelope& out)
+	{
+		out.reset();
+
+		while (_nonEmpty != 0)
+		{
+			const Index i = _unlink(detail::highest_bit(_nonEmpty));
+			Slot& slot = _slots[i];
+
+			if (_expire(slot))
+			{
+				_discard(i);
+				continue;
+			}
+
+			out._event = slot.ops->relocate(out._storage, slot.storage);
+			out._ops = slot.ops;
+			_free(i);
+			return true;
+		}
+
+		return false;
+	}
+
+	/**
+	* @brief Dispatch the next event into state machine sm, which owns it for
+	*        the RTC step (see StateMachine::dispatch(Event&&))
+	*
+	* @retval false if there was no event to dispatch
+	*/
+	template <typename SM>
+	bool dispatch_next(SM& sm)
+	{
+		return pop([&sm](Event& e){ sm.dispatch(std::move(e)); });
+	}
+
+	/**
+	* @brief Destroy all queued events
+	*/
+	void clear()
+	{
+		while (_nonEmpty != 0)
+		{
+			_discard(_unlink(detail::highest_bit(_nonEmpty)));
+		}
+	}
+
+private:
+	template <typename E>
+	static void _destroy(void* p)
+	{
+		static_cast<E*>(p)->~E();
+	}
+
+	template <typename E>
+	static Event* _relocate(void* dst, void* src)
+	{
+		E* e = static_cast<E*>(src);
+		Event* moved = ::new (dst) E(std::move(*e));
+		e->~E();
+		return moved;
+	}
+
+	template <typename E>
+	inline static constexpr Ops kOps = {&_destroy<E>, &_relocate<E>};
+
+	struct Slot
+	{
+		alignas(detail::storage_for<Events>::align)
+		unsigned char storage[detail::storage_for<Events>::size];
+		Event* event;
+		const Ops* ops;
+		TimePoint deadline;
+		Index* pending;
+		Index next;
+	};
+
+	struct Lane
+	{
+		Index head;
+		Index tail;
+	};
+
+	template <typename EV>
+	void _coalesce(Slot& slot, EV&& e, TimePoint deadline)
+	{
+		using E = std::decay_t<EV>;
+		E* pending = std::launder(reinterpret_cast<E*>(slot.storage));
+
+		if constexpr (E::kCoalesce == Coalesce::kMerge)
+		{
+			pending->merge(e);
+		}
+		else
+		{
+			pending->~E();
+			slot.event = ::new (static_cast<void*>(slot.storage)) E(std::forward<EV>(e));
+		}
+
+		slot.deadline = deadline;
+		++_coalesced;
+	}
+
+	/**
+	* @retval true if the event in slot has passed its deadline (it is counted)
+	*/
+	bool _expire(const Slot& slot)
+	{
+		if (slot.deadline != kNoDeadline && Clock::now() > slot.deadline)
+		{
+			++_expired;
+			return true;
+		}
+		return false;
+	}
+
+	/**
+	* @brief Destroy the event of an unlinked slot and return the slot to the
+	*        free list
+	*/
+	void _discard(Index i)
+	{
+		_slots[i].ops->destroy(_slots[i].storage);
+		_free(i);
+	}
+
+	Index _allocate()
+	{
+		const Index i = _freeHead;
+		if (i != kNone)
+		{
+			_freeHead = _slots[i].next;
+			_highWaterMark = std::max(_highWaterMark, ++_size);
+		}
+		return i;
+	}
+
+	void _free(Index i)
+	{
+		_slots[i].next = _freeHead;
+		_freeHead = i;
+		--_size;
+	}
+
+	void _link(std::size_t lane, Index i)
+	{
+		Lane& l = _lanes[lane];
+		_slots[i].next = kNone;
+
+		if (l.tail == kNone)
+		{
+			l.head = i;
+			_nonEmpty |= std::uint32_t(1) << lane;
+		}
+		else
+		{
+			_slots[l.tail].next = i;
+		}
+
+		l.tail = i;
+	}
+
+	Index _unlink(std::size_t lane)
+	{
+		Lane& l = _lanes[lane];
+		const Index i = l.head;
+
+		l.head = _slots[i].next;
+		if (l.head == kNone)
+		{
+			l.tail = kNone;
+			_nonEmpty &= ~(std::uint32_t(1) << lane);
+		}
+
+		//A coalescable event stops being pending once it leaves the queue
+		if (_slots[i].pending)
+		{
+			*_slots[i].pending = kNone;
+		}
+
+		return i;
+	}
+
+private:
+	Slot _slots[kCapacity];
+	Lane _lanes[kLanes];
+	Index _pending[detail::size_v<Events>];
+	Index _freeHead = 0;
+	std::uint32_t _nonEmpty = 0;
+	std::size_t _size = 0;
+	std::size_t _highWaterMark = 0;
+	std::size_t _dropped = 0;
+	std::size_t _expired = 0;
+	std::size_t _coalesced = 0;
+	std::size_t _filtered = 0;
+};
+
+} //namespace pw::hsm
+
+#endif //INCLUDE_PW_HSM_QUEUE_HPP_
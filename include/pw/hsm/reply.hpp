@@ -0,0 +1,258 @@
+#ifndef INCLUDE_PW_HSM_REPLY_HPP_
+#define INCLUDE_PW_HSM_REPLY_HPP_
+
+#include <pw/hsm.hpp>
+#include <pw/hsm/futex.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <new>
+#include <thread>
+#include <utility>
+
+//==============================================================================
+
+namespace pw::hsm
+{
+
+template <typename E, typename HANDLER, typename T>
+class Request;
+
+/**
+* @brief Slot, owned by the caller, which receives the reply to a
+*        @ref Request
+*
+* The slot holds the reply in place, so requesting and replying allocate
+* nothing. Every request made with the slot gets a new ticket, which makes
+* the previous request stale: if the caller stopped waiting for a reply and
+* made another request, a late reply to the first one is discarded.
+*
+* A request only refers to the slot, so the slot must outlive the requests
+* made with it, including those still queued after their caller gave up. A
+* slot on the stack is therefore only safe for requests which are dispatched
+* before the caller returns; a caller which waits with a timeout should own a
+* long-lived slot (e.g., a member) and reuse it for its requests.
+*
+* One thread at a time makes requests with a slot and reads its reply.
+*
+* @tparam T Typename of the reply
+*/
+template <typename T>
+class Reply
+{
+	template <typename E_, typename HANDLER_, typename T_>
+	friend class Request;
+
+	/*
+	* The state word holds the ticket of the current request in its upper
+	* bits, whether the caller sleeps on the word and the request's phase
+	*/
+	static constexpr std::uint32_t kPending = 0;
+	static constexpr std::uint32_t kWriting = 1;
+	static constexpr std::uint32_t kReady = 2;
+	static constexpr std::uint32_t kPhase = 3;
+	static constexpr std::uint32_t kWaiting = 4;
+	static constexpr std::uint32_t kTicket = 8;
+
+public:
+	Reply() = default;
+
+	Reply(const Reply&) = delete;
+	Reply& operator=(const Reply&) = delete;
+
+	~Reply()
+	{
+		if (ready())
+		{
+			_value().~T();
+		}
+	}
+
+	/**
+	* @retval true if the current request has been replied to
+	*/
+	bool ready() const
+	{
+		return (_state.load(std::memory_order_acquire) & kPhase) == kReady;
+	}
+
+	/**
+	* @return The reply to the current request, or nullptr if there is none
+	*         (yet)
+	*/
+	const T* get() const
+	{
+		return ready() ? &_value() : nullptr;
+	}
+
+	/**
+	* @brief Sleep until the current request is replied to, for timeout at
+	*        most
+	*
+	* @return The reply, or nullptr if the timeout expired first
+	*/
+	template <typename REP, typename PERIOD>
+	const T* wait_for(std::chrono::duration<REP, PERIOD> timeout)
+	{
+		const auto deadline = std::chrono::steady_clock::now() +
+			std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeout);
+
+		std::uint32_t state = _state.fetch_or(kWaiting, std::memory_order_acquire) | kWaiting;
+
+		for (;;)
+		{
+			const auto now = std::chrono::steady_clock::now();
+			if ((state & kPhase) == kReady || now >= deadline)
+			{
+				break;
+			}
+
+			//Returns at once if the word no longer holds state (e.g., replied)
+			detail::futex_wait_for(_state, state, std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - now));
+			state = _state.load(std::memory_order_acquire);
+		}
+
+		if (state & kWaiting)
+		{
+			_state.fetch_and(~kWaiting, std::memory_order_relaxed);
+		}
+
+		return get();
+	}
+
+private:
+	/**
+	* @brief Discard the reply to the previous request (or make a late one be
+	*        discarded) and return the ticket of a new request
+	*/
+	std::uint32_t _begin()
+	{
+		std::uint32_t state = _state.load(std::memory_order_acquire);
+
+		for (;;)
+		{
+			const std::uint32_t next = (state & ~(kPhase | kWaiting)) + kTicket;
+
+			switch (state & kPhase)
+			{
+			case kReady:
+				//Nobody else may write once a request has been replied to
+				_value().~T();
+				_state.store(next, std::memory_order_relaxed);
+				return next;
+
+			case kWriting:
+				//A late reply is being written, which is short
+				std::this_thread::yield();
+				state = _state.load(std::memory_order_acquire);
+				break;
+
+			default:
+				if (_state.compare_exchange_weak(state, next, std::memory_order_acquire))
+				{
+					return next;
+				}
+				break;
+			}
+		}
+	}
+
+	/**
+	* @brief Construct the reply to the request with ticket, unless another
+	*        request was made since or it has been replied to already
+	*/
+	template <typename ... ARGS>
+	bool _fulfill(std::uint32_t ticket, ARGS&& ... args)
+	{
+		std::uint32_t state = _state.load(std::memory_order_relaxed);
+		do
+		{
+			if ((state & ~kWaiting) != (ticket | kPending))
+			{
+				return false;
+			}
+		} while (!_state.compare_exchange_weak(state, (state & kWaiting) | ticket | kWriting, std::memory_order_acquire, std::memory_order_relaxed));
+
+		::new (_storage) T(std::forward<ARGS>(args)...);
+
+		if (_state.exchange(ticket | kReady, std::memory_order_release) & kWaiting)
+		{
+			detail::futex_wake(_state);
+		}
+
+		return true;
+	}
+
+	const T& _value() const { return *std::launder(reinterpret_cast<const T*>(_storage)); }
+	T& _value() { return *std::launder(reinterpret_cast<T*>(_storage)); }
+
+private:
+	std::atomic<std::uint32_t> _state{0};
+	alignas(T) unsigned char _storage[sizeof(T)];
+};
+
+/**
+* @brief Base class of an event which asks the state handling it for a reply
+*        of type T
+*
+* The caller constructs the request with a @ref Reply slot, then either
+* dispatches it and reads the slot right away, or pushes it into the queue
+* of a machine running on another thread and waits for the slot:
+*     class EGetConfig : public pw::hsm::Request<EGetConfig, Handler, Config> { using Request::Request; };
+*     pw::hsm::Reply<Config> config;
+*     sm.dispatch(EGetConfig(config));
+*     if (const Config* c = config.get()) ...
+* The handler replies with e.reply(...), which constructs the reply in the
+* slot. Only the first reply counts; if no state replies (e.g., the event
+* was passed), the slot stays empty.
+*
+* A request is just a pointer to its slot and a ticket, so it is cheap to
+* copy into queues.
+*
+* @tparam E Typename of the event (CRTP)
+* @tparam HANDLER Typename of the handler/visitor base class
+* @tparam T Typename of the reply
+*/
+template <typename E, typename HANDLER, typename T>
+class Request : public Event<E, HANDLER>
+{
+public:
+	using ReplyType = T;
+
+public:
+	/**
+	* @brief A request nobody waits for (replies are discarded)
+	*/
+	Request() = default;
+
+	/**
+	* @brief A new request, whose reply goes into slot (which forgets the
+	*        previous request made with it)
+	*/
+	explicit Request(Reply<T>& slot) :
+		_slot(&slot),
+		_ticket(slot._begin())
+	{
+
+	}
+
+	/**
+	* @brief Construct the reply from args in the caller's slot
+	*
+	* @retval false if the request was already replied to, or the caller has
+	*         made another request with the slot since
+	*/
+	template <typename ... ARGS>
+	bool reply(ARGS&& ... args) const
+	{
+		return _slot && _slot->_fulfill(_ticket, std::forward<ARGS>(args)...);
+	}
+
+private:
+	Reply<T>* _slot = nullptr;
+	std::uint32_t _ticket = 0;
+};
+
+} //namespace pw::hsm
+
+#endif //INCLUDE_PW_HSM_REPLY_HPP_
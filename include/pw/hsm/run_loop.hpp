@@ -0,0 +1,193 @@
+#ifndef INCLUDE_PW_HSM_RUN_LOOP_HPP_
+#define INCLUDE_PW_HSM_RUN_LOOP_HPP_
+
+#include <pw/hsm.hpp>
+#include <pw/hsm/clock.hpp>
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+
+//==============================================================================
+
+namespace pw::hsm
+{
+
+/**
+* @brief Statistics of a RunLoop
+*/
+struct RunLoopStats
+{
+	/**
+	* @brief Number of times the loop went to sleep and woke up again
+	*/
+	std::size_t wakeups;
+
+	/**
+	* @brief Number of events popped from the queue and dispatched
+	*/
+	std::size_t events;
+
+	/**
+	* @brief Number of timers which expired
+	*/
+	std::size_t timers;
+};
+
+/**
+* @brief Tickless event loop which feeds a StateMachine from a queue and a
+*        timer service
+*
+* When there is nothing to dispatch, the loop sleeps until either an event is
+* pushed into the queue or the timer service's next deadline is reached,
+* whichever comes first. If no timer is armed, it sleeps until an event
+* arrives. No synthetic tick events are generated, so an idle machine does
+* not wake up at all and timeouts expire within one timer tick of their
+* deadline rather than at the next poll.
+*
+* If the timer service uses a @ref VirtualClock, the loop never sleeps.
+* Whenever the queue is empty it moves the clock straight to the next timer
+* deadline, so simulated time passes as fast as the events can be dispatched.
+*
+* The loop must run on the thread which owns the timer service; events may be
+* pushed into the queue from any thread.
+*
+* @tparam QUEUE Typename of the queue (e.g., @ref LockingEventQueue)
+* @tparam TIMERS Typename of the timer service (e.g., @ref TimerService)
+*/
+template <typename QUEUE, typename TIMERS>
+class RunLoop
+{
+public:
+	using Envelope = typename QUEUE::Envelope;
+	using Clock = typename TIMERS::Clock;
+	using TimePoint = typename TIMERS::TimePoint;
+
+public:
+	RunLoop(QUEUE& queue, TIMERS& timers) :
+		_queue(queue),
+		_timers(timers)
+	{
+
+	}
+
+	RunLoop(const RunLoop&) = delete;
+	RunLoop& operator=(const RunLoop&) = delete;
+
+	/**
+	* @brief Dispatch events and expire timers until stop() is called
+	*
+	* With a virtual clock, this also returns once the queue is empty and no
+	* timer is armed, since nothing can happen after that.
+	*/
+	template <typename SM>
+	void run(SM& sm)
+	{
+		while (run_once(sm))
+		{
+
+		}
+	}
+
+	/**
+	* @brief Dispatch events and expire timers until the clock reaches time
+	*        limit or stop() is called
+	*
+	* Timers which expire exactly at limit fire on the next call.
+	*/
+	template <typename SM>
+	void run_until(SM& sm, TimePoint limit)
+	{
+		while (Clock::now() < limit && _step(sm, limit))
+		{
+
+		}
+	}
+
+	/**
+	* @brief Dispatch events and expire timers for duration d of clock time
+	*/
+	template <typename SM, typename REP, typename PERIOD>
+	void run_for(SM& sm, std::chrono::duration<REP, PERIOD> d)
+	{
+		run_until(sm, Clock::now() + std::chrono::duration_cast<typename Clock::duration>(d));
+	}
+
+	/**
+	* @brief Expire due timers and dispatch one event, sleeping until one is
+	*        available or the next timer is due if there is none
+	*
+	* @retval false if the loop has been stopped (or, with a virtual clock, has
+	*         nothing left to do)
+	*/
+	template <typename SM>
+	bool run_once(SM& sm)
+	{
+		return _step(sm, TimePoint::max());
+	}
+
+	/**
+	* @brief Make run() return once the current event has been dispatched
+	*
+	* This may be called from any thread (but not from a signal handler).
+	*/
+	void stop()
+	{
+		_stop.store(true, std::memory_order_relaxed);
+		_queue.wake();
+	}
+
+	/**
+	* @return Statistics of the loop (must be called from the loop's thread)
+	*/
+	const RunLoopStats& stats() const { return _stats; }
+
+private:
+	template <typename SM>
+	bool _step(SM& sm, TimePoint limit)
+	{
+		if (_stop.load(std::memory_order_relaxed))
+		{
+			return false;
+		}
+
+		_stats.timers += _timers.advance();
+
+		Envelope e;
+		if (!_queue.try_pop(e))
+		{
+			//Handlers run on this thread, so the deadline cannot change while asleep
+			const TimePoint until = std::min(_timers.next_deadline(), limit);
+			++_stats.wakeups;
+
+			if constexpr (detail::is_virtual_clock_v<Clock>)
+			{
+				if (until == TimePoint::max())
+				{
+					return false;
+				}
+
+				Clock::advance_to(until);
+				return !_stop.load(std::memory_order_relaxed);
+			}
+			else if (!_queue.try_wait_and_pop_until(e, until))
+			{
+				return !_stop.load(std::memory_order_relaxed);
+			}
+		}
+
+		sm.dispatch(std::move(*e));
+		++_stats.events;
+
+		return !_stop.load(std::memory_order_relaxed);
+	}
+
+private:
+	QUEUE& _queue;
+	TIMERS& _timers;
+	std::atomic<bool> _stop{false};
+	RunLoopStats _stats{};
+};
+
+} //namespace pw::hsm
+
+#endif //INCLUDE_PW_HSM_RUN_LOOP_HPP_
@@ -0,0 +1,742 @@
+#ifndef INCLUDE_PW_HSM_SHARDED_HPP_
+#define INCLUDE_PW_HSM_SHARDED_HPP_
+
+#include <pw/hsm.hpp>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+//==============================================================================
+
+namespace pw::hsm
+{
+
+/**
+* @brief Compile-time configuration of a ShardedRuntime
+*
+* To change a setting, inherit from ShardConfig, redeclare the setting and
+* pass the new type as the CONFIG argument of ShardedRuntime.
+*/
+struct ShardConfig
+{
+	/**
+	* @brief Number of events each shard-to-shard queue can hold (must be a
+	*        power of 2)
+	*/
+	static constexpr std::size_t kRingCapacity = 256;
+
+	/**
+	* @brief Number of events each shard's queue for posts from threads other
+	*        than shards can hold (must be a power of 2)
+	*/
+	static constexpr std::size_t kIngressCapacity = 1024;
+
+	/**
+	* @brief Maximum number of events a shard takes from one queue before it
+	*        moves on to the next
+	*/
+	static constexpr std::size_t kBudget = 64;
+
+	/**
+	* @brief Number of times an idle shard looks for work before it sleeps
+	*/
+	static constexpr std::size_t kSpins = 64;
+
+	/**
+	* @brief Whether each shard's thread is pinned to its own CPU (Linux only)
+	*/
+	static constexpr bool kPin = true;
+};
+
+/**
+* @brief Statistics of one shard of a ShardedRuntime
+*/
+struct ShardStats
+{
+	/**
+	* @brief Number of events dispatched into the shard's machines
+	*/
+	std::size_t dispatched;
+
+	/**
+	* @brief Number of machines living on the shard
+	*/
+	std::size_t machines;
+
+	/**
+	* @brief Number of events posted to the shard which were dropped because
+	*        the queue they were posted into was full
+	*/
+	std::size_t dropped;
+
+	/**
+	* @brief Number of events for new keys which were dropped because the
+	*        shard had no room for another machine
+	*/
+	std::size_t rejected;
+
+	/**
+	* @brief CPU the shard's thread is pinned to, or -1 if it is not pinned
+	*/
+	int cpu;
+};
+
+} //namespace pw::hsm
+
+//==============================================================================
+
+namespace pw::hsm::detail
+{
+
+/**
+* @brief Bounded single-producer/single-consumer queue of keyed events
+*
+* Events are stored in place and dispatched straight out of the ring, so
+* moving an event between shards costs one copy (or move, if it was posted as
+* an rvalue).
+*/
+template <typename HANDLER, typename KEY, std::size_t CAPACITY>
+class ShardRing
+{
+	static_assert(CAPACITY > 0 && (CAPACITY & (CAPACITY - 1)) == 0, "CAPACITY must be a power of 2");
+
+	using Event = AbstractEvent<HANDLER>;
+	using Events = handler_events_t<HANDLER>;
+
+	struct Slot
+	{
+		alignas(storage_for<Events>::align)
+		unsigned char storage[storage_for<Events>::size];
+		Event* event;
+		void (*destroy)(void* p);
+		KEY key;
+	};
+
+public:
+	ShardRing() = default;
+	ShardRing(const ShardRing&) = delete;
+	ShardRing& operator=(const ShardRing&) = delete;
+
+	~ShardRing()
+	{
+		while (_head != _tail.load(std::memory_order_relaxed))
+		{
+			Slot& slot = _slots[_head & (CAPACITY - 1)];
+			slot.destroy(slot.storage);
+			++_head;
+		}
+	}
+
+	/**
+	* @brief Copy event e (or move it, if it is an rvalue) for key into the
+	*        ring (producer only)
+	*
+	* @retval false if the ring was full (an rvalue is not moved from)
+	*/
+	template <typename EV>
+	bool push(const KEY& key, EV&& e)
+	{
+		using E = std::decay_t<EV>;
+
+		const std::size_t tail = _tail.load(std::memory_order_relaxed);
+
+		if (tail - _cachedHead >= CAPACITY)
+		{
+			_cachedHead = _published.load(std::memory_order_acquire);
+			if (tail - _cachedHead >= CAPACITY)
+			{
+				return false;
+			}
+		}
+
+		Slot& slot = _slots[tail & (CAPACITY - 1)];
+		slot.event = ::new (slot.storage) E(std::forward<EV>(e));
+		slot.destroy = &_destroy<E>;
+		slot.key = key;
+
+		_tail.store(tail + 1, std::memory_order_release);
+		return true;
+	}
+
+	/**
+	* @brief Pass up to max events to f(key, event), oldest first (consumer
+	*        only), which may move from the events
+	*
+	* @return The number of events passed to f
+	*/
+	template <typename F>
+	std::size_t drain(F&& f, std::size_t max)
+	{
+		const std::size_t tail = _tail.load(std::memory_order_acquire);
+		std::size_t n = 0;
+
+		while (_head != tail && n < max)
+		{
+			Slot& slot = _slots[_head & (CAPACITY - 1)];
+			f(slot.key, *slot.event);
+			slot.destroy(slot.storage);
+			++_head;
+			++n;
+		}
+
+		if (n > 0)
+		{
+			_published.store(_head, std::memory_order_release);
+		}
+
+		return n;
+	}
+
+	bool empty() const
+	{
+		return _published.load(std::memory_order_acquire) == _tail.load(std::memory_order_acquire);
+	}
+
+private:
+	template <typename E>
+	static void _destroy(void* p)
+	{
+		static_cast<E*>(p)->~E();
+	}
+
+private:
+	//Consumer side
+	alignas(64) std::size_t _head = 0;
+	std::atomic<std::size_t> _published{0};
+
+	//Producer side
+	alignas(64) std::atomic<std::size_t> _tail{0};
+	std::size_t _cachedHead = 0;
+
+	alignas(64) Slot _slots[CAPACITY];
+};
+
+/**
+* @brief Pin the calling thread to the index-th CPU it is allowed to run on
+*
+* @return The CPU pinned to, or -1 if the thread could not be pinned
+*/
+inline int pin_this_thread(std::size_t index)
+{
+#if defined(__linux__)
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0 || CPU_COUNT(&allowed) == 0)
+	{
+		return -1;
+	}
+
+	index %= std::size_t(CPU_COUNT(&allowed));
+
+	for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+	{
+		if (CPU_ISSET(cpu, &allowed) && index-- == 0)
+		{
+			cpu_set_t one;
+			CPU_ZERO(&one);
+			CPU_SET(cpu, &one);
+			return pthread_setaffinity_np(pthread_self(), sizeof(one), &one) == 0 ? cpu : -1;
+		}
+	}
+#else
+	(void)index;
+#endif
+
+	return -1;
+}
+
+} //namespace pw::hsm::detail
+
+//==============================================================================
+
+namespace pw::hsm
+{
+
+/**
+* @brief Runtime which partitions keyed state machines over shards, each of
+*        which is a thread pinned to its own CPU
+*
+* Events are posted with a key. The key's hash selects the shard, which
+* creates the key's machine on the first event for it and dispatches every
+* event for the key from then on. A machine is therefore only ever touched by
+* its shard's thread, so no locking is needed to dispatch into it.
+*
+* Every pair of shards is connected by a lock-free single-producer/
+* single-consumer queue, which carries the events that handlers running on
+* one shard post to keys of another. Threads which are not shards post into a
+* per-shard queue guarded by a mutex.
+*
+* Each shard allocates its machines and its incoming queues from its own
+* thread after it has been pinned. With Linux's default first-touch policy,
+* that memory is placed on the NUMA node of the shard's CPU.
+*
+* Machines are constructed with (ShardedRuntime&, const KEY&), (const KEY&)
+* or (), whichever SM supports first, and destroyed on their shard when the
+* runtime is destroyed.
+*
+* @tparam SM Typename of the state machine
+* @tparam KEY Typename of the routing key
+* @tparam CONFIG Compile-time configuration (see @ref ShardConfig)
+* @tparam HASH Hash function of KEY
+*/
+template <typename SM, typename KEY, typename CONFIG = ShardConfig, typename HASH = std::hash<KEY>>
+class ShardedRuntime
+{
+	using Handler = typename SM::RootState::Handler;
+	using Event = AbstractEvent<Handler>;
+	using Ring = detail::ShardRing<Handler, KEY, CONFIG::kRingCapacity>;
+	using Ingress = detail::ShardRing<Handler, KEY, CONFIG::kIngressCapacity>;
+
+	struct Shard;
+
+public:
+	/**
+	* @brief Start the shards' threads, each with room for up to capacity
+	*        machines
+	*/
+	ShardedRuntime(std::size_t shards, std::size_t capacity) :
+		_size(shards > 0 ? shards : 1),
+		_capacity(capacity),
+		_shards(new Shard[_size])
+	{
+		for (std::size_t i = 0; i < _size; ++i)
+		{
+			_shards[i].thread = std::thread([this, i]() { _run(i); });
+		}
+
+		//Wait for the shards to allocate their queues before accepting events
+		std::unique_lock<std::mutex> lock(_startGuard);
+		_started.wait(lock, [this]() { return _ready == _size; });
+	}
+
+	ShardedRuntime(const ShardedRuntime&) = delete;
+	ShardedRuntime& operator=(const ShardedRuntime&) = delete;
+
+	/**
+	* @brief Stop the shards and destroy the machines
+	*
+	* Events which have not been dispatched yet are discarded; call
+	* wait_idle() first to dispatch them.
+	*/
+	~ShardedRuntime()
+	{
+		_stop.store(true, std::memory_order_relaxed);
+
+		for (std::size_t i = 0; i < _size; ++i)
+		{
+			_wake(_shards[i]);
+		}
+
+		for (std::size_t i = 0; i < _size; ++i)
+		{
+			_shards[i].thread.join();
+		}
+	}
+
+	/**
+	* @return Number of shards
+	*/
+	std::size_t size() const { return _size; }
+
+	/**
+	* @return Index of the shard which owns key's machine
+	*/
+	std::size_t shard_of(const KEY& key) const
+	{
+		return HASH{}(key) % _size;
+	}
+
+	/**
+	* @brief Copy event e (or move it, if it is an rvalue) into the queue of
+	*        the shard which owns key's machine (from any thread)
+	*
+	* @retval false if the queue was full and the event was dropped
+	*/
+	template <typename EV>
+	bool post(const KEY& key, EV&& e)
+	{
+		Shard& to = _shards[shard_of(key)];
+		const Current& current = _current();
+		bool queued;
+
+		/*
+		* The event is counted as posted before it is pushed, so that it cannot
+		* be counted as consumed first, and counted as consumed straight away
+		* if it is dropped (see wait_idle()).
+		*/
+		if (current.runtime == this)
+		{
+			Shard& from = _shards[current.index];
+			_increment(from.posted);
+			queued = to.inbound[current.index].push(key, std::forward<EV>(e));
+			if (!queued)
+			{
+				_increment(from.consumed);
+			}
+		}
+		else
+		{
+			std::lock_guard<std::mutex> lock(to.ingressGuard);
+			_externalPosted.fetch_add(1, std::memory_order_release);
+			queued = to.ingress->push(key, std::forward<EV>(e));
+			if (!queued)
+			{
+				_externalDropped.fetch_add(1, std::memory_order_release);
+			}
+		}
+
+		if (!queued)
+		{
+			to.dropped.fetch_add(1, std::memory_order_relaxed);
+			return false;
+		}
+
+		//Pairs with the fence in _park() so that either the shard sees the event or we see it sleeping
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (to.sleeping.load(std::memory_order_relaxed))
+		{
+			_wake(to);
+		}
+
+		return true;
+	}
+
+	/**
+	* @brief Wait until every posted event has been dispatched
+	*
+	* Must not be called from a shard. Only meaningful while no other thread
+	* posts events.
+	*/
+	void wait_idle()
+	{
+		for (;;)
+		{
+			/*
+			* Counts only ever grow and an event is counted as posted before
+			* it is counted as dispatched (including the events posted by its
+			* handlers), so if the dispatched count read first equals the
+			* posted count read second, nothing was in flight in between.
+			*/
+			std::uint64_t dispatched = _externalDropped.load(std::memory_order_seq_cst);
+			for (std::size_t i = 0; i < _size; ++i)
+			{
+				dispatched += _shards[i].consumed.load(std::memory_order_seq_cst);
+			}
+
+			std::uint64_t posted = _externalPosted.load(std::memory_order_seq_cst);
+			for (std::size_t i = 0; i < _size; ++i)
+			{
+				posted += _shards[i].posted.load(std::memory_order_seq_cst);
+			}
+
+			if (dispatched == posted)
+			{
+				return;
+			}
+
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+		}
+	}
+
+	/**
+	* @return Statistics of shard
+	*/
+	ShardStats stats(std::size_t shard) const
+	{
+		const Shard& s = _shards[shard];
+		return {
+			s.dispatched.load(std::memory_order_relaxed),
+			s.machines.load(std::memory_order_relaxed),
+			s.dropped.load(std::memory_order_relaxed),
+			s.rejected.load(std::memory_order_relaxed),
+			s.cpu
+		};
+	}
+
+private:
+	/*
+	* Raw storage for a machine
+	*/
+	struct Storage
+	{
+		alignas(SM) unsigned char bytes[sizeof(SM)];
+	};
+
+	/*
+	* Entry of a shard's open-addressing table from key to machine
+	*/
+	struct Entry
+	{
+		KEY key;
+		SM* sm = nullptr;
+	};
+
+	struct alignas(64) Shard
+	{
+		std::thread thread;
+		int cpu = -1;
+
+		//Allocated by the shard's own thread
+		std::unique_ptr<Ring[]> inbound;
+		std::unique_ptr<Ingress> ingress;
+		std::unique_ptr<Storage[]> storage;
+		std::unique_ptr<Entry[]> table;
+		std::size_t mask = 0;
+
+		std::mutex ingressGuard;
+
+		//Written only by the shard, read by anyone
+		std::atomic<std::uint64_t> posted{0};
+		std::atomic<std::uint64_t> consumed{0};
+		std::atomic<std::size_t> dispatched{0};
+		std::atomic<std::size_t> machines{0};
+		std::atomic<std::size_t> rejected{0};
+
+		//Written by producers
+		std::atomic<std::size_t> dropped{0};
+
+		std::mutex sleepGuard;
+		std::condition_variable wakeup;
+		std::atomic<bool> sleeping{false};
+		bool signalled = false;
+	};
+
+	/*
+	* The runtime and index of the shard running on this thread (if any)
+	*/
+	struct Current
+	{
+		const ShardedRuntime* runtime = nullptr;
+		std::size_t index = 0;
+	};
+
+	static Current& _current()
+	{
+		static thread_local Current current;
+		return current;
+	}
+
+	/**
+	* @brief Increment a counter which only the calling thread writes
+	*/
+	template <typename T>
+	static void _increment(std::atomic<T>& counter)
+	{
+		counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+	}
+
+	void _wake(Shard& shard)
+	{
+		{
+			std::lock_guard<std::mutex> lock(shard.sleepGuard);
+			shard.signalled = true;
+		}
+		shard.wakeup.notify_one();
+	}
+
+	/**
+	* @return key's machine, creating it if necessary, or nullptr if the shard
+	*         is full
+	*/
+	SM* _find(Shard& shard, const KEY& key)
+	{
+		std::size_t i = HASH{}(key) / _size;
+
+		for (;; ++i)
+		{
+			Entry& entry = shard.table[i & shard.mask];
+
+			if (entry.sm == nullptr)
+			{
+				const std::size_t count = shard.machines.load(std::memory_order_relaxed);
+				if (count == _capacity)
+				{
+					return nullptr;
+				}
+
+				entry.key = key;
+				entry.sm = _construct(shard.storage[count].bytes, key);
+				shard.machines.store(count + 1, std::memory_order_relaxed);
+				return entry.sm;
+			}
+
+			if (entry.key == key)
+			{
+				return entry.sm;
+			}
+		}
+	}
+
+	SM* _construct(void* p, const KEY& key)
+	{
+		if constexpr (std::is_constructible_v<SM, ShardedRuntime&, const KEY&>)
+		{
+			return ::new (p) SM(*this, key);
+		}
+		else if constexpr (std::is_constructible_v<SM, const KEY&>)
+		{
+			return ::new (p) SM(key);
+		}
+		else
+		{
+			return ::new (p) SM();
+		}
+	}
+
+	std::size_t _drain(Shard& shard, std::size_t index)
+	{
+		auto dispatch = [this, &shard](const KEY& key, Event& e)
+		{
+			if (SM* sm = _find(shard, key))
+			{
+				sm->dispatch(std::move(e));
+				_increment(shard.dispatched);
+			}
+			else
+			{
+				_increment(shard.rejected);
+			}
+
+			//Counted after the handler so that the events it posted are counted first
+			_increment(shard.consumed);
+		};
+
+		std::size_t n = 0;
+
+		for (std::size_t i = 0; i < _size; ++i)
+		{
+			n += shard.inbound[(index + i) % _size].drain(dispatch, CONFIG::kBudget);
+		}
+
+		if (!shard.ingress->empty())
+		{
+			std::lock_guard<std::mutex> lock(shard.ingressGuard);
+			n += shard.ingress->drain(dispatch, CONFIG::kBudget);
+		}
+
+		return n;
+	}
+
+	bool _hasWork(const Shard& shard) const
+	{
+		if (!shard.ingress->empty())
+		{
+			return true;
+		}
+
+		for (std::size_t i = 0; i < _size; ++i)
+		{
+			if (!shard.inbound[i].empty())
+			{
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+	void _park(Shard& shard)
+	{
+		std::unique_lock<std::mutex> lock(shard.sleepGuard);
+
+		shard.sleeping.store(true, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		if (!_hasWork(shard) && !_stop.load(std::memory_order_relaxed))
+		{
+			shard.wakeup.wait(lock, [&]() { return shard.signalled; });
+		}
+
+		shard.signalled = false;
+		shard.sleeping.store(false, std::memory_order_relaxed);
+	}
+
+	void _run(std::size_t index)
+	{
+		Shard& shard = _shards[index];
+		_current() = Current{this, index};
+
+		if constexpr (CONFIG::kPin)
+		{
+			shard.cpu = detail::pin_this_thread(index);
+		}
+
+		//First touch from the pinned thread places these on its NUMA node
+		std::size_t tableSize = 1;
+		while (tableSize < _capacity * 2)
+		{
+			tableSize *= 2;
+		}
+
+		shard.inbound.reset(new Ring[_size]);
+		shard.ingress.reset(new Ingress);
+		shard.storage.reset(new Storage[_capacity > 0 ? _capacity : 1]);
+		shard.table.reset(new Entry[tableSize]);
+		shard.mask = tableSize - 1;
+
+		{
+			std::lock_guard<std::mutex> lock(_startGuard);
+			++_ready;
+		}
+		_started.notify_all();
+
+		std::size_t spins = 0;
+		while (!_stop.load(std::memory_order_relaxed))
+		{
+			if (_drain(shard, index) > 0)
+			{
+				spins = 0;
+			}
+			else if (++spins < CONFIG::kSpins)
+			{
+				std::this_thread::yield();
+			}
+			else
+			{
+				spins = 0;
+				_park(shard);
+			}
+		}
+
+		//Machines are destroyed by the thread which ran them
+		for (std::size_t i = 0; i <= shard.mask; ++i)
+		{
+			if (shard.table[i].sm)
+			{
+				shard.table[i].sm->~SM();
+				shard.table[i].sm = nullptr;
+			}
+		}
+	}
+
+private:
+	const std::size_t _size;
+	const std::size_t _capacity;
+	std::unique_ptr<Shard[]> _shards;
+
+	std::mutex _startGuard;
+	std::condition_variable _started;
+	std::size_t _ready = 0;
+
+	std::atomic<bool> _stop{false};
+	std::atomic<std::uint64_t> _externalPosted{0};
+	std::atomic<std::uint64_t> _externalDropped{0};
+};
+
+} //namespace pw::hsm
+
+#endif //INCLUDE_PW_HSM_SHARDED_HPP_
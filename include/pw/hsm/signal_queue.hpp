@@ -0,0 +1,190 @@
+#ifndef INCLUDE_PW_HSM_SIGNAL_QUEUE_HPP_
+#define INCLUDE_PW_HSM_SIGNAL_QUEUE_HPP_
+
+#include <pw/hsm.hpp>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+
+//==============================================================================
+
+namespace pw::hsm
+{
+
+/**
+* @brief Fixed-size, lock-free queue into which events may be posted from
+*        signal handlers and other interrupt-like contexts
+*
+* post() only copies the event into a preallocated slot and updates atomics;
+* it never allocates, locks or waits, so it is async-signal-safe and may be
+* called from any number of threads and nested handlers at once. Events are
+* copied without running their destructors, so they must be trivially
+* destructible, i.e., carry no payload or a small POD payload.
+*
+* The consumer (normally a @ref LockingEventQueue the signal queue has been
+* attached to) drains the events in the order they were posted. After every
+* post, the queue rings a doorbell so that the consumer wakes up; the
+* doorbell must be async-signal-safe too.
+*
+* @tparam HANDLER Typename of the handler/visitor base class
+* @tparam CAPACITY Number of events the queue can hold (must be a power of 2)
+*/
+template <typename HANDLER, std::size_t CAPACITY = 16>
+class SignalQueue
+{
+	static_assert(CAPACITY > 0 && (CAPACITY & (CAPACITY - 1)) == 0, "CAPACITY must be a power of 2");
+	static_assert(std::atomic<std::size_t>::is_always_lock_free, "Signal queues need lock-free atomics");
+
+	using Events = detail::handler_events_t<HANDLER>;
+
+	struct Slot
+	{
+		std::atomic<std::size_t> sequence;
+		std::uint8_t type;
+		alignas(detail::storage_for<Events>::align)
+		unsigned char storage[detail::storage_for<Events>::size];
+	};
+
+public:
+	/**
+	* @brief Function which wakes up the consumer (called with the target
+	*        passed to set_doorbell())
+	*/
+	using Doorbell = void (*)(void* target);
+
+public:
+	SignalQueue()
+	{
+		for (std::size_t i = 0; i < CAPACITY; ++i)
+		{
+			_slots[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	SignalQueue(const SignalQueue&) = delete;
+	SignalQueue& operator=(const SignalQueue&) = delete;
+
+	/**
+	* @brief Copy event e into the queue (async-signal-safe)
+	*
+	* @retval false if the queue was full and the event was dropped
+	*/
+	template <typename E>
+	bool post(const E& e) noexcept
+	{
+		static_assert(std::is_trivially_destructible_v<E>, "Events posted from signal handlers must be trivially destructible");
+		static_assert(std::is_nothrow_copy_constructible_v<E>, "Events posted from signal handlers must be copied without throwing");
+
+		std::size_t tail = _tail.load(std::memory_order_relaxed);
+		Slot* slot;
+
+		for (;;)
+		{
+			slot = &_slots[tail & (CAPACITY - 1)];
+			const std::size_t sequence = slot->sequence.load(std::memory_order_acquire);
+			const auto diff = static_cast<std::ptrdiff_t>(sequence - tail);
+
+			if (diff == 0)
+			{
+				if (_tail.compare_exchange_weak(tail, tail + 1, std::memory_order_relaxed))
+				{
+					break;
+				}
+			}
+			else if (diff < 0)
+			{
+				_dropped.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			}
+			else
+			{
+				tail = _tail.load(std::memory_order_relaxed);
+			}
+		}
+
+		::new (slot->storage) E(e);
+		slot->type = std::uint8_t(detail::index_of_v<E, Events>);
+		slot->sequence.store(tail + 1, std::memory_order_release);
+
+		if (const Doorbell ring = _doorbell.load(std::memory_order_acquire))
+		{
+			ring(_target.load(std::memory_order_relaxed));
+		}
+
+		return true;
+	}
+
+	/**
+	* @brief Pass the queued events to f in the order they were posted
+	*        (consumer only)
+	*
+	* f is called with each event as its concrete type, e.g., with a generic
+	* lambda. Draining stops at an event whose post() has not completed yet
+	* (e.g., because the handler posting it was interrupted); that post()
+	* rings the doorbell again when it completes.
+	*
+	* @return The number of events passed to f
+	*/
+	template <typename F>
+	std::size_t drain(F&& f)
+	{
+		std::size_t n = 0;
+
+		for (;; ++_head, ++n)
+		{
+			Slot& slot = _slots[_head & (CAPACITY - 1)];
+			if (slot.sequence.load(std::memory_order_acquire) != _head + 1)
+			{
+				return n;
+			}
+
+			_visit(slot.type, slot.storage, f, Events{});
+			slot.sequence.store(_head + CAPACITY, std::memory_order_release);
+		}
+	}
+
+	/**
+	* @brief Set the function which post() calls to wake up the consumer
+	*
+	* Call this before any signal handler may post into the queue.
+	*/
+	void set_doorbell(Doorbell ring, void* target)
+	{
+		_target.store(target, std::memory_order_relaxed);
+		_doorbell.store(ring, std::memory_order_release);
+	}
+
+	/**
+	* @return Number of events dropped because the queue was full
+	*/
+	std::size_t dropped() const
+	{
+		return _dropped.load(std::memory_order_relaxed);
+	}
+
+private:
+	template <typename F, typename ... Es>
+	static void _visit(std::size_t type, const void* storage, F& f, detail::TypeList<Es...>)
+	{
+		std::size_t i = 0;
+		((i++ == type ? (f(*std::launder(static_cast<const Es*>(storage))), true) : false) || ...);
+	}
+
+private:
+	//Consumer side
+	alignas(64) std::size_t _head = 0;
+
+	//Producer side
+	alignas(64) std::atomic<std::size_t> _tail{0};
+	std::atomic<std::size_t> _dropped{0};
+	std::atomic<Doorbell> _doorbell{nullptr};
+	std::atomic<void*> _target{nullptr};
+
+	Slot _slots[CAPACITY];
+};
+
+} //namespace pw::hsm
+
+#endif //INCLUDE_PW_HSM_SIGNAL_QUEUE_HPP_
@@ -0,0 +1,520 @@
+#ifndef INCLUDE_PW_HSM_TIMER_HPP_
+#define INCLUDE_PW_HSM_TIMER_HPP_
+
+#include <pw/hsm.hpp>
+#include <chrono>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+//==============================================================================
+
+namespace pw::hsm
+{
+
+/**
+* @brief Compile-time configuration of a TimerService
+*
+* To change a setting, inherit from TimerConfig, redeclare the setting and
+* pass the new type as the CONFIG argument of TimerService.
+*/
+struct TimerConfig
+{
+	/**
+	* @brief Clock from which expiry times are measured
+	*/
+	using Clock = std::chrono::steady_clock;
+
+	/**
+	* @brief Resolution of the timing wheel
+	*
+	* Timers expire at the first tick boundary at or after their deadline.
+	*/
+	using Tick = std::chrono::milliseconds;
+};
+
+} //namespace pw::hsm
+
+//==============================================================================
+
+namespace pw::hsm::detail
+{
+
+/**
+* @brief Intrusive link of a timer in one of the timing wheel's slot lists
+*
+* Slot lists are circular and doubly linked with the slot itself acting as the
+* list head, so unlinking a node never needs to know which list it is in.
+*/
+struct TimerLink
+{
+	TimerLink* prev = this;
+	TimerLink* next = this;
+
+	bool linked() const { return next != this; }
+
+	void unlink()
+	{
+		prev->next = next;
+		next->prev = prev;
+		prev = this;
+		next = this;
+	}
+
+	void push_back(TimerLink& node)
+	{
+		node.prev = prev;
+		node.next = this;
+		prev->next = &node;
+		prev = &node;
+	}
+
+	/**
+	* @brief Move all nodes of this list into the (empty) list other
+	*/
+	void splice_into(TimerLink& other)
+	{
+		if (linked())
+		{
+			other.next = next;
+			other.prev = prev;
+			next->prev = &other;
+			prev->next = &other;
+			prev = this;
+			next = this;
+		}
+	}
+};
+
+/**
+* @brief A timer as seen by the timing wheel
+*/
+struct TimerNode : TimerLink
+{
+	std::uint64_t expires = 0;
+	void (*fire)(TimerNode& node) = nullptr;
+};
+
+/*
+* Detects whether SINK accepts events through push(e) (e.g., an event queue)
+* rather than through dispatch(e) (e.g., a StateMachine)
+*/
+template <typename SINK, typename E, typename ENABLE = void>
+struct has_push : std::false_type {};
+
+template <typename SINK, typename E>
+struct has_push<SINK, E, std::void_t<decltype(std::declval<SINK&>().push(std::declval<const E&>()))>> :
+	std::true_type {};
+
+/**
+* @brief Deliver event e to sink, preferring sink.push(e) over sink.dispatch(e)
+*
+* A machine is given a copy of e, since the dispatch may exit the state which
+* owns e (e.g., the event of a Timer which is a member of a state).
+*/
+template <typename SINK, typename E>
+void post(SINK& sink, const E& e)
+{
+	if constexpr (has_push<SINK, E>::value)
+	{
+		sink.push(e);
+	}
+	else
+	{
+		E copy(e);
+		sink.dispatch(std::move(copy));
+	}
+}
+
+} //namespace pw::hsm::detail
+
+//==============================================================================
+
+namespace pw::hsm
+{
+
+/**
+* @brief Timer service based on a hierarchical timing wheel
+*
+* The wheel has four levels of 256 slots each. A timer is kept in the level
+* that matches how far in the future it expires and is moved (cascaded) to a
+* lower level when the wheel comes around to its slot. Arming and cancelling a
+* timer are O(1) and need no dynamic memory, since the timer's links live in
+* the timer object itself (see @ref Timer). This lets a single thread manage
+* millions of concurrent timers.
+*
+* The service is not thread-safe; it is meant to be advanced by the thread
+* which runs the state machines whose states own the timers.
+*
+* @tparam CONFIG Compile-time configuration (see @ref TimerConfig)
+*/
+template <typename CONFIG = TimerConfig>
+class TimerService
+{
+	static constexpr unsigned kLevels = 4;
+	static constexpr unsigned kSlotBits = 8;
+	static constexpr unsigned kSlots = 1u << kSlotBits;
+	static constexpr std::uint64_t kSlotMask = kSlots - 1;
+	static constexpr std::uint64_t kMaxDelta = (std::uint64_t(1) << (kLevels * kSlotBits)) - 1;
+	static constexpr unsigned kWordBits = 32;
+	static constexpr unsigned kWords = kSlots / kWordBits;
+
+public:
+	using Clock = typename CONFIG::Clock;
+	using TimePoint = typename Clock::time_point;
+	using Duration = typename Clock::duration;
+	using Tick = typename CONFIG::Tick;
+
+public:
+	TimerService() : _epoch(Clock::now()) {}
+
+	TimerService(const TimerService&) = delete;
+	TimerService& operator=(const TimerService&) = delete;
+
+	~TimerService()
+	{
+		//Detach (but do not fire) any timers which outlive the service
+		for (auto& level : _wheel)
+		{
+			for (auto& slot : level)
+			{
+				while (slot.linked())
+				{
+					slot.next->unlink();
+				}
+			}
+		}
+	}
+
+	/**
+	* @return Number of armed timers
+	*/
+	std::size_t size() const { return _size; }
+
+	/**
+	* @brief Arm node to expire at time deadline (re-arming it if it already
+	*        was)
+	*/
+	void arm(detail::TimerNode& node, TimePoint deadline)
+	{
+		cancel(node);
+
+		node.expires = _toTick(deadline);
+		_insert(node);
+		++_size;
+	}
+
+	/**
+	* @brief Disarm node (does nothing if it is not armed)
+	*/
+	void cancel(detail::TimerNode& node)
+	{
+		if (node.linked())
+		{
+			node.unlink();
+			--_size;
+		}
+	}
+
+	/**
+	* @brief Fire all timers which have expired by time now
+	*
+	* @return The number of timers fired
+	*/
+	std::size_t advance(TimePoint now)
+	{
+		const std::uint64_t target = _toTickFloor(now);
+		std::size_t fired = 0;
+
+		while (_current <= target)
+		{
+			if (_size == 0)
+			{
+				//Nothing to fire or cascade, jump straight to the target tick
+				_current = target + 1;
+				break;
+			}
+
+			const unsigned index = unsigned(_current & kSlotMask);
+			if (index == 0)
+			{
+				_cascade(1);
+			}
+
+			if (!_wheel[0][index].linked())
+			{
+				//Skip to the next occupied slot, the next cascade, or past target
+				const unsigned next = _nextOccupied(0, index + 1);
+				_current = std::min(_current - index + next, target + 1);
+				continue;
+			}
+
+			detail::TimerLink expired;
+			_wheel[0][index].splice_into(expired);
+			++_current;
+
+			//Timers may cancel or arm other timers as they fire
+			while (expired.linked())
+			{
+				auto& node = static_cast<detail::TimerNode&>(*expired.next);
+				node.unlink();
+				--_size;
+				++fired;
+				node.fire(node);
+			}
+		}
+
+		return fired;
+	}
+
+	/**
+	* @brief Fire all timers which have expired by now
+	*/
+	std::size_t advance()
+	{
+		return advance(Clock::now());
+	}
+
+	/**
+	* @return A time at or before which the next timer expires (or the wheel
+	*         must cascade timers towards it), or TimePoint::max() if no
+	*         timer is armed
+	*
+	* The returned time is exact for timers less than 256 ticks away. For
+	* timers further away it is the time of the next cascade of their slot,
+	* so a caller sleeping until then wakes at most once per wheel level
+	* before the timer actually expires.
+	*/
+	TimePoint next_deadline() const
+	{
+		if (_size == 0)
+		{
+			return TimePoint::max();
+		}
+
+		std::uint64_t next = ~std::uint64_t(0);
+
+		for (unsigned level = 0; level < kLevels; ++level)
+		{
+			const unsigned shift = level * kSlotBits;
+			const unsigned current = unsigned((_current >> shift) & kSlotMask);
+
+			/*
+			* The current slot of a level is cascaded (or, on level 0, fired)
+			* when the tick whose lower bits are all zero is processed. Once
+			* that has happened, anything in the slot belongs to the next
+			* rotation.
+			*/
+			const bool pending = (_current & ((std::uint64_t(1) << shift) - 1)) == 0;
+			const unsigned first = pending ? current : current + 1;
+
+			//Search from first to the end of the level, then wrap around
+			unsigned slot = _nextOccupied(level, first);
+			if (slot >= kSlots)
+			{
+				slot = _nextOccupied(level, 0);
+				slot = slot < first ? slot + kSlots : kSlots * 2;
+			}
+
+			if (slot < kSlots * 2)
+			{
+				const std::uint64_t block = (_current >> shift) - current + slot;
+				next = std::min(next, block << shift);
+			}
+		}
+
+		return _epoch + std::chrono::duration_cast<Duration>(Tick(next));
+	}
+
+private:
+	std::uint64_t _toTick(TimePoint t) const
+	{
+		if (t <= _epoch)
+		{
+			return 0;
+		}
+
+		//Round up so that a timer never expires before its deadline
+		return std::uint64_t(std::chrono::ceil<Tick>(t - _epoch).count());
+	}
+
+	std::uint64_t _toTickFloor(TimePoint t) const
+	{
+		if (t <= _epoch)
+		{
+			return 0;
+		}
+
+		return std::uint64_t(std::chrono::floor<Tick>(t - _epoch).count());
+	}
+
+	void _insert(detail::TimerNode& node)
+	{
+		//Timers which are already due go in the slot processed next
+		const std::uint64_t expires = std::max(node.expires, _current);
+		const std::uint64_t delta = std::min(expires - _current, kMaxDelta);
+		const std::uint64_t at = _current + delta;
+
+		unsigned level = 0;
+		while (level + 1 < kLevels && delta >= (std::uint64_t(1) << ((level + 1) * kSlotBits)))
+		{
+			++level;
+		}
+
+		const unsigned slot = unsigned((at >> (level * kSlotBits)) & kSlotMask);
+		_wheel[level][slot].push_back(node);
+		_occupied[level][slot / kWordBits] |= std::uint32_t(1) << (slot % kWordBits);
+	}
+
+	/**
+	* @return The index of the first non-empty slot of level at or after slot
+	*         from, or kSlots if there is none
+	*
+	* The occupancy bits are only set when a timer is inserted (cancelling a
+	* timer does not know its slot), so a bit may be stale. Stale bits are
+	* cleared here as they are found.
+	*/
+	unsigned _nextOccupied(unsigned level, unsigned from) const
+	{
+		while (from < kSlots)
+		{
+			const unsigned word = from / kWordBits;
+			const std::uint32_t bits = _occupied[level][word] & (~std::uint32_t(0) << (from % kWordBits));
+
+			if (bits == 0)
+			{
+				from = (word + 1) * kWordBits;
+				continue;
+			}
+
+			const unsigned slot = word * kWordBits + detail::lowest_bit(bits);
+			if (_wheel[level][slot].linked())
+			{
+				return slot;
+			}
+
+			_occupied[level][word] &= ~(std::uint32_t(1) << (slot % kWordBits));
+			from = slot + 1;
+		}
+
+		return kSlots;
+	}
+
+	/**
+	* @brief Re-insert the timers of the current slot of level (and, if that
+	*        slot is the first one, of the levels above) into lower levels
+	*/
+	void _cascade(unsigned level)
+	{
+		if (level >= kLevels)
+		{
+			return;
+		}
+
+		const unsigned index = unsigned((_current >> (level * kSlotBits)) & kSlotMask);
+		if (index == 0)
+		{
+			_cascade(level + 1);
+		}
+
+		detail::TimerLink moving;
+		_wheel[level][index].splice_into(moving);
+
+		while (moving.linked())
+		{
+			auto& node = static_cast<detail::TimerNode&>(*moving.next);
+			node.unlink();
+			_insert(node);
+		}
+	}
+
+private:
+	detail::TimerLink _wheel[kLevels][kSlots];
+	mutable std::uint32_t _occupied[kLevels][kWords] = {};
+	TimePoint _epoch;
+	std::uint64_t _current = 0;
+	std::size_t _size = 0;
+};
+
+/**
+* @brief A timer which posts event E into SINK when it expires
+*
+* A state which owns a Timer as a member thereby owns the timeout: since a
+* state is destroyed when it is exited, the timer is cancelled automatically
+* by the state's exit action. SINK is typically the machine's event queue
+* (anything with push(const E&)) or the StateMachine itself (dispatch), which
+* is given a copy of the event since the dispatch may destroy the timer.
+*
+* @tparam E Typename of the event posted on expiry
+* @tparam SINK Typename of the object the event is posted to
+* @tparam CONFIG Configuration of the TimerService
+*/
+template <typename E, typename SINK, typename CONFIG = TimerConfig>
+class Timer : private detail::TimerNode
+{
+public:
+	using Service = TimerService<CONFIG>;
+	using TimePoint = typename Service::TimePoint;
+
+public:
+	Timer(Service& service, SINK& sink, E event = E{}) :
+		_service(service),
+		_sink(sink),
+		_event(std::move(event))
+	{
+		this->fire = &Timer::_fire;
+	}
+
+	Timer(const Timer&) = delete;
+	Timer& operator=(const Timer&) = delete;
+
+	~Timer()
+	{
+		cancel();
+	}
+
+	/**
+	* @brief (Re)start the timer to expire after timeout
+	*/
+	template <typename REP, typename PERIOD>
+	void start(std::chrono::duration<REP, PERIOD> timeout)
+	{
+		_service.arm(*this, Service::Clock::now() + timeout);
+	}
+
+	/**
+	* @brief (Re)start the timer to expire at time deadline
+	*/
+	void start_at(TimePoint deadline)
+	{
+		_service.arm(*this, deadline);
+	}
+
+	void cancel()
+	{
+		_service.cancel(*this);
+	}
+
+	bool active() const { return this->linked(); }
+
+	/**
+	* @return The event which is posted on expiry
+	*/
+	E& event() { return _event; }
+
+private:
+	static void _fire(detail::TimerNode& node)
+	{
+		auto& self = static_cast<Timer&>(node);
+		detail::post(self._sink, self._event);
+	}
+
+private:
+	Service& _service;
+	SINK& _sink;
+	E _event;
+};
+
+} //namespace pw::hsm
+
+#endif //INCLUDE_PW_HSM_TIMER_HPP_
@@ -0,0 +1,98 @@
+#ifndef INCLUDE_PW_HSM_WAIT_HPP_
+#define INCLUDE_PW_HSM_WAIT_HPP_
+
+#include <pw/hsm.hpp>
+#include <pw/hsm/futex.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+//==============================================================================
+
+namespace pw::hsm::detail
+{
+
+/**
+* @brief Sleep until state S of sm is active or deadline is reached
+*/
+template <typename S, typename SM>
+bool wait_until_in(SM& sm, std::chrono::steady_clock::time_point deadline)
+{
+	if (SM::template is_within<S>(sm.active_state().leaf))
+	{
+		return true;
+	}
+
+	auto& slot = sm.active_state_slot();
+	std::atomic<std::uint32_t>& word = slot.sequence();
+
+	slot.enter_wait(&futex_wake);
+
+	bool reached = false;
+	for (;;)
+	{
+		const std::uint32_t seq = word.load(std::memory_order_seq_cst);
+
+		if (SM::template is_within<S>(slot.load().leaf))
+		{
+			reached = true;
+			break;
+		}
+
+		const auto now = std::chrono::steady_clock::now();
+		if (now >= deadline)
+		{
+			break;
+		}
+
+		//Returns at once if a transition was published since seq was read
+		futex_wait_for(word, seq, std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - now));
+	}
+
+	slot.leave_wait();
+	return reached;
+}
+
+} //namespace pw::hsm::detail
+
+//==============================================================================
+
+namespace pw::hsm
+{
+
+/**
+* @brief Block the calling thread until state S of sm is active, or for
+*        timeout at most
+*
+* sm must publish its active state (see DefaultConfig::kPublishActiveState)
+* and run on another thread. The caller sleeps on a futex keyed by the
+* seqlock's sequence number and is woken by the dispatching thread after each
+* transition, so it checks again only when the active state has changed.
+* While nobody waits, a transition only checks a counter of waiters.
+*
+* Like @ref StateMachine::active_state, this sees the regions of an
+* orthogonal state as a whole: S may be an orthogonal state or one of its
+* ancestors, but not a state inside one of its regions. Where futexes are not
+* available, the caller yields instead of sleeping.
+*
+* @retval false if the timeout expired first
+*/
+template <typename S, typename SM, typename REP, typename PERIOD>
+bool wait_until_in(SM& sm, std::chrono::duration<REP, PERIOD> timeout)
+{
+	return detail::wait_until_in<S>(sm, std::chrono::steady_clock::now() +
+		std::chrono::duration_cast<std::chrono::steady_clock::duration>(timeout));
+}
+
+/**
+* @brief Block the calling thread until state S of sm is active (see above)
+*/
+template <typename S, typename SM>
+void wait_until_in(SM& sm)
+{
+	detail::wait_until_in<S>(sm, std::chrono::steady_clock::time_point::max());
+}
+
+} //namespace pw::hsm
+
+#endif //INCLUDE_PW_HSM_WAIT_HPP_